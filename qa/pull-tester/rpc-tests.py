@@ -172,6 +172,7 @@ testScripts = [
     'game_bounties.py',
     'game_kills.py',
     'game_mempool.py',
+    'game_movevalidation.py',
     'game_minertaxes.py',
 
     # Other new tests for Huntercoin.
@@ -0,0 +1,57 @@
+#!/usr/bin/env python3
+
+# Copyright (c) 2026 Crypto Realities Ltd
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Check that moves are validated against the game rules already when
+# they enter the mempool, so that invalid ones can not break mining.
+
+from test_framework.game import GameTestFramework
+from test_framework.util import *
+
+import json
+
+class GameMoveValidationTest (GameTestFramework):
+
+  def run_test (self):
+    self.register (0, "locked", 0)
+    self.generate (0, 1)
+
+    # Lock the reward address to one that node 0 does not own.  Then
+    # node 0 can no longer change it.
+    print ("Locking the reward address...")
+    lockAddr = self.nodes[1].getnewaddress ()
+    self.nodes[0].name_update ("locked", json.dumps ({"addressLock": lockAddr}))
+    self.generate (0, 1)
+    assert 'addressLock' in self.nodes[1].game_getplayerstate ("locked")
+
+    # Try to change the address anyway.  This must be rejected by the
+    # mempool instead of failing later when building a block.
+    print ("Rejecting an invalid move...")
+    addr = self.nodes[0].getnewaddress ()
+    try:
+      self.nodes[0].name_update ("locked", json.dumps ({"address": addr}))
+      raise AssertionError ("invalid move accepted to the mempool")
+    except JSONRPCException as exc:
+      assert_equal (exc.error['code'], -4)
+    assert_equal (self.nodes[0].getrawmempool (), [])
+
+    # Mining still works and the address is unchanged.
+    self.generate (0, 1)
+    data = self.nodes[1].game_getplayerstate ("locked")
+    assert 'address' not in data
+
+if __name__ == '__main__':
+  GameMoveValidationTest ().main ()
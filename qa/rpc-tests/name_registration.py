@@ -71,6 +71,15 @@ class NameRegistrationTest (NameTestFramework):
     self.checkNameHistory (1, "node-0", ["value-0"])
     self.checkNameHistory (1, "node-1", ["x" * 520])
 
+    # Check name_show_many, including unknown and duplicate names.
+    many = self.nodes[1].name_show_many (["node-1", "unknown", "node-0",
+                                          "node-1"])
+    assert_equal (len (many), 4)
+    assert_equal (many[0], self.nodes[1].name_show ("node-1"))
+    assert_equal (many[1], None)
+    assert_equal (many[2], data)
+    assert_equal (many[3], many[0])
+
     # Check for error with rand mismatch (wrong name)
     newA = self.nodes[0].name_new ("test-name")
     self.generate (0, 10)
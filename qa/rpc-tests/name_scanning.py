@@ -68,6 +68,11 @@ class NameScanningTest (NameTestFramework):
     height = self.nodes[3].getblockcount ()
     self.checkList (self.nodes[3].name_filter (), ["a", "b", "c", "aa"])
     self.checkList (self.nodes[3].name_filter ("[ac]"), ["a", "c", "aa"])
+    self.checkList (self.nodes[3].name_filter ("^a"), ["a", "aa"])
+    self.checkList (self.nodes[3].name_filter ("^a$"), ["a"])
+    self.checkList (self.nodes[3].name_filter ("^ab?"), ["a", "aa"])
+    self.checkList (self.nodes[3].name_filter ("^aa", 0, 0, 1), ["aa"])
+    self.checkList (self.nodes[3].name_filter ("^z"), [])
     self.checkList (self.nodes[3].name_filter ("", 10), [])
     self.checkList (self.nodes[3].name_filter ("", 30), ["a", "c"])
     self.checkList (self.nodes[3].name_filter ("", 0, 0, 0),
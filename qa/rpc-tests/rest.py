@@ -389,5 +389,17 @@ class RESTTest (BitcoinTestFramework):
             res = http_get_call(url.hostname, url.port, query, True)
             assert_equal(res.status, http.client.BAD_REQUEST)
 
+        # Query multiple names at once.  Unknown names yield null.
+        query = ('/rest/name/many/' + urllib.parse.quote(name, safe='')
+                 + '/unknown' + self.FORMAT_SEPARATOR + 'json')
+        res = http_get_call(url.hostname, url.port, query, True)
+        assert_equal(res.status, 200)
+        data = json.loads(res.read().decode("ascii"))
+        assert_equal(data, [nameData, None])
+
+        query = '/rest/name/many/a/%' + self.FORMAT_SEPARATOR + 'json'
+        res = http_get_call(url.hostname, url.port, query, True)
+        assert_equal(res.status, http.client.BAD_REQUEST)
+
 if __name__ == '__main__':
     RESTTest ().main ()
@@ -18,5 +18,8 @@ echo "\nGame kills..."
 echo "\nGame mempool cleanup..."
 ./game_mempool.py
 
+echo "\nGame move validation..."
+./game_movevalidation.py
+
 echo "\nGame miner taxes..."
 ./game_minertaxes.py
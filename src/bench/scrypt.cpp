@@ -0,0 +1,32 @@
+// Copyright (C) 2016 Crypto Realities Ltd
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "scrypt/scrypt.h"
+
+#include <vector>
+
+/* Number of headers to hash per iteration */
+static const size_t HEADERS = 64;
+
+static void ScryptSingle(benchmark::State& state)
+{
+    std::vector<char> in(80 * HEADERS, 0);
+    std::vector<char> out(32 * HEADERS);
+    while (state.KeepRunning())
+        for (size_t i = 0; i < HEADERS; ++i)
+            scrypt_1024_1_1_256(&in[80 * i], &out[32 * i]);
+}
+
+static void ScryptMultiBuffer(benchmark::State& state)
+{
+    scrypt_detect_multi();
+    std::vector<char> in(80 * HEADERS, 0);
+    std::vector<char> out(32 * HEADERS);
+    while (state.KeepRunning())
+        scrypt_1024_1_1_256_multi(&in[0], &out[0], HEADERS);
+}
+
+BENCHMARK(ScryptSingle);
+BENCHMARK(ScryptMultiBuffer);
@@ -9,6 +9,7 @@
 #include "undo.h"
 #include "util.h"
 
+#include <algorithm>
 #include <assert.h>
 
 /**
@@ -60,11 +61,29 @@ bool CCoinsView::GetCoins(const uint256 &txid, CCoins &coins) const { return fal
 bool CCoinsView::HaveCoins(const uint256 &txid) const { return false; }
 uint256 CCoinsView::GetBestBlock() const { return uint256(); }
 bool CCoinsView::GetName(const valtype &name, CNameData &data) const { return false; }
-bool CCoinsView::GetNameHistory(const valtype &name, CNameHistory &data) const { return false; }
+unsigned CCoinsView::GetNameHistorySize(const valtype &name) const { return 0; }
+bool CCoinsView::GetNameHistoryEntries(const valtype &name, unsigned nFrom, unsigned nCount, std::vector<CNameData> &entries) const { entries.clear(); return true; }
 CNameIterator* CCoinsView::IterateNames() const { assert (false); }
+CNameIterator* CCoinsView::IterateNamesForAddress(const CScript &addr) const { assert (false); }
+CNameSnapshot* CCoinsView::SnapshotNames() const { assert (false); }
 bool CCoinsView::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CNameCache &names) { return false; }
 CCoinsViewCursor *CCoinsView::Cursor() const { return 0; }
-bool CCoinsView::ValidateNameDB(CGameDB& gameDb) const { return false; }
+bool CCoinsView::ValidateNameDB(CGameDB& gameDb, uint256& hashBlock) const { return false; }
+
+bool CCoinsView::GetNameHistory(const valtype &name, CNameHistory &data) const {
+    const unsigned nSize = GetNameHistorySize(name);
+    if (nSize == 0)
+        return false;
+
+    std::vector<CNameData> entries;
+    if (!GetNameHistoryEntries(name, 0, nSize, entries) || entries.size() != nSize)
+        return false;
+
+    data = CNameHistory();
+    BOOST_FOREACH(const CNameData& entry, entries)
+        data.push(entry);
+    return true;
+}
 
 
 CCoinsViewBacked::CCoinsViewBacked(CCoinsView *viewIn) : base(viewIn) { }
@@ -72,12 +91,15 @@ bool CCoinsViewBacked::GetCoins(const uint256 &txid, CCoins &coins) const { retu
 bool CCoinsViewBacked::HaveCoins(const uint256 &txid) const { return base->HaveCoins(txid); }
 uint256 CCoinsViewBacked::GetBestBlock() const { return base->GetBestBlock(); }
 bool CCoinsViewBacked::GetName(const valtype &name, CNameData &data) const { return base->GetName(name, data); }
-bool CCoinsViewBacked::GetNameHistory(const valtype &name, CNameHistory &data) const { return base->GetNameHistory(name, data); }
+unsigned CCoinsViewBacked::GetNameHistorySize(const valtype &name) const { return base->GetNameHistorySize(name); }
+bool CCoinsViewBacked::GetNameHistoryEntries(const valtype &name, unsigned nFrom, unsigned nCount, std::vector<CNameData> &entries) const { return base->GetNameHistoryEntries(name, nFrom, nCount, entries); }
 CNameIterator* CCoinsViewBacked::IterateNames() const { return base->IterateNames(); }
+CNameIterator* CCoinsViewBacked::IterateNamesForAddress(const CScript &addr) const { return base->IterateNamesForAddress(addr); }
+CNameSnapshot* CCoinsViewBacked::SnapshotNames() const { return base->SnapshotNames(); }
 void CCoinsViewBacked::SetBackend(CCoinsView &viewIn) { base = &viewIn; }
 bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CNameCache &names) { return base->BatchWrite(mapCoins, hashBlock, names); }
 CCoinsViewCursor *CCoinsViewBacked::Cursor() const { return base->Cursor(); }
-bool CCoinsViewBacked::ValidateNameDB(CGameDB& gameDb) const { return base->ValidateNameDB(gameDb); }
+bool CCoinsViewBacked::ValidateNameDB(CGameDB& gameDb, uint256& hashBlock) const { return base->ValidateNameDB(gameDb, hashBlock); }
 
 SaltedTxidHasher::SaltedTxidHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
 
@@ -89,7 +111,7 @@ CCoinsViewCache::~CCoinsViewCache()
 }
 
 size_t CCoinsViewCache::DynamicMemoryUsage() const {
-    return memusage::DynamicUsage(cacheCoins) + cachedCoinsUsage;
+    return memusage::DynamicUsage(cacheCoins) + cachedCoinsUsage + cacheNames.DynamicMemoryUsage();
 }
 
 CCoinsMap::const_iterator CCoinsViewCache::FetchCoins(const uint256 &txid) const {
@@ -200,20 +222,54 @@ bool CCoinsViewCache::GetName(const valtype &name, CNameData& data) const {
     return base->GetName(name, data);
 }
 
-bool CCoinsViewCache::GetNameHistory(const valtype &name, CNameHistory& data) const {
-    if (cacheNames.getHistory(name, data))
+unsigned CCoinsViewCache::GetNameHistorySize(const valtype &name) const {
+    const CNameCache::HistoryChanges* changes = cacheNames.getHistory(name);
+    if (changes)
+        return changes->nSize;
+
+    return base->GetNameHistorySize(name);
+}
+
+bool CCoinsViewCache::GetNameHistoryEntries(const valtype &name, unsigned nFrom, unsigned nCount, std::vector<CNameData> &entries) const {
+    const CNameCache::HistoryChanges* changes = cacheNames.getHistory(name);
+    if (!changes)
+        return base->GetNameHistoryEntries(name, nFrom, nCount, entries);
+
+    entries.clear();
+    const unsigned nEnd = std::min<uint64_t>(static_cast<uint64_t>(nFrom) + nCount, changes->nSize);
+    if (nFrom >= nEnd)
         return true;
 
-    /* Note: This does not attempt to cache backend queries.  The cache
-       only keeps track of changes!  */
+    /* Entries below the low water mark are unchanged and read from
+       the base view, the others are all in the cache.  */
+    if (nFrom < changes->nLowWater)
+    {
+        const unsigned nBaseEnd = std::min(nEnd, changes->nLowWater);
+        if (!base->GetNameHistoryEntries(name, nFrom, nBaseEnd - nFrom, entries))
+            return false;
+    }
+    for (unsigned i = std::max(nFrom, changes->nLowWater); i < nEnd; ++i)
+    {
+        const std::map<unsigned, CNameData>::const_iterator mi = changes->entries.find(i);
+        assert(mi != changes->entries.end());
+        entries.push_back(mi->second);
+    }
 
-    return base->GetNameHistory(name, data);
+    return true;
 }
 
 CNameIterator* CCoinsViewCache::IterateNames() const {
     return cacheNames.iterateNames(base->IterateNames());
 }
 
+CNameIterator* CCoinsViewCache::IterateNamesForAddress(const CScript &addr) const {
+    return cacheNames.iterateNamesForAddress(addr, base->IterateNamesForAddress(addr));
+}
+
+CNameSnapshot* CCoinsViewCache::SnapshotNames() const {
+    return cacheNames.snapshotNames(base->SnapshotNames());
+}
+
 /* undo is set if the change is due to disconnecting blocks / going back in
    time.  The ordinary case (!undo) means that we update the name normally,
    going forward in time.  This is important for keeping track of the
@@ -230,20 +286,16 @@ void CCoinsViewCache::SetName(const valtype &name, const CNameData& data, bool u
            for the name history.  */
         if (fNameHistory)
         {
-            CNameHistory history;
-            if (!GetNameHistory(name, history))
+            const unsigned nSize = GetNameHistorySize(name);
+            if (undo)
             {
-                /* Ensure that the history stack is indeed (still) empty
-                   and was not modified by the failing GetNameHistory call.  */
-                assert(history.empty());
+                std::vector<CNameData> top;
+                const bool fOk = (nSize > 0 && GetNameHistoryEntries(name, nSize - 1, 1, top));
+                assert(fOk && top.size() == 1 && top.back() == data);
+                cacheNames.popHistory(name, nSize);
             }
-
-            if (undo)
-                history.pop(data);
             else
-                history.push(oldData);
-
-            cacheNames.setHistory(name, history);
+                cacheNames.pushHistory(name, nSize, oldData);
         }
     } else
         assert (!undo);
@@ -255,8 +307,7 @@ void CCoinsViewCache::DeleteName(const valtype &name) {
     if (fNameHistory)
     {
         /* When deleting a name, the history should already be clean.  */
-        CNameHistory history;
-        assert (!GetNameHistory(name, history) || history.empty());
+        assert (GetNameHistorySize(name) == 0);
     }
 
     cacheNames.remove(name);
@@ -356,12 +356,26 @@ public:
     // Get a name (if it exists)
     virtual bool GetName(const valtype& name, CNameData& data) const;
 
-    // Get a name's history (if it exists)
-    virtual bool GetNameHistory(const valtype& name, CNameHistory& data) const;
+    // Get the number of entries in a name's history stack
+    virtual unsigned GetNameHistorySize(const valtype& name) const;
+
+    // Get the history entries of a name with indices in [nFrom, nFrom + nCount)
+    virtual bool GetNameHistoryEntries(const valtype& name, unsigned nFrom, unsigned nCount, std::vector<CNameData>& entries) const;
+
+    // Get a name's full history (if it exists)
+    bool GetNameHistory(const valtype& name, CNameHistory& data) const;
 
     // Get a name iterator.
     virtual CNameIterator* IterateNames() const;
 
+    // Get an iterator over the names owned by an address (requires
+    // -nameaddressindex).
+    virtual CNameIterator* IterateNamesForAddress(const CScript& addr) const;
+
+    // Get a snapshot of the names that can be iterated without holding
+    // the lock protecting this view.
+    virtual CNameSnapshot* SnapshotNames() const;
+
     //! Do a bulk modification (multiple CCoins changes + BestBlock change).
     //! The passed mapCoins can be modified.
     virtual bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CNameCache &names);
@@ -369,8 +383,11 @@ public:
     //! Get a cursor to iterate over the whole state
     virtual CCoinsViewCursor *Cursor() const;
 
-    // Validate the name database.
-    virtual bool ValidateNameDB(CGameDB& gameDb) const;
+    // Validate the name database.  This checks a snapshot of the state
+    // on disk, so it does not need cs_main.  If hashBlock is not null and
+    // matches the best block on disk, the check is skipped.  Otherwise it
+    // is set to the block that was checked.
+    virtual bool ValidateNameDB(CGameDB& gameDb, uint256& hashBlock) const;
 
     //! As we use CCoinsViews polymorphically, have a virtual destructor
     virtual ~CCoinsView() {}
@@ -389,12 +406,15 @@ public:
     bool HaveCoins(const uint256 &txid) const;
     uint256 GetBestBlock() const;
     bool GetName(const valtype& name, CNameData& data) const;
-    bool GetNameHistory(const valtype& name, CNameHistory& data) const;
+    unsigned GetNameHistorySize(const valtype& name) const;
+    bool GetNameHistoryEntries(const valtype& name, unsigned nFrom, unsigned nCount, std::vector<CNameData>& entries) const;
     CNameIterator* IterateNames() const;
+    CNameIterator* IterateNamesForAddress(const CScript& addr) const;
+    CNameSnapshot* SnapshotNames() const;
     void SetBackend(CCoinsView &viewIn);
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CNameCache &names);
     CCoinsViewCursor *Cursor() const;
-    bool ValidateNameDB(CGameDB& gameDb) const;
+    bool ValidateNameDB(CGameDB& gameDb, uint256& hashBlock) const;
 };
 
 
@@ -436,7 +456,6 @@ protected:
     mutable CCoinsMap cacheCoins;
 
     /* Cached dynamic memory usage for the inner CCoins objects. */
-    /* TODO: Sum up also name cache usage.  */
     mutable size_t cachedCoinsUsage;
 
     /** Name changes cache.  */
@@ -452,8 +471,11 @@ public:
     uint256 GetBestBlock() const;
     void SetBestBlock(const uint256 &hashBlock);
     bool GetName(const valtype &name, CNameData &data) const;
-    bool GetNameHistory(const valtype &name, CNameHistory &data) const;
+    unsigned GetNameHistorySize(const valtype &name) const;
+    bool GetNameHistoryEntries(const valtype &name, unsigned nFrom, unsigned nCount, std::vector<CNameData> &entries) const;
     CNameIterator* IterateNames() const;
+    CNameIterator* IterateNamesForAddress(const CScript& addr) const;
+    CNameSnapshot* SnapshotNames() const;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CNameCache &names);
 
     /* Changes to the name database.  */
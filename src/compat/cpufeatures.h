@@ -0,0 +1,39 @@
+// Copyright (c) 2016 Crypto Realities Ltd
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COMPAT_CPUFEATURES_H
+#define BITCOIN_COMPAT_CPUFEATURES_H
+
+/**
+ * Instruction set extensions that some code paths (scrypt-multi, the AI
+ * kernels) provide specialised implementations for.
+ */
+enum CPUFeature
+{
+    CPU_FEATURE_SSE2,
+    CPU_FEATURE_AVX2,
+};
+
+/**
+ * Check whether the CPU we are running on supports the given feature.
+ * This is the single place where the runtime probe is done, so that the
+ * dispatch code and the unit tests agree on what can be run.  On builds
+ * without the probe (non-x86 or non-GCC-compatible compilers), no
+ * feature is reported and callers fall back to their generic code.
+ */
+inline bool CPUHasFeature(CPUFeature feature)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    switch (feature) {
+    case CPU_FEATURE_SSE2:
+        return __builtin_cpu_supports("sse2");
+    case CPU_FEATURE_AVX2:
+        return __builtin_cpu_supports("avx2");
+    }
+#endif
+    return false;
+}
+
+#endif // BITCOIN_COMPAT_CPUFEATURES_H
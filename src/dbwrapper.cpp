@@ -122,6 +122,23 @@ bool CDBWrapper::IsEmpty()
     return !(it->Valid());
 }
 
+CDBSnapshot::CDBSnapshot(const CDBWrapper &_parent) : parent(_parent)
+{
+    psnapshot = parent.pdb->GetSnapshot();
+}
+
+CDBSnapshot::~CDBSnapshot()
+{
+    parent.pdb->ReleaseSnapshot(psnapshot);
+}
+
+CDBIterator *CDBSnapshot::NewIterator() const
+{
+    leveldb::ReadOptions options = parent.iteroptions;
+    options.snapshot = psnapshot;
+    return new CDBIterator(parent, parent.pdb->NewIterator(options));
+}
+
 CDBIterator::~CDBIterator() { delete piter; }
 bool CDBIterator::Valid() { return piter->Valid(); }
 void CDBIterator::SeekToFirst() { piter->SeekToFirst(); }
@@ -164,9 +164,35 @@ public:
 
 };
 
+/**
+ * Consistent read-only view of a CDBWrapper at the time it was created.
+ * Iterators created from it are not affected by later writes, and can be
+ * used concurrently from different threads.  The snapshot must not
+ * outlive its parent.
+ */
+class CDBSnapshot
+{
+private:
+    const CDBWrapper &parent;
+    const leveldb::Snapshot *psnapshot;
+
+    CDBSnapshot(const CDBSnapshot&);
+    void operator=(const CDBSnapshot&);
+
+public:
+    /**
+     * @param[in] _parent   CDBWrapper to take the snapshot of
+     */
+    CDBSnapshot(const CDBWrapper &_parent);
+    ~CDBSnapshot();
+
+    CDBIterator *NewIterator() const;
+};
+
 class CDBWrapper
 {
     friend const std::vector<unsigned char>& dbwrapper_private::GetObfuscateKey(const CDBWrapper &w);
+    friend class CDBSnapshot;
 private:
     //! custom environment this database is using (may be NULL in case of default environment)
     leveldb::Env* penv;
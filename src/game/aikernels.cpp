@@ -0,0 +1,351 @@
+// Copyright (C) 2016 Crypto Realities Ltd
+
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "game/aikernels.h"
+
+#include "compat/cpufeatures.h"
+#include "util.h"
+
+#ifdef USE_AI_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+/* Bit mask (one bit per colour) of the colours that are foes.  */
+static inline unsigned
+ForeignLanes (int ownColor)
+{
+  unsigned res = (1u << AI_KERNEL_COLORS) - 1;
+  if (ownColor >= 0 && ownColor < AI_KERNEL_COLORS)
+    res &= ~(1u << ownColor);
+  return res;
+}
+
+/* ************************************************************************** */
+/* Generic implementation.  */
+
+static uint32_t
+FoeMaskGeneric (const int (*scores)[AI_KERNEL_COLORS], int count, int ownColor)
+{
+  const unsigned foe = ForeignLanes (ownColor);
+  uint32_t res = 0;
+  for (int n = 0; n < count; ++n)
+    for (int k = 0; k < AI_KERNEL_COLORS; ++k)
+      if ((foe & (1u << k)) && scores[n][k] != 0)
+        {
+          res |= 1u << n;
+          break;
+        }
+  return res;
+}
+
+static uint32_t
+WeakFoeMaskGeneric (const int (*scores)[AI_KERNEL_COLORS], int count,
+                    int ownColor, int maxScore)
+{
+  const unsigned foe = ForeignLanes (ownColor);
+  uint32_t res = 0;
+  for (int n = 0; n < count; ++n)
+    for (int k = 0; k < AI_KERNEL_COLORS; ++k)
+      if ((foe & (1u << k)) && scores[n][k] > 0 && scores[n][k] < maxScore)
+        {
+          res |= 1u << n;
+          break;
+        }
+  return res;
+}
+
+static uint32_t
+TargetMaskGeneric (const int (*scores)[AI_KERNEL_COLORS],
+                   const unsigned int (*flags)[AI_KERNEL_COLORS],
+                   int count, int ownColor, unsigned int resistMask)
+{
+  const unsigned foe = ForeignLanes (ownColor);
+  uint32_t res = 0;
+  for (int n = 0; n < count; ++n)
+    for (int k = 0; k < AI_KERNEL_COLORS; ++k)
+      if ((foe & (1u << k)) && scores[n][k] != 0
+            && (flags[n][k] & resistMask) != 0)
+        {
+          res |= 1u << n;
+          break;
+        }
+  return res;
+}
+
+const AIKernels AI_kernels_generic =
+  {"generic", &FoeMaskGeneric, &WeakFoeMaskGeneric, &TargetMaskGeneric};
+
+const AIKernels* AI_kernels = &AI_kernels_generic;
+
+#ifdef USE_AI_KERNELS_X86
+
+#define AI_TARGET_SSE2 __attribute__((target("sse2")))
+#define AI_TARGET_AVX2 __attribute__((target("avx2")))
+
+/* Reduce a mask with four lane bits per tile (as produced by movemask
+   over consecutive tiles) to one bit per tile, set iff any of its lanes
+   is set.  Handles up to eight tiles.  */
+static inline uint32_t
+CollapseLanes (uint32_t m)
+{
+  m |= m >> 1;
+  m |= m >> 2;
+  m &= 0x11111111;
+  m = (m | (m >> 3)) & 0x03030303;
+  m = (m | (m >> 6)) & 0x000f000f;
+  m = (m | (m >> 12)) & 0x000000ff;
+  return m;
+}
+
+/* ************************************************************************** */
+/* SSE2 implementation, one tile per 128-bit vector.  */
+
+AI_TARGET_SSE2 static inline __m128i
+LoadTileSSE2 (const void* p)
+{
+  return _mm_loadu_si128 (static_cast<const __m128i*> (p));
+}
+
+AI_TARGET_SSE2 static inline unsigned
+LanesSSE2 (__m128i m)
+{
+  return _mm_movemask_ps (_mm_castsi128_ps (m));
+}
+
+/* Lanes of a tile with zero score.  */
+AI_TARGET_SSE2 static inline unsigned
+ZeroLanesSSE2 (const int* scores)
+{
+  return LanesSSE2 (_mm_cmpeq_epi32 (LoadTileSSE2 (scores),
+                                     _mm_setzero_si128 ()));
+}
+
+/* Lanes of a tile with a score in (0, maxScore).  */
+AI_TARGET_SSE2 static inline unsigned
+WeakLanesSSE2 (const int* scores, __m128i maxScore)
+{
+  const __m128i s = LoadTileSSE2 (scores);
+  return LanesSSE2 (_mm_and_si128 (_mm_cmpgt_epi32 (s, _mm_setzero_si128 ()),
+                                   _mm_cmplt_epi32 (s, maxScore)));
+}
+
+/* Lanes of a tile that are not a target (zero score or no matching flag).  */
+AI_TARGET_SSE2 static inline unsigned
+NonTargetLanesSSE2 (const int* scores, const unsigned int* flags,
+                    __m128i resistMask)
+{
+  const __m128i zero = _mm_setzero_si128 ();
+  const __m128i f = _mm_and_si128 (LoadTileSSE2 (flags), resistMask);
+  return LanesSSE2 (_mm_or_si128 (_mm_cmpeq_epi32 (LoadTileSSE2 (scores), zero),
+                                  _mm_cmpeq_epi32 (f, zero)));
+}
+
+AI_TARGET_SSE2 static uint32_t
+FoeMaskSSE2 (const int (*scores)[AI_KERNEL_COLORS], int count, int ownColor)
+{
+  const uint32_t foe = ForeignLanes (ownColor) * 0x1111;
+  uint32_t res = 0;
+
+  int n = 0;
+  for (; n + 4 <= count; n += 4)
+    {
+      const uint32_t zero = ZeroLanesSSE2 (scores[n])
+                              | (ZeroLanesSSE2 (scores[n + 1]) << 4)
+                              | (ZeroLanesSSE2 (scores[n + 2]) << 8)
+                              | (ZeroLanesSSE2 (scores[n + 3]) << 12);
+      res |= CollapseLanes (~zero & foe) << n;
+    }
+  for (; n < count; ++n)
+    if (~ZeroLanesSSE2 (scores[n]) & foe & 0xF)
+      res |= 1u << n;
+
+  return res;
+}
+
+AI_TARGET_SSE2 static uint32_t
+WeakFoeMaskSSE2 (const int (*scores)[AI_KERNEL_COLORS], int count,
+                 int ownColor, int maxScore)
+{
+  const uint32_t foe = ForeignLanes (ownColor) * 0x1111;
+  const __m128i maxv = _mm_set1_epi32 (maxScore);
+  uint32_t res = 0;
+
+  int n = 0;
+  for (; n + 4 <= count; n += 4)
+    {
+      const uint32_t weak = WeakLanesSSE2 (scores[n], maxv)
+                              | (WeakLanesSSE2 (scores[n + 1], maxv) << 4)
+                              | (WeakLanesSSE2 (scores[n + 2], maxv) << 8)
+                              | (WeakLanesSSE2 (scores[n + 3], maxv) << 12);
+      res |= CollapseLanes (weak & foe) << n;
+    }
+  for (; n < count; ++n)
+    if (WeakLanesSSE2 (scores[n], maxv) & foe & 0xF)
+      res |= 1u << n;
+
+  return res;
+}
+
+AI_TARGET_SSE2 static uint32_t
+TargetMaskSSE2 (const int (*scores)[AI_KERNEL_COLORS],
+                const unsigned int (*flags)[AI_KERNEL_COLORS],
+                int count, int ownColor, unsigned int resistMask)
+{
+  const uint32_t foe = ForeignLanes (ownColor) * 0x1111;
+  const __m128i rm = _mm_set1_epi32 (static_cast<int> (resistMask));
+  uint32_t res = 0;
+
+  int n = 0;
+  for (; n + 4 <= count; n += 4)
+    {
+      const uint32_t other
+          = NonTargetLanesSSE2 (scores[n], flags[n], rm)
+              | (NonTargetLanesSSE2 (scores[n + 1], flags[n + 1], rm) << 4)
+              | (NonTargetLanesSSE2 (scores[n + 2], flags[n + 2], rm) << 8)
+              | (NonTargetLanesSSE2 (scores[n + 3], flags[n + 3], rm) << 12);
+      res |= CollapseLanes (~other & foe) << n;
+    }
+  for (; n < count; ++n)
+    if (~NonTargetLanesSSE2 (scores[n], flags[n], rm) & foe & 0xF)
+      res |= 1u << n;
+
+  return res;
+}
+
+const AIKernels AI_kernels_sse2 =
+  {"sse2", &FoeMaskSSE2, &WeakFoeMaskSSE2, &TargetMaskSSE2};
+
+/* ************************************************************************** */
+/* AVX2 implementation, two tiles per 256-bit vector and eight tiles per
+   iteration.  The remainder is handled by the SSE2 code.  */
+
+AI_TARGET_AVX2 static inline __m256i
+LoadTilesAVX2 (const void* p)
+{
+  return _mm256_loadu_si256 (static_cast<const __m256i*> (p));
+}
+
+AI_TARGET_AVX2 static inline uint32_t
+LanesAVX2 (__m256i m)
+{
+  return static_cast<uint32_t> (_mm256_movemask_ps (_mm256_castsi256_ps (m)));
+}
+
+AI_TARGET_AVX2 static uint32_t
+FoeMaskAVX2 (const int (*scores)[AI_KERNEL_COLORS], int count, int ownColor)
+{
+  const uint32_t foe = ForeignLanes (ownColor) * 0x11111111;
+  const __m256i zero = _mm256_setzero_si256 ();
+  uint32_t res = 0;
+
+  int n = 0;
+  for (; n + 8 <= count; n += 8)
+    {
+      uint32_t zeroLanes = 0;
+      for (int i = 0; i < 4; ++i)
+        {
+          const __m256i s = LoadTilesAVX2 (scores[n + 2 * i]);
+          zeroLanes |= LanesAVX2 (_mm256_cmpeq_epi32 (s, zero)) << (8 * i);
+        }
+      res |= CollapseLanes (~zeroLanes & foe) << n;
+    }
+  if (n < count)
+    res |= FoeMaskSSE2 (scores + n, count - n, ownColor) << n;
+
+  return res;
+}
+
+AI_TARGET_AVX2 static uint32_t
+WeakFoeMaskAVX2 (const int (*scores)[AI_KERNEL_COLORS], int count,
+                 int ownColor, int maxScore)
+{
+  const uint32_t foe = ForeignLanes (ownColor) * 0x11111111;
+  const __m256i zero = _mm256_setzero_si256 ();
+  const __m256i maxv = _mm256_set1_epi32 (maxScore);
+  uint32_t res = 0;
+
+  int n = 0;
+  for (; n + 8 <= count; n += 8)
+    {
+      uint32_t weak = 0;
+      for (int i = 0; i < 4; ++i)
+        {
+          const __m256i s = LoadTilesAVX2 (scores[n + 2 * i]);
+          const __m256i m = _mm256_and_si256 (_mm256_cmpgt_epi32 (s, zero),
+                                              _mm256_cmpgt_epi32 (maxv, s));
+          weak |= LanesAVX2 (m) << (8 * i);
+        }
+      res |= CollapseLanes (weak & foe) << n;
+    }
+  if (n < count)
+    res |= WeakFoeMaskSSE2 (scores + n, count - n, ownColor, maxScore) << n;
+
+  return res;
+}
+
+AI_TARGET_AVX2 static uint32_t
+TargetMaskAVX2 (const int (*scores)[AI_KERNEL_COLORS],
+                const unsigned int (*flags)[AI_KERNEL_COLORS],
+                int count, int ownColor, unsigned int resistMask)
+{
+  const uint32_t foe = ForeignLanes (ownColor) * 0x11111111;
+  const __m256i zero = _mm256_setzero_si256 ();
+  const __m256i rm = _mm256_set1_epi32 (static_cast<int> (resistMask));
+  uint32_t res = 0;
+
+  int n = 0;
+  for (; n + 8 <= count; n += 8)
+    {
+      uint32_t other = 0;
+      for (int i = 0; i < 4; ++i)
+        {
+          const __m256i s = LoadTilesAVX2 (scores[n + 2 * i]);
+          const __m256i f = _mm256_and_si256 (LoadTilesAVX2 (flags[n + 2 * i]),
+                                              rm);
+          const __m256i m = _mm256_or_si256 (_mm256_cmpeq_epi32 (s, zero),
+                                             _mm256_cmpeq_epi32 (f, zero));
+          other |= LanesAVX2 (m) << (8 * i);
+        }
+      res |= CollapseLanes (~other & foe) << n;
+    }
+  if (n < count)
+    res |= TargetMaskSSE2 (scores + n, flags + n, count - n, ownColor,
+                           resistMask) << n;
+
+  return res;
+}
+
+const AIKernels AI_kernels_avx2 =
+  {"avx2", &FoeMaskAVX2, &WeakFoeMaskAVX2, &TargetMaskAVX2};
+
+#endif // USE_AI_KERNELS_X86
+
+/* ************************************************************************** */
+
+void
+AI_DetectKernels ()
+{
+#ifdef USE_AI_KERNELS_X86
+  if (CPUHasFeature (CPU_FEATURE_AVX2))
+    AI_kernels = &AI_kernels_avx2;
+  else if (CPUHasFeature (CPU_FEATURE_SSE2))
+    AI_kernels = &AI_kernels_sse2;
+  else
+    AI_kernels = &AI_kernels_generic;
+  LogPrintf ("AI kernels: using %s as detected.\n", AI_kernels->name);
+#else
+  LogPrintf ("AI kernels: using %s as built.\n", AI_kernels->name);
+#endif
+}
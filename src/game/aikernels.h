@@ -0,0 +1,76 @@
+// Copyright (C) 2016 Crypto Realities Ltd
+
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef GAME_AIKERNELS_H
+#define GAME_AIKERNELS_H
+
+#include <stdint.h>
+
+/* Vectorised kernels for the AI's neighbourhood scans.  The per-tile maps
+   (AI_playermap, Damageflagmap) store one 32-bit value per team colour, so
+   a run of tiles on a map row is a contiguous array of int[4].  Each kernel
+   scans such a run and returns a mask with bit n set if tile n is
+   "interesting" for the caller's per-colour loop.  This lets the scalar
+   code skip tiles without foes entirely, while keeping its order of
+   evaluation (and thus its random number draws) unchanged.
+
+   A run may be at most AI_KERNEL_MAX_RUN tiles long.  The colour of the
+   moving character is excluded from all tests; it may be outside of
+   [0, AI_KERNEL_COLORS), in which case all colours count as foes.  */
+
+static const int AI_KERNEL_COLORS = 4;
+static const int AI_KERNEL_MAX_RUN = 32;
+
+struct AIKernels
+{
+  /** Name of the implementation (for logging).  */
+  const char* name;
+
+  /** Tiles where any foe colour has a nonzero playermap score.  */
+  uint32_t (*foeMask) (const int (*scores)[AI_KERNEL_COLORS], int count,
+                       int ownColor);
+
+  /** Tiles where any foe colour has a score in the range (0, maxScore).  */
+  uint32_t (*weakFoeMask) (const int (*scores)[AI_KERNEL_COLORS], int count,
+                           int ownColor, int maxScore);
+
+  /**
+   * Tiles where any foe colour has both a nonzero score and at least
+   * one of resistMask set in its damage / resist flags.
+   */
+  uint32_t (*targetMask) (const int (*scores)[AI_KERNEL_COLORS],
+                          const unsigned int (*flags)[AI_KERNEL_COLORS],
+                          int count, int ownColor, unsigned int resistMask);
+};
+
+/** Portable implementation, always available.  */
+extern const AIKernels AI_kernels_generic;
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define USE_AI_KERNELS_X86 1
+extern const AIKernels AI_kernels_sse2;
+extern const AIKernels AI_kernels_avx2;
+#endif
+
+/** The implementation in use.  Defaults to the generic one.  */
+extern const AIKernels* AI_kernels;
+
+/**
+ * Select the fastest implementation supported by the CPU we are running on.
+ * All implementations are bit-exact, so this never affects consensus.
+ */
+void AI_DetectKernels ();
+
+#endif // GAME_AIKERNELS_H
@@ -27,7 +27,7 @@ std::string CharacterID::ToString() const
 }
 
 RandomGenerator::RandomGenerator (const uint256& hashBlock)
-  : state0(SerializeHash (hashBlock, SER_GETHASH, 0))
+  : state0(SerializeHash (hashBlock, SER_GETHASH, 0)), nDraws(0)
 {
     state = UintToArith256 (state0);
 }
@@ -55,6 +55,7 @@ RandomGenerator::GetIntRnd (int modulo)
       state = UintToArith256 (state0);
     }
 
+  ++nDraws;
   arith_uint256 res = state;
   state /= modulo;
   res -= state * modulo;
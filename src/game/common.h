@@ -109,9 +109,17 @@ public:
       return res;
     }
 
+    /* Number of random numbers drawn so far (for statistics).  */
+    inline unsigned
+    GetDraws () const
+    {
+      return nDraws;
+    }
+
 private:
     uint256 state0;
     arith_uint256 state;
+    unsigned nDraws;
     static const arith_uint256 MIN_STATE;
 };
 
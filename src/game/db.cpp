@@ -18,7 +18,9 @@
 #include "chain.h"
 #include "chainparams.h"
 #include "consensus/validation.h"
+#include "game/digest.h"
 #include "game/move.h"
+#include "game/perf.h"
 #include "game/state.h"
 #include "main.h"
 #include "util.h"
@@ -32,6 +34,9 @@
    need them so we can tell game states apart from the obfuscation key that
    is also in the database.  */
 static const char DB_GAMESTATE = 'g';
+static const char DB_DIGEST = 'd';
+static const char DB_TRUSTED = 't';
+static const char DB_IMPORTED = 'i';
 
 /* Define some configuration parameters.  */
 /* TODO: Make them CLI options.  */
@@ -44,127 +49,296 @@ CGameDB::CGameDB (bool fMemory, bool fWipe)
   : keepEveryNth(KEEP_EVERY_NTH),
     minInMemory(MIN_IN_MEMORY), maxInMemory(MAX_IN_MEMORY),
     keepEverything(false),
+    checkDigests(GetBoolArg ("-checkgamedigests", DEFAULT_CHECKGAMEDIGESTS)),
     db(GetDataDir() / "gamestates", DB_CACHE_SIZE, fMemory, fWipe, true),
-    cache(), cs_cache()
+    cache(), tipState(), digests(), cs_cache()
 {
   // Nothing else to do.
 }
 
 CGameDB::~CGameDB ()
 {
-  LOCK (cs_cache);
+  LOCK2 (cs_main, cs_cache);
+  tipState.reset ();
   flush (true);
-  assert (cache.empty ());
+  assert (cache.empty () && digests.empty ());
 }
 
-bool
-CGameDB::getFromCache (const uint256& hash, GameState& state) const
+GameStatePtr
+CGameDB::getFromCache (const uint256& hash) const
 {
   {
     LOCK (cs_cache);
     const GameStateMap::const_iterator mi = cache.find (hash);
     if (mi != cache.end ())
       {
-        state = *mi->second;
-        assert (hash == state.hashBlock);
-        return true;
+        assert (hash == mi->second->hashBlock);
+        return mi->second;
       }
   }
 
-  if (!db.Read (std::make_pair (DB_GAMESTATE, hash), state))
-    return false;
+  std::shared_ptr<GameState> state(new GameState (Params ().GetConsensus ()));
+  if (!db.Read (std::make_pair (DB_GAMESTATE, hash), *state))
+    return GameStatePtr ();
+  assert (hash == state->hashBlock);
+
+  /* With -checkgamedigests, verify the state read from disk against its
+     stored digest (if there is one).  If it does not match, treat it as
+     missing so that it is recomputed from an earlier state.  */
+  uint256 digest;
+  if (checkDigests && db.Read (std::make_pair (DB_DIGEST, hash), digest)
+        && GameStateDigest::Compute (*state).GetHash () != digest)
+    {
+      error ("%s: game state on disk does not match its digest", __func__);
+      return GameStatePtr ();
+    }
 
-  assert (hash == state.hashBlock);
-  return true;
+  return state;
 }
 
-bool
-CGameDB::get (const uint256& hash, GameState& state)
+GameStatePtr
+CGameDB::get (const uint256& hash)
+{
+  return lookup (hash, true);
+}
+
+GameStatePtr
+CGameDB::getNoStore (const uint256& hash)
+{
+  return lookup (hash, false);
+}
+
+GameStatePtr
+CGameDB::lookup (const uint256& hash, bool fStore)
 {
-  if (!getFromCache (hash, state))
+  GamePerfScope perf(GAMEPERF_DB_GET);
+
+  GameStatePtr res = getFromCache (hash);
+  if (res)
+    return res;
+
+  /* Look up the latest previous block for which the game
+     state is known in the cache somewhere.  If it goes back
+     to the genesis block, use a default-constructed game state
+     instead as the input.  It corresponds to the block "before"
+     the genesis block.
+
+     We keep all CBlockIndex pointers in a vector, so that
+     we can then go back up the chain without relying on chainActive.  */
+
+  LOCK (cs_main);
+  const CChainParams& chainparams = Params ();
+
+  std::vector<const CBlockIndex*> needed;
+  const BlockMap::const_iterator mi = mapBlockIndex.find (hash);
+  if (mi == mapBlockIndex.end ())
     {
-      /* Look up the latest previous block for which the game
-         state is known in the cache somewhere.  If it goes back
-         to the genesis block, use a default-constructed game state
-         instead as the input.  It corresponds to the block "before"
-         the genesis block.
+      error ("%s: block hash not found", __func__);
+      return GameStatePtr ();
+    }
+  needed.push_back (mi->second);
+  GameStatePtr stateIn;
+  while (needed.back ()->pprev)
+    {
+      const CBlockIndex* pprev = needed.back ()->pprev;
+      stateIn = getFromCache (*pprev->phashBlock);
+      if (stateIn)
+        break;
+      needed.push_back (pprev);
+    }
+  if (!stateIn)
+    stateIn.reset (new GameState (chainparams.GetConsensus ()));
 
-         We keep all CBlockIndex pointers in a vector, so that
-         we can then go back up the chain without relying on chainActive.  */
+  LogPrint ("game", "Integrating game state from height %d to height %d.\n",
+            stateIn->nHeight, needed.front ()->nHeight);
 
-      LOCK (cs_main);
-      const CChainParams& chainparams = Params ();
-      GameState stateIn(chainparams.GetConsensus ());
-
-      std::vector<const CBlockIndex*> needed;
-      const BlockMap::const_iterator mi = mapBlockIndex.find (hash);
-      if (mi == mapBlockIndex.end ())
-        return error ("%s: block hash not found", __func__);
-      needed.push_back (mi->second);
-      while (needed.back ()->pprev)
+  while (!needed.empty ())
+    {
+      const CBlockIndex* pindex = needed.back ();
+      needed.pop_back ();
+      assert (stateIn->nHeight + 1 == pindex->nHeight);
+
+      CBlock block;
+      if (!ReadBlockFromDisk (block, pindex, chainparams.GetConsensus ()))
         {
-          const CBlockIndex* pprev = needed.back ()->pprev;
-          if (getFromCache (*pprev->phashBlock, stateIn))
-            break;
-          needed.push_back (pprev);
+          error ("%s: failed to read block from disk", __func__);
+          return GameStatePtr ();
         }
 
-      LogPrint ("game", "Integrating game state from height %d to height %d.\n",
-                stateIn.nHeight, needed.front ()->nHeight);
-
-      while (!needed.empty ())
+      CValidationState valid;
+      StepResult stepRes;
+      std::shared_ptr<GameState> stateOut(
+          new GameState (chainparams.GetConsensus ()));
+      if (!PerformStep (block, *stateIn, NULL, valid, stepRes, *stateOut))
         {
-          const CBlockIndex* pindex = needed.back ();
-          needed.pop_back ();
-          assert (stateIn.nHeight + 1 == pindex->nHeight);
+          error ("%s: failed to perform game step", __func__);
+          return GameStatePtr ();
+        }
 
-          CBlock block;
-          if (!ReadBlockFromDisk (block, pindex, chainparams.GetConsensus ()))
-            return error ("%s: failed to read block from disk", __func__);
+      assert (stateOut->hashBlock == *pindex->phashBlock);
+      stateIn = stateOut;
+    }
 
-          CValidationState valid;
-          StepResult res;
-          if (!PerformStep (block, stateIn, NULL, valid, res, state))
-            return error ("%s: failed to perform game step", __func__);
+  assert (hash == stateIn->hashBlock);
+  if (fStore)
+    storeHandle (stateIn);
 
-          assert (state.hashBlock == *pindex->phashBlock);
-          stateIn = state;
-        }
+  return stateIn;
+}
 
-      store (hash, state);
-    }
+bool
+CGameDB::get (const uint256& hash, GameState& state)
+{
+  const GameStatePtr res = get (hash);
+  if (!res)
+    return false;
 
-  assert (hash == state.hashBlock);
+  state = *res;
   return true;
 }
 
+GameStatePtr
+CGameDB::getTip ()
+{
+  LOCK (cs_main);
+  const uint256 hash = chainActive.Tip ()->GetBlockHash ();
+
+  {
+    LOCK (cs_cache);
+    if (tipState && tipState->hashBlock == hash)
+      return tipState;
+  }
+
+  const GameStatePtr res = get (hash);
+  if (res)
+    {
+      LOCK (cs_cache);
+      tipState = res;
+    }
+
+  return res;
+}
+
 void
 CGameDB::store (const uint256& hash, const GameState& state)
 {
   assert (hash == state.hashBlock);
+  std::shared_ptr<GameState> s(new GameState (Params ().GetConsensus ()));
+  *s = state;
+  storeHandle (s);
+}
+
+void
+CGameDB::storeHandle (const GameStatePtr& state)
+{
+  GamePerfScope perf(GAMEPERF_DB_STORE);
+
+  {
+    LOCK (cs_cache);
+
+    /* If the state is already there, replace it.  Handles to the old
+       object stay valid.  */
+    const uint256& hash = state->hashBlock;
+    digests.erase (hash);
+    cache[hash] = state;
+  }
+
+  /* Flushing needs cs_main.  Callers (e.g. the speculative step or the
+     background threads) may not hold it, so release cs_cache first to
+     keep the lock order.  */
+  attemptFlush ();
+}
+
+void
+CGameDB::attemptFlush ()
+{
+  LOCK2 (cs_main, cs_cache);
+  if (!keepEverything && cache.size () > maxInMemory)
+    flush (false);
+}
+
+bool
+CGameDB::getDigest (const uint256& hash, uint256& digest)
+{
+  {
+    LOCK (cs_cache);
+    const std::map<uint256, uint256>::const_iterator mi = digests.find (hash);
+    if (mi != digests.end ())
+      {
+        digest = mi->second;
+        return true;
+      }
+  }
+
+  if (db.Read (std::make_pair (DB_DIGEST, hash), digest))
+    return true;
+
+  const GameStatePtr state = get (hash);
+  if (!state)
+    return false;
+  digest = GameStateDigest::Compute (*state).GetHash ();
+
+  /* Remember the digest for in-memory states.  If the state is on disk
+     without a digest (written by an older version), add it there.  */
   LOCK (cs_cache);
+  if (cache.count (hash) > 0)
+    digests[hash] = digest;
+  else if (db.Exists (std::make_pair (DB_GAMESTATE, hash)))
+    db.Write (std::make_pair (DB_DIGEST, hash), digest);
 
-  const GameStateMap::iterator mi = cache.find (hash);
-  if (mi != cache.end ())
-    {
-      delete mi->second;
-      mi->second = new GameState (Params ().GetConsensus ());
-      *mi->second = state;
-    }
-  else
+  return true;
+}
+
+void
+CGameDB::storeTrusted (const GameState& state, const uint256& digest)
+{
+  GamePerfScope perf(GAMEPERF_DB_STORE);
+
+  CDBBatch batch(db);
+  batch.Write (std::make_pair (DB_GAMESTATE, state.hashBlock), state);
+  batch.Write (std::make_pair (DB_DIGEST, state.hashBlock), digest);
+  batch.Write (std::make_pair (DB_TRUSTED, state.hashBlock), state.nHeight);
+  batch.Write (std::make_pair (DB_IMPORTED, state.hashBlock), state.nHeight);
+  if (!db.WriteBatch (batch, true))
+    error ("%s: failed to write game db", __func__);
+}
+
+std::vector<uint256>
+CGameDB::getTrusted ()
+{
+  std::vector<uint256> res;
+
+  std::unique_ptr<CDBIterator> pcursor(db.NewIterator ());
+  for (pcursor->Seek (DB_TRUSTED); pcursor->Valid (); pcursor->Next ())
     {
-      std::unique_ptr<GameState> s(new GameState (Params ().GetConsensus ()));
-      *s = state;
-      cache.insert (std::make_pair (hash, s.release ()));
+      std::pair<char, uint256> key;
+      if (!pcursor->GetKey (key) || key.first != DB_TRUSTED)
+        break;
+      res.push_back (key.second);
     }
 
-  attemptFlush ();
+  return res;
+}
+
+void
+CGameDB::markVerified (const uint256& hash)
+{
+  if (!db.Erase (std::make_pair (DB_TRUSTED, hash), true))
+    error ("%s: failed to write game db", __func__);
+}
+
+bool
+CGameDB::isImported (const uint256& hash) const
+{
+  return db.Exists (std::make_pair (DB_IMPORTED, hash));
 }
 
 void
 CGameDB::flush (bool saveAll)
 {
+  AssertLockHeld (cs_main);
   AssertLockHeld (cs_cache);
+  GamePerfScope perf(GAMEPERF_DB_FLUSH);
   LogPrint ("game", "Flushing game db to disk...\n");
 
   /* Find blocks that we want to continue to hold in memory.  These are
@@ -210,17 +384,32 @@ CGameDB::flush (bool saveAll)
       if (write)
         {
           batch.Write (std::make_pair (DB_GAMESTATE, mi->first), *mi->second);
+
+          /* Computing the digest is a full pass over the state.  Only do
+             that if the digests are checked on reads.  Otherwise, write
+             it only if it is known already.  getDigest computes missing
+             ones on demand.  */
+          const std::map<uint256, uint256>::const_iterator di
+            = digests.find (mi->first);
+          if (di != digests.end ())
+            batch.Write (std::make_pair (DB_DIGEST, mi->first), di->second);
+          else if (checkDigests)
+            batch.Write (std::make_pair (DB_DIGEST, mi->first),
+                         GameStateDigest::Compute (*mi->second).GetHash ());
+
           ++written;
         }
       else
         ++discarded;
 
-      delete mi->second;
       toErase.insert (mi->first);
     }
   for (std::set<uint256>::const_iterator i = toErase.begin ();
        i != toErase.end (); ++i)
-    cache.erase (*i);
+    {
+      cache.erase (*i);
+      digests.erase (*i);
+    }
   assert (!saveAll || cache.empty ());
   LogPrint ("game", "  wrote %u game states, discarded %u\n",
             written, discarded);
@@ -252,6 +441,13 @@ CGameDB::flush (bool saveAll)
       if (saveAll && keepThis)
         continue;
 
+      /* Imported states are kept permanently.  The node has no earlier
+         states on disk, so without them everything would have to be
+         recomputed from genesis.  */
+      if (db.Exists (std::make_pair (DB_IMPORTED, key.second))
+            || db.Exists (std::make_pair (DB_TRUSTED, key.second)))
+        continue;
+
       /* Otherwise, check for block height condition and delete if
          this is not a state we want to keep.  */
       LOCK (cs_main);
@@ -263,6 +459,7 @@ CGameDB::flush (bool saveAll)
         {
           ++discarded;
           batch.Erase (key);
+          batch.Erase (std::make_pair (DB_DIGEST, key.second));
         }
     }
   LogPrint ("game", "  pruning %u game states from disk\n", discarded);
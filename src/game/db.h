@@ -21,9 +21,21 @@
 #include "uint256.h"
 
 #include <map>
+#include <memory>
+#include <vector>
 
 class GameState;
 
+/** Default for -checkgamedigests.  */
+static const bool DEFAULT_CHECKGAMEDIGESTS = false;
+
+/**
+ * Shared handle to an immutable game state.  The states in the cache of
+ * CGameDB are handed out this way, so that reading them does not need
+ * a copy.  A handle stays valid even if the cache drops the state.
+ */
+typedef std::shared_ptr<const GameState> GameStatePtr;
+
 /**
  * Database for caching game states.  Note that each block hash corresponds
  * uniquely to a game state.  Game states can never change, they are only
@@ -61,10 +73,7 @@ public:
 
       keepEverything = keep;
       if (!keepEverything)
-        {
-          LOCK (cs_cache);
-          attemptFlush ();
-        }
+        attemptFlush ();
     }
 
     /**
@@ -72,19 +81,90 @@ public:
      * must be present in mapBlockIndex already.  If the game state is not
      * directly available, it is recomputed as necessary.
      * @param hash The block hash to look up.
+     * @return Handle to the game state, or null if it failed.
+     */
+    GameStatePtr get (const uint256& hash);
+
+    /**
+     * Query for a game state like get(), but do not store it if it has
+     * to be recomputed.  This does not write to the database, and is
+     * used when replaying the game history for analysis.
+     * @param hash The block hash to look up.
+     * @return Handle to the game state, or null if it failed.
+     */
+    GameStatePtr getNoStore (const uint256& hash);
+
+    /**
+     * Query for a game state and copy it.  This is only needed if the
+     * caller wants to modify the state, otherwise use the handle.
+     * @param hash The block hash to look up.
      * @param state Put the game state here.
      * @return True iff successful.
      */
     bool get (const uint256& hash, GameState& state);
 
+    /**
+     * Return the game state at the current tip of chainActive.  The tip's
+     * state is pinned, so that it stays in memory and repeated lookups
+     * are cheap.  Locks cs_main.
+     * @return Handle to the tip's game state, or null if it failed.
+     */
+    GameStatePtr getTip ();
+
     /**
      * Store a game state.  This is in principle not necessary, since get()
      * itself also stores the game state after computing it.  We use it,
      * nevertheless, when connecting blocks.  This avoids a duplicate
-     * computation.
+     * computation.  The state is copied, see storeHandle to avoid that.
      */
     void store (const uint256& hash, const GameState& state);
 
+    /**
+     * Store a game state without copying it.  The handle is put into the
+     * in-memory cache, replacing an existing state for the same block
+     * hash.  The state must not be modified afterwards.
+     */
+    void storeHandle (const GameStatePtr& state);
+
+    /**
+     * Query for the digest (see GameStateDigest) of the game state
+     * corresponding to a block hash.  The digest is computed at most once
+     * for states that are in memory, and stored alongside the states
+     * kept on disk.
+     * @param hash The block hash to look up.
+     * @param digest Put the digest here.
+     * @return True iff successful.
+     */
+    bool getDigest (const uint256& hash, uint256& digest);
+
+    /**
+     * Store a game state imported from a snapshot.  It is written to disk
+     * right away and kept there permanently, regardless of the
+     * keep-every-nth policy.  Earlier states are not available, so it is
+     * the starting point for any recomputation.
+     * @param state The game state, which must match the digest.
+     * @param digest The state's digest.
+     */
+    void storeTrusted (const GameState& state, const uint256& digest);
+
+    /**
+     * Return the block hashes of imported game states that have not yet
+     * been verified.
+     */
+    std::vector<uint256> getTrusted ();
+
+    /**
+     * Mark an imported game state as verified.  It is no longer returned
+     * by getTrusted, but stays on disk.
+     */
+    void markVerified (const uint256& hash);
+
+    /**
+     * Check whether a game state has been imported already (whether or
+     * not it has been verified since).
+     */
+    bool isImported (const uint256& hash) const;
+
 private:
 
     /** Keep every Nth game state permanently on disk.  */
@@ -100,30 +180,44 @@ private:
     /** Temporarily disable flushing at all and keep everything.  */
     bool keepEverything;
 
+    /**
+     * Whether to verify states read from disk against their digests
+     * (-checkgamedigests).  The digest is not maintained incrementally,
+     * so this means a full pass over each state read and written.
+     */
+    bool checkDigests;
+
     /** The backing LevelDB.  */
     CDBWrapper db;
 
-    typedef std::map<uint256, GameState*> GameStateMap;
+    typedef std::map<uint256, GameStatePtr> GameStateMap;
     /** In-memory store of the last few block states.  */
     GameStateMap cache;
+    /** The game state at the chain tip as last returned by getTip.  */
+    GameStatePtr tipState;
+    /** Digests of in-memory states, as far as they were computed.  */
+    std::map<uint256, uint256> digests;
     /** Lock to protect the cache datastructure.  */
     mutable CCriticalSection cs_cache;
 
     /**
-     * Get without recomputation.  Returns false if the state is not
+     * Get without recomputation.  Returns null if the state is not
      * readily available.
      */
-    bool getFromCache (const uint256& hash, GameState& state) const;
+    GameStatePtr getFromCache (const uint256& hash) const;
 
     /**
-     * Attempt to flush, which flushes if the cache is overly full.
+     * Look up a game state and recompute it if necessary.  If fStore is
+     * true, the recomputed state is put into the cache.
      */
-    void attemptFlush ()
-    {
-      AssertLockHeld (cs_cache);
-      if (!keepEverything && cache.size () > maxInMemory)
-        flush (false);
-    }
+    GameStatePtr lookup (const uint256& hash, bool fStore);
+
+    /**
+     * Attempt to flush, which flushes if the cache is overly full.  This
+     * locks cs_main before cs_cache, as everywhere else.  So callers
+     * must not hold cs_cache unless they hold cs_main already.
+     */
+    void attemptFlush ();
 
     /**
      * Flush the in-memory cache to disk.  The minimum in-memory blocks
@@ -132,6 +226,7 @@ private:
      * the on-disk states and removes ones that do not fit the policy.
      * @param saveAll Store all in-memory cache to disk.  This is done
      *                when shutting down the node.
+     * Needs cs_main and cs_cache.
      */
     void flush (bool saveAll);
 
@@ -0,0 +1,98 @@
+// Copyright (C) 2016 Crypto Realities Ltd
+
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "game/digest.h"
+
+#include "clientversion.h"
+#include "game/state.h"
+#include "hash.h"
+
+/* Type tags for the element hashes, so that elements of different kinds
+   can never be confused with each other.  */
+static const char DIGEST_PLAYER = 'p';
+static const char DIGEST_DEAD_CHAT = 'd';
+static const char DIGEST_LOOT = 'l';
+static const char DIGEST_HEART = 'h';
+static const char DIGEST_BANK = 'b';
+static const char DIGEST_GLOBALS = 'g';
+
+/* Wrapper to serialise only the global fields of a game state.  */
+class GameStateGlobals
+{
+
+private:
+
+  const GameState& state;
+
+public:
+
+  explicit inline GameStateGlobals (const GameState& s)
+    : state(s)
+  {}
+
+  template<typename Stream>
+    inline void
+    Serialize (Stream& s, int nType, int nVersion) const
+  {
+    const_cast<GameState&> (state).SerializationOpGlobals (
+        s, CSerActionSerialize (), nType, nVersion);
+  }
+
+};
+
+/* Hash a single element with its type tag.  */
+template<typename K, typename V>
+  static uint256
+  HashElement (char tag, const K& key, const V& value)
+{
+  CHashWriter hasher(SER_DISK, CLIENT_VERSION);
+  hasher << tag << key << value;
+  return hasher.GetHash ();
+}
+
+/* Add all elements of a map to the digest.  */
+template<typename M>
+  static void
+  AddMap (GameStateDigest& digest, char tag, const M& m)
+{
+  for (typename M::const_iterator mi = m.begin (); mi != m.end (); ++mi)
+    digest.Add (HashElement (tag, mi->first, mi->second));
+}
+
+GameStateDigest
+GameStateDigest::Compute (const GameState& state)
+{
+  GameStateDigest res;
+
+  AddMap (res, DIGEST_PLAYER, state.players);
+  AddMap (res, DIGEST_DEAD_CHAT, state.dead_players_chat);
+  AddMap (res, DIGEST_LOOT, state.loot);
+  AddMap (res, DIGEST_BANK, state.banks);
+
+  for (std::set<Coord>::const_iterator i = state.hearts.begin ();
+       i != state.hearts.end (); ++i)
+    {
+      CHashWriter hasher(SER_DISK, CLIENT_VERSION);
+      hasher << DIGEST_HEART << *i;
+      res.Add (hasher.GetHash ());
+    }
+
+  CHashWriter hasher(SER_DISK, CLIENT_VERSION);
+  hasher << DIGEST_GLOBALS << GameStateGlobals (state);
+  res.Add (hasher.GetHash ());
+
+  return res;
+}
@@ -0,0 +1,85 @@
+// Copyright (C) 2016 Crypto Realities Ltd
+
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef GAME_DIGEST_H
+#define GAME_DIGEST_H
+
+#include "arith_uint256.h"
+#include "uint256.h"
+
+class GameState;
+
+/**
+ * Order-independent digest of a game state.  The state is treated as a
+ * multiset of elements (each player with its characters, each chat entry
+ * of dead players, loot pile, heart, bank and the remaining "global"
+ * fields).  Every element is hashed on its own together with a type tag,
+ * and the element hashes are summed up modulo 2^256.  Thus elements can
+ * be added and removed in any order, and two states have the same digest
+ * iff they have the same elements (barring collisions).
+ *
+ * This is meant for consistency checks between honest copies of a state
+ * (cached vs recomputed, replays, snapshots), not as a commitment that
+ * is secure against adversarially chosen states.
+ */
+class GameStateDigest
+{
+
+private:
+
+  /** Sum of all element hashes.  */
+  arith_uint256 sum;
+
+public:
+
+  inline GameStateDigest ()
+    : sum()
+  {}
+
+  /** Add an element (given by its hash) to the multiset.  */
+  inline void
+  Add (const uint256& element)
+  {
+    sum += UintToArith256 (element);
+  }
+
+  /** Remove an element (given by its hash) from the multiset.  */
+  inline void
+  Remove (const uint256& element)
+  {
+    sum -= UintToArith256 (element);
+  }
+
+  inline GameStateDigest&
+  operator+= (const GameStateDigest& other)
+  {
+    sum += other.sum;
+    return *this;
+  }
+
+  /** Return the digest value.  */
+  inline uint256
+  GetHash () const
+  {
+    return ArithToUint256 (sum);
+  }
+
+  /** Compute the digest of a full game state.  */
+  static GameStateDigest Compute (const GameState& state);
+
+};
+
+#endif // GAME_DIGEST_H
@@ -4,19 +4,24 @@
 #include "consensus/validation.h"
 #include "game/db.h"
 #include "game/map.h"
+#include "game/perf.h"
 #include "game/state.h"
+#include "hash.h"
 #include "main.h"
 #include "names/common.h"
 #include "names/main.h"
 #include "primitives/block.h"
 #include "primitives/transaction.h"
 #include "script/names.h"
+#include "sync.h"
 #include "util.h"
 #include "utilstrencodings.h"
 
 #include <boost/foreach.hpp>
 #include <boost/xpressive/xpressive_dynamic.hpp>
 
+#include <map>
+
 /* Maximum number of waypoints per character.  */
 static const int MAX_WAYPOINTS = 100;
 
@@ -393,11 +398,125 @@ Move::IsValidPlayerName (const std::string& player)
   return regex_search(player, match, regex);
 }
 
+/* ************************************************************************** */
+/* Move validation.  */
+
+/* Parse the move in a name output.  This also checks that spawns are done
+   with name_firstupdate and other moves with name_update.  */
+static bool
+ParseNameMove (const CNameScript& nameOp, CAmount nValue, Move& m,
+               CValidationState& res)
+{
+  const std::string strName = ValtypeToString (nameOp.getOpName ());
+  const std::string strValue = ValtypeToString (nameOp.getOpValue ());
+
+  m.newLocked = nValue;
+  if (!m.Parse (strName, strValue))
+    return res.Invalid (error ("%s: cannot parse move %s",
+                               __func__, strValue.c_str ()));
+
+  if (m.IsSpawn ())
+    {
+      if (nameOp.getNameOp () != OP_NAME_FIRSTUPDATE)
+        return res.Invalid (error ("%s: spawn is not firstupdate", __func__));
+    }
+  else if (nameOp.getNameOp () != OP_NAME_UPDATE)
+    return res.Invalid (error ("%s: firstupdate is not spawn", __func__));
+
+  return true;
+}
+
+bool
+CheckMove (const Move& m, const CTransaction& tx, const GameState& state,
+           const CCoinsView* pview, CValidationState& res)
+{
+  if (!m.IsValid (state))
+    return res.Invalid (error ("%s: invalid move for player %s",
+                               __func__, m.player.c_str ()));
+
+  const std::string addressLock = m.AddressOperationPermission (state);
+  if (!pview || addressLock.empty ())
+    return true;
+
+  /* If one of inputs has address equal to addressLock, then that input
+     has been signed by the address owner and thus authorizes the
+     address change operation.  */
+  BOOST_FOREACH (const CTxIn& txi, tx.vin)
+    {
+      const COutPoint prevout = txi.prevout;
+      CCoins coins;
+
+      if (!pview->GetCoins (prevout.hash, coins)
+            || !coins.IsAvailable (prevout.n))
+        continue;
+
+      const CTxOut& prevTxo = coins.vout[prevout.n];
+      CTxDestination dest;
+      CBitcoinAddress addrParsed;
+      if (ExtractDestination (prevTxo.scriptPubKey, dest)
+            && addrParsed.Set (dest)
+            && addrParsed.ToString () == addressLock)
+        return true;
+    }
+
+  return res.Invalid (error ("%s: address operation denied", __func__));
+}
+
+bool
+CheckMoveTransaction (const CTransaction& tx, const GameState& state,
+                      const CCoinsView* pview, CValidationState& res,
+                      std::shared_ptr<const Move>& move)
+{
+  move.reset ();
+  if (!tx.IsNamecoin ())
+    return true;
+
+  BOOST_FOREACH (const CTxOut& txo, tx.vout)
+    {
+      const CNameScript nameOp(txo.scriptPubKey);
+      if (!nameOp.isNameOp () || !nameOp.isAnyUpdate ())
+        continue;
+
+      if (move)
+        return res.Invalid (error ("%s: more than one move in tx", __func__));
+
+      std::shared_ptr<Move> m(new Move ());
+      if (!ParseNameMove (nameOp, txo.nValue, *m, res)
+            || !CheckMove (*m, tx, state, pview, res))
+        return false;
+      move = m;
+    }
+
+  return true;
+}
+
+bool
+IsMoveAffected (const Move& m, const GameState& stateOld,
+                const GameState& stateNew)
+{
+  const Consensus::Params& param = *stateNew.param;
+  if (m.MinimumGameFee (param, stateOld.nHeight + 1)
+        != m.MinimumGameFee (param, stateNew.nHeight + 1))
+    return true;
+
+  const PlayerStateMap::const_iterator oldIt = stateOld.players.find (m.player);
+  const PlayerStateMap::const_iterator newIt = stateNew.players.find (m.player);
+  const bool fOld = (oldIt != stateOld.players.end ());
+  const bool fNew = (newIt != stateNew.players.end ());
+  if (fOld != fNew)
+    return true;
+  if (!fOld)
+    return false;
+
+  return oldIt->second.lockedCoins != newIt->second.lockedCoins
+          || oldIt->second.addressLock != newIt->second.addressLock;
+}
+
 /* ************************************************************************** */
 /* StepData.  */
 
 StepData::StepData (const GameState& s)
-  : state(s), dup(), nTreasureAmount(-1), newHash(), vMoves()
+  : state(s), dup(), hashMoves(), nTreasureAmount(-1), newHash(), vMoves()
 {
   const CAmount nSubsidy = GetBlockSubsidy (state.nHeight + 1, *state.param);
   // Miner subsidy is 10%, thus game treasure is 9 times the subsidy
@@ -415,6 +534,7 @@ StepData::addTransaction (const CTransaction& tx, const CCoinsView* pview,
      to prevent a situation where some moves are added already but the
      function fails later with an error.  */
   std::vector<Move> newMoves;
+  uint256 newHashMoves = hashMoves;
 
   BOOST_FOREACH (const CTxOut& txo, tx.vout)
     {
@@ -431,60 +551,157 @@ StepData::addTransaction (const CTransaction& tx, const CCoinsView* pview,
       dup.insert (strName);
 
       Move m;
-      m.newLocked = txo.nValue;
+      if (!ParseNameMove (nameOp, txo.nValue, m, res)
+            || !CheckMove (m, tx, state, pview, res))
+        return false;
 
-      if (!m.Parse (strName, strValue))
-        return res.Invalid (error ("%s: cannot parse move %s",
-                                   __func__, strValue.c_str ()));
-      if (!m.IsValid (state))
-        return res.Invalid (error ("%s: invalid move for player %s",
-                                   __func__, strName.c_str ()));
+      newMoves.push_back (m);
 
-      if (m.IsSpawn ())
-        {
-          if (nameOp.getNameOp () != OP_NAME_FIRSTUPDATE)
-            return res.Invalid (error ("%s: spawn is not firstupdate",
-                                       __func__));
-        }
-      else if (nameOp.getNameOp () != OP_NAME_UPDATE)
-        return res.Invalid (error ("%s: firstupdate is not spawn"));
+      CHashWriter hasher(SER_GETHASH, 0);
+      hasher << newHashMoves << strName << strValue << txo.nValue;
+      newHashMoves = hasher.GetHash ();
+    }
 
-      const std::string addressLock = m.AddressOperationPermission (state);
-      if (pview && !addressLock.empty ())
-        {
-          /* If one of inputs has address equal to addressLock, then that input
-             has been signed by the address owner and thus authorizes the
-             address change operation.  */
-          bool found = false;
-          BOOST_FOREACH (const CTxIn& txi, tx.vin)
-            {
-              const COutPoint prevout = txi.prevout;
-              CCoins coins;
-
-              if (!pview->GetCoins (prevout.hash, coins)
-                    || !coins.IsAvailable (prevout.n))
-                continue;
-
-              const CTxOut& prevTxo = coins.vout[prevout.n];
-              CTxDestination dest;
-              CBitcoinAddress addrParsed;
-              if (ExtractDestination (prevTxo.scriptPubKey, dest)
-                    && addrParsed.Set (dest)
-                    && addrParsed.ToString () == addressLock)
-                {
-                  found = true;
-                  break;
-                }
-            }
-          if (!found)
-            return res.Invalid (error ("%s: address operation denied",
-                                       __func__));
-        }
+  vMoves.insert (vMoves.end (), newMoves.begin (), newMoves.end ());
+  hashMoves = newHashMoves;
+  return true;
+}
 
-      newMoves.push_back (m);
+/* ************************************************************************** */
+/* Prepared steps.  */
+
+/* Number of prepared steps to remember for the current chain tip.  Each
+   holds a full game state.  This must cover the templates handed out
+   for each algo, and also the previous one for each that may still be
+   mined on while its replacement is built.  */
+static const unsigned MAX_PREPARED_STEPS = 2 * NUM_ALGOS;
+
+/* Prepared steps are identified by the previous block hash and the
+   hash of their moves.  */
+typedef std::pair<uint256, uint256> PreparedStepKey;
+
+/* A remembered step together with the time it was last used.  */
+struct PreparedStepEntry
+{
+  std::shared_ptr<const PreparedStep> step;
+  uint64_t nLastUsed;
+};
+typedef std::map<PreparedStepKey, PreparedStepEntry> PreparedStepMap;
+
+/* The remembered steps.  They all build on the same previous block,
+   since steps for an outdated tip will not be used anymore.  */
+static PreparedStepMap preparedSteps;
+static uint64_t nPreparedStepsUsed = 0;
+
+/* The step prepared speculatively for the next template.  It is kept apart
+   from the steps of templates already built, so that speculation does not
+   push those out.  */
+static PreparedStepKey speculativeKey;
+static std::shared_ptr<const PreparedStep> speculativeStep;
+
+static CCriticalSection cs_preparedSteps;
+
+static PreparedStepKey
+GetPreparedStepKey (const GameState& stateIn, const StepData& step)
+{
+  return std::make_pair (stateIn.hashBlock, step.GetMovesHash ());
+}
+
+static void
+RememberPreparedStep (const PreparedStepKey& key,
+                      const std::shared_ptr<const PreparedStep>& step)
+{
+  AssertLockHeld (cs_preparedSteps);
+
+  /* Drop steps for other previous blocks.  */
+  PreparedStepMap::iterator mi = preparedSteps.begin ();
+  while (mi != preparedSteps.end ())
+    if (mi->first.first != key.first)
+      preparedSteps.erase (mi++);
+    else
+      ++mi;
+
+  /* Evict the least recently used step if the map is full.  */
+  if (preparedSteps.size () >= MAX_PREPARED_STEPS)
+    {
+      PreparedStepMap::iterator oldest = preparedSteps.begin ();
+      for (mi = preparedSteps.begin (); mi != preparedSteps.end (); ++mi)
+        if (mi->second.nLastUsed < oldest->second.nLastUsed)
+          oldest = mi;
+      preparedSteps.erase (oldest);
     }
 
-  vMoves.insert (vMoves.end (), newMoves.begin (), newMoves.end ());
+  PreparedStepEntry entry;
+  entry.step = step;
+  entry.nLastUsed = ++nPreparedStepsUsed;
+  preparedSteps[key] = entry;
+}
+
+/* Look up a prepared step.  If it is found in the speculative slot and
+   fTemplate is set, it is moved to the steps of templates.  */
+static std::shared_ptr<const PreparedStep>
+LookupPreparedStep (const PreparedStepKey& key, bool fTemplate)
+{
+  LOCK (cs_preparedSteps);
+  const PreparedStepMap::iterator mi = preparedSteps.find (key);
+  if (mi != preparedSteps.end ())
+    {
+      mi->second.nLastUsed = ++nPreparedStepsUsed;
+      return mi->second.step;
+    }
+
+  if (!speculativeStep || speculativeKey != key)
+    return std::shared_ptr<const PreparedStep> ();
+
+  const std::shared_ptr<const PreparedStep> res = speculativeStep;
+  if (fTemplate)
+    {
+      RememberPreparedStep (key, res);
+      speculativeStep.reset ();
+    }
+
+  return res;
+}
+
+std::shared_ptr<const PreparedStep>
+PrepareGameStep (const GameState& stateIn, const StepData& step,
+                 bool* pfCached)
+{
+  const PreparedStepKey key = GetPreparedStepKey (stateIn, step);
+  std::shared_ptr<const PreparedStep> res = LookupPreparedStep (key, true);
+  if (pfCached)
+    *pfCached = static_cast<bool> (res);
+  if (res)
+    return res;
+
+  std::shared_ptr<PreparedStep> prep(new PreparedStep (*stateIn.param));
+  if (!PrepareStep (stateIn, step, *prep))
+    return std::shared_ptr<const PreparedStep> ();
+  prep->nTimePrepared = GetTimeMicros ();
+  res = prep;
+
+  LOCK (cs_preparedSteps);
+  RememberPreparedStep (key, res);
+  return res;
+}
+
+bool
+PrepareSpeculativeGameStep (const GameState& stateIn, const StepData& step,
+                            bool& fAborted)
+{
+  fAborted = false;
+  const PreparedStepKey key = GetPreparedStepKey (stateIn, step);
+  if (LookupPreparedStep (key, false))
+    return true;
+
+  std::shared_ptr<PreparedStep> prep(new PreparedStep (*stateIn.param));
+  if (!PrepareStepSpeculative (stateIn, step, *prep, fAborted))
+    return false;
+  prep->nTimePrepared = GetTimeMicros ();
+
+  LOCK (cs_preparedSteps);
+  speculativeKey = key;
+  speculativeStep = prep;
   return true;
 }
 
@@ -502,6 +719,19 @@ PerformStep (const CBlock& block, const GameState& stateIn,
                     __func__, tx.GetHash ().GetHex ().c_str());
   step.newHash = block.GetHash ();
 
+  /* If we prepared the step for a block template with the same moves,
+     only the second phase needs to be done.  */
+  const std::shared_ptr<const PreparedStep> prep
+    = LookupPreparedStep (GetPreparedStepKey (stateIn, step), false);
+  if (prep)
+    {
+      GamePerfAddCount (GAMEPERF_PREPARED_HITS, 1);
+      if (!FinishStep (stateIn, step, *prep, stateOut, res))
+        return error ("%s: game engine failed to finish step", __func__);
+      return true;
+    }
+
+  GamePerfAddCount (GAMEPERF_PREPARED_MISSES, 1);
   if (!PerformStep (stateIn, step, stateOut, res))
     return error ("%s: game engine failed to perform step", __func__);
 
@@ -10,6 +10,7 @@
 
 #include <boost/optional.hpp>
 
+#include <memory>
 #include <set>
 #include <string>
 #include <vector>
@@ -21,6 +22,7 @@ class CTransaction;
 class CValidationState;
 class GameState;
 class StepResult;
+struct PreparedStep;
 
 struct Move
 {
@@ -78,6 +80,27 @@ struct Move
     static bool IsValidPlayerName (const std::string& player);
 };
 
+/* Check an already parsed move of the given tx against the game state.
+   This also validates address permissions against pview, unless it is
+   NULL (see StepData::addTransaction).  */
+bool CheckMove (const Move& m, const CTransaction& tx, const GameState& state,
+                const CCoinsView* pview, CValidationState& res);
+
+/* Parse the move (if any) in a tx and check it against the game state
+   with CheckMove.  This is used to validate moves when they enter the
+   mempool.  move is set to the parsed move, or NULL if tx has none.  */
+bool CheckMoveTransaction (const CTransaction& tx, const GameState& state,
+                           const CCoinsView* pview, CValidationState& res,
+                           std::shared_ptr<const Move>& move);
+
+/* Return true if the move's validity may differ between the two game
+   states.  This is the case if the player was spawned or killed, its
+   locked coins or address lock changed, or the required game fee
+   changed.  Otherwise, a move valid in stateOld is also valid in
+   stateNew and need not be checked again.  */
+bool IsMoveAffected (const Move& m, const GameState& stateOld,
+                     const GameState& stateNew);
+
 class StepData
 {
 
@@ -90,6 +113,9 @@ private:
        player name.  */
     std::set<PlayerID> dup;
 
+    /* Running hash of all moves added so far, in order.  */
+    uint256 hashMoves;
+
 public:
 
     /* Public due to the legacy code.  */
@@ -110,8 +136,34 @@ public:
     bool addTransaction (const CTransaction& tx, const CCoinsView* pview,
                          CValidationState& res);
 
+    /* Return a hash committing to all moves added (in order).  Together
+       with the previous state's block hash, this identifies the result
+       of the hash-independent phase of the step.  */
+    inline const uint256&
+    GetMovesHash () const
+    {
+      return hashMoves;
+    }
+
 };
 
+/* Perform the hash-independent phase of the game step for the given
+   moves (see PrepareStep) and remember the result.  Connecting a block
+   with exactly these moves on top of stateIn then only needs the cheap
+   second phase.  This is used when building block templates.  Returns
+   NULL if the step fails.  If pfCached is given, it is set to whether
+   the step had been prepared already.  */
+std::shared_ptr<const PreparedStep> PrepareGameStep (const GameState& stateIn,
+                                                     const StepData& step,
+                                                     bool* pfCached = NULL);
+
+/* Prepare the step in the background (see PrepareStepSpeculative).  The
+   result is kept in a separate slot, where PrepareGameStep and connecting
+   a block find it as well.  Returns false if the step failed or was
+   aborted, and sets fAborted in the latter case.  */
+bool PrepareSpeculativeGameStep (const GameState& stateIn,
+                                 const StepData& step, bool& fAborted);
+
 /* Perform a game engine step based on the given block.  Returns false if any
    error occurs and the block should be considered invalid.  */
 bool PerformStep (const CBlock& block, const GameState& stateIn,
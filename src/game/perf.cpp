@@ -0,0 +1,236 @@
+// Copyright (C) 2016 Crypto Realities Ltd
+
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "game/perf.h"
+
+#include "util.h"
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+/* Number of most recent samples kept per timer.  */
+static const unsigned PERF_WINDOW_SIZE = 256;
+
+static const char* const TIMER_NAMES[GAMEPERF_NUM_TIMERS] =
+  {
+    "step", "finish", "speculative", "template_step_age",
+    "pass0", "pass1", "pass2", "ai", "pass3", "pass4",
+    "banking", "loot", "db_get", "db_store", "db_flush",
+  };
+
+static const char* const COUNTER_NAMES[GAMEPERF_NUM_COUNTERS] =
+  {
+    "characters", "poi_evaluations", "rng_draws",
+    "prepared_hits", "prepared_misses",
+    "speculative_steps", "template_step_hits", "template_step_misses",
+  };
+
+/* Data for a timer.  All fields are only accessed atomically, so that
+   recording never blocks the game engine and the RPC thread can read
+   at any time.  Readers may see a slightly inconsistent picture while
+   a sample is being recorded, which is fine for statistics.  */
+struct PerfTimerData
+{
+
+  std::atomic<uint64_t> count;
+  std::atomic<uint64_t> total;
+  std::atomic<int64_t> max;
+
+  /* Time accumulated since the last GamePerfLogStep, only counting
+     samples recorded while connecting a block.  */
+  std::atomic<int64_t> pending;
+
+  /* Ring buffer with the most recent samples.  The next sample is
+     written to window[count % PERF_WINDOW_SIZE].  */
+  std::atomic<int64_t> window[PERF_WINDOW_SIZE];
+
+};
+
+struct PerfCounterData
+{
+
+  std::atomic<uint64_t> total;
+  std::atomic<uint64_t> pending;
+
+};
+
+/* Static storage, thus zero-initialised.  */
+static PerfTimerData timers[GAMEPERF_NUM_TIMERS];
+static PerfCounterData counters[GAMEPERF_NUM_COUNTERS];
+
+/* Whether the current thread is within a GamePerfConnectScope.  */
+static thread_local bool fConnectingBlock = false;
+
+GamePerfConnectScope::GamePerfConnectScope ()
+  : fOld(fConnectingBlock)
+{
+  fConnectingBlock = true;
+}
+
+GamePerfConnectScope::~GamePerfConnectScope ()
+{
+  fConnectingBlock = fOld;
+}
+
+void
+GamePerfAddTime (GamePerfTimer timer, int64_t micros)
+{
+  assert (timer >= 0 && timer < GAMEPERF_NUM_TIMERS);
+  PerfTimerData& t = timers[timer];
+
+  const uint64_t ind = t.count.fetch_add (1, std::memory_order_relaxed);
+  t.window[ind % PERF_WINDOW_SIZE].store (micros, std::memory_order_relaxed);
+  t.total.fetch_add (micros, std::memory_order_relaxed);
+  if (fConnectingBlock)
+    t.pending.fetch_add (micros, std::memory_order_relaxed);
+
+  int64_t oldMax = t.max.load (std::memory_order_relaxed);
+  while (micros > oldMax
+          && !t.max.compare_exchange_weak (oldMax, micros,
+                                           std::memory_order_relaxed))
+    continue;
+}
+
+void
+GamePerfAddCount (GamePerfCounter counter, uint64_t n)
+{
+  assert (counter >= 0 && counter < GAMEPERF_NUM_COUNTERS);
+  counters[counter].total.fetch_add (n, std::memory_order_relaxed);
+  if (fConnectingBlock)
+    counters[counter].pending.fetch_add (n, std::memory_order_relaxed);
+}
+
+void
+GamePerfReset ()
+{
+  for (unsigned i = 0; i < GAMEPERF_NUM_TIMERS; ++i)
+    {
+      PerfTimerData& t = timers[i];
+      t.count.store (0);
+      t.total.store (0);
+      t.max.store (0);
+      t.pending.store (0);
+      for (unsigned j = 0; j < PERF_WINDOW_SIZE; ++j)
+        t.window[j].store (0);
+    }
+
+  for (unsigned i = 0; i < GAMEPERF_NUM_COUNTERS; ++i)
+    {
+      counters[i].total.store (0);
+      counters[i].pending.store (0);
+    }
+}
+
+/* Convert microseconds to (fractional) milliseconds for the JSON output.  */
+static double
+ToMillis (int64_t micros)
+{
+  return 0.001 * micros;
+}
+
+/* Return the element at the given percentile of a sorted vector.  */
+static int64_t
+GetPercentile (const std::vector<int64_t>& sorted, unsigned percent)
+{
+  assert (!sorted.empty ());
+  const size_t ind = (sorted.size () - 1) * percent / 100;
+  return sorted[ind];
+}
+
+static UniValue
+TimerToJSON (const PerfTimerData& t)
+{
+  const uint64_t count = t.count.load (std::memory_order_relaxed);
+
+  UniValue res(UniValue::VOBJ);
+  res.push_back (Pair ("count", count));
+  res.push_back (Pair ("total_ms",
+                       ToMillis (t.total.load (std::memory_order_relaxed))));
+  res.push_back (Pair ("max_ms",
+                       ToMillis (t.max.load (std::memory_order_relaxed))));
+
+  const size_t nSamples = std::min<uint64_t> (count, PERF_WINDOW_SIZE);
+  std::vector<int64_t> samples;
+  samples.reserve (nSamples);
+  for (size_t i = 0; i < nSamples; ++i)
+    samples.push_back (t.window[i].load (std::memory_order_relaxed));
+  std::sort (samples.begin (), samples.end ());
+
+  UniValue recent(UniValue::VOBJ);
+  recent.push_back (Pair ("samples", static_cast<uint64_t> (nSamples)));
+  if (!samples.empty ())
+    {
+      int64_t sum = 0;
+      for (size_t i = 0; i < samples.size (); ++i)
+        sum += samples[i];
+
+      recent.push_back (Pair ("mean_ms", ToMillis (sum) / samples.size ()));
+      recent.push_back (Pair ("median_ms",
+                              ToMillis (GetPercentile (samples, 50))));
+      recent.push_back (Pair ("p90_ms", ToMillis (GetPercentile (samples, 90))));
+      recent.push_back (Pair ("p99_ms", ToMillis (GetPercentile (samples, 99))));
+      recent.push_back (Pair ("max_ms", ToMillis (samples.back ())));
+    }
+  res.push_back (Pair ("recent", recent));
+
+  return res;
+}
+
+UniValue
+GamePerfToJSON ()
+{
+  UniValue timersJson(UniValue::VOBJ);
+  for (unsigned i = 0; i < GAMEPERF_NUM_TIMERS; ++i)
+    timersJson.push_back (Pair (TIMER_NAMES[i], TimerToJSON (timers[i])));
+
+  UniValue countersJson(UniValue::VOBJ);
+  for (unsigned i = 0; i < GAMEPERF_NUM_COUNTERS; ++i)
+    countersJson.push_back (
+        Pair (COUNTER_NAMES[i],
+              counters[i].total.load (std::memory_order_relaxed)));
+
+  UniValue res(UniValue::VOBJ);
+  res.push_back (Pair ("window", static_cast<uint64_t> (PERF_WINDOW_SIZE)));
+  res.push_back (Pair ("timers", timersJson));
+  res.push_back (Pair ("counters", countersJson));
+
+  return res;
+}
+
+void
+GamePerfLogStep (int nHeight)
+{
+  /* Always reset the pending values, so that they do not accumulate
+     while the category is turned off.  */
+  int64_t pendingTimes[GAMEPERF_NUM_TIMERS];
+  for (unsigned i = 0; i < GAMEPERF_NUM_TIMERS; ++i)
+    pendingTimes[i] = timers[i].pending.exchange (0);
+  uint64_t pendingCounts[GAMEPERF_NUM_COUNTERS];
+  for (unsigned i = 0; i < GAMEPERF_NUM_COUNTERS; ++i)
+    pendingCounts[i] = counters[i].pending.exchange (0);
+
+  if (!LogAcceptCategory ("game-bench"))
+    return;
+
+  std::string msg = strprintf ("Game step @%d:", nHeight);
+  for (unsigned i = 0; i < GAMEPERF_NUM_TIMERS; ++i)
+    msg += strprintf (" %s=%.2fms", TIMER_NAMES[i],
+                      ToMillis (pendingTimes[i]));
+  for (unsigned i = 0; i < GAMEPERF_NUM_COUNTERS; ++i)
+    msg += strprintf (" %s=%u", COUNTER_NAMES[i],
+                      static_cast<unsigned> (pendingCounts[i]));
+  LogPrintf ("%s\n", msg);
+}
@@ -0,0 +1,132 @@
+// Copyright (C) 2016 Crypto Realities Ltd
+
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef GAME_PERF_H
+#define GAME_PERF_H
+
+#include "utiltime.h"
+
+#include <univalue.h>
+
+#include <stdint.h>
+
+/* Always-on instrumentation of the game engine.  Timings of the individual
+   passes of a game step and of CGameDB operations are recorded into
+   lock-free rolling windows, and a few counters are accumulated.  The data
+   can be queried via the getgameperfinfo RPC and is logged per block
+   with -debug=game-bench.  */
+
+/** The timed parts of the game engine.  */
+enum GamePerfTimer
+{
+  GAMEPERF_STEP = 0,
+  GAMEPERF_FINISH,
+  GAMEPERF_SPECULATIVE,
+  GAMEPERF_TEMPLATE_STEP_AGE,
+  GAMEPERF_PASS0,
+  GAMEPERF_PASS1,
+  GAMEPERF_PASS2,
+  GAMEPERF_AI,
+  GAMEPERF_PASS3,
+  GAMEPERF_PASS4,
+  GAMEPERF_BANKING,
+  GAMEPERF_LOOT,
+  GAMEPERF_DB_GET,
+  GAMEPERF_DB_STORE,
+  GAMEPERF_DB_FLUSH,
+
+  GAMEPERF_NUM_TIMERS
+};
+
+/** The counted events in the game engine.  */
+enum GamePerfCounter
+{
+  GAMEPERF_CHARACTERS = 0,
+  GAMEPERF_POI_EVALUATIONS,
+  GAMEPERF_RNG_DRAWS,
+  GAMEPERF_PREPARED_HITS,
+  GAMEPERF_PREPARED_MISSES,
+  GAMEPERF_SPECULATIVE_STEPS,
+  GAMEPERF_TEMPLATE_STEP_HITS,
+  GAMEPERF_TEMPLATE_STEP_MISSES,
+
+  GAMEPERF_NUM_COUNTERS
+};
+
+/** Record a duration (in microseconds) for the given timer.  */
+void GamePerfAddTime (GamePerfTimer timer, int64_t micros);
+
+/** Record the number of events for the given counter in the last step.  */
+void GamePerfAddCount (GamePerfCounter counter, uint64_t n);
+
+/** Reset all timers and counters.  */
+void GamePerfReset ();
+
+/** Return all timers and counters as JSON (for getgameperfinfo).  */
+UniValue GamePerfToJSON ();
+
+/**
+ * Log the timers and counters of the last connected block (as recorded
+ * within a GamePerfConnectScope since the previous call to this function)
+ * under the "game-bench" category.
+ */
+void GamePerfLogStep (int nHeight);
+
+/**
+ * Tag the samples recorded by the current thread during the lifetime of
+ * this object as part of connecting a block.  Only those go into the
+ * per-block totals of GamePerfLogStep.  Steps for block templates,
+ * speculative steps and replays are recorded in the overall statistics
+ * only.  Scopes may be nested.
+ */
+class GamePerfConnectScope
+{
+
+private:
+
+  const bool fOld;
+
+public:
+
+  GamePerfConnectScope ();
+  ~GamePerfConnectScope ();
+
+};
+
+/**
+ * Time the lifetime of this object and record it for a timer.
+ */
+class GamePerfScope
+{
+
+private:
+
+  const GamePerfTimer timer;
+  const int64_t nStart;
+
+public:
+
+  explicit inline GamePerfScope (GamePerfTimer t)
+    : timer(t), nStart(GetTimeMicros ())
+  {}
+
+  inline ~GamePerfScope ()
+  {
+    GamePerfAddTime (timer, GetTimeMicros () - nStart);
+  }
+
+};
+
+#endif // GAME_PERF_H
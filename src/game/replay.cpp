@@ -0,0 +1,196 @@
+// Copyright (C) 2016 Crypto Realities Ltd
+
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "game/replay.h"
+
+#include "chain.h"
+#include "chainparams.h"
+#include "consensus/validation.h"
+#include "game/db.h"
+#include "game/digest.h"
+#include "game/move.h"
+#include "game/perf.h"
+#include "game/state.h"
+#include "init.h"
+#include "main.h"
+#include "util.h"
+#include "utilstrencodings.h"
+#include "utiltime.h"
+
+#include <vector>
+
+/* Number of characters on the map, for the log output.  */
+static unsigned
+CountCharacters (const GameState& state)
+{
+  unsigned res = 0;
+  for (PlayerStateMap::const_iterator mi = state.players.begin ();
+       mi != state.players.end (); ++mi)
+    res += mi->second.characters.size ();
+  return res;
+}
+
+/* Perform one replay run over the given blocks.  The digests of the
+   states after each block are returned in digests.  */
+static bool
+ReplayRun (const std::vector<const CBlockIndex*>& blocks,
+           const GameState& startState, std::vector<uint256>& digests)
+{
+  const Consensus::Params& params = Params ().GetConsensus ();
+
+  GameState stateIn(params);
+  GameState stateOut(params);
+  stateIn = startState;
+
+  digests.clear ();
+  digests.reserve (blocks.size ());
+  GamePerfReset ();
+
+  int64_t nTimeTotal = 0, nTimeRead = 0, nTimeMax = 0;
+  int nHeightMax = -1;
+  for (std::vector<const CBlockIndex*>::const_iterator i = blocks.begin ();
+       i != blocks.end (); ++i)
+    {
+      if (ShutdownRequested ())
+        return error ("%s: interrupted", __func__);
+
+      const CBlockIndex* pindex = *i;
+      assert (stateIn.nHeight + 1 == pindex->nHeight);
+
+      const int64_t nStart = GetTimeMicros ();
+      CBlock block;
+      if (!ReadBlockFromDisk (block, pindex, params))
+        return error ("%s: failed to read block at height %d",
+                      __func__, pindex->nHeight);
+      const int64_t nRead = GetTimeMicros ();
+
+      CValidationState valid;
+      StepResult res;
+      if (!PerformStep (block, stateIn, NULL, valid, res, stateOut))
+        return error ("%s: game step failed at height %d",
+                      __func__, pindex->nHeight);
+      const int64_t nStep = GetTimeMicros () - nRead;
+
+      nTimeRead += nRead - nStart;
+      nTimeTotal += nStep;
+      if (nStep > nTimeMax)
+        {
+          nTimeMax = nStep;
+          nHeightMax = pindex->nHeight;
+        }
+
+      digests.push_back (GameStateDigest::Compute (stateOut).GetHash ());
+      LogPrintf ("replay: height %d, step %.2fms, %u players, %u characters,"
+                 " %u killed, digest %s\n",
+                 pindex->nHeight, 0.001 * nStep,
+                 static_cast<unsigned> (stateOut.players.size ()),
+                 CountCharacters (stateOut),
+                 static_cast<unsigned> (res.GetKilledPlayers ().size ()),
+                 digests.back ().GetHex ());
+
+      stateIn = stateOut;
+    }
+
+  LogPrintf ("replay: %u blocks, step %.2fms (%.3fms/block, max %.2fms"
+             " at height %d), reading blocks %.2fms\n",
+             static_cast<unsigned> (blocks.size ()), 0.001 * nTimeTotal,
+             blocks.empty () ? 0.0 : 0.001 * nTimeTotal / blocks.size (),
+             0.001 * nTimeMax, nHeightMax, 0.001 * nTimeRead);
+  LogPrintf ("replay: engine statistics %s\n", GamePerfToJSON ().write ());
+
+  return true;
+}
+
+bool
+ParseGameReplayRange (const std::string& str, int& fromHeight, int& toHeight)
+{
+  const size_t sep = str.find (':');
+  if (sep == std::string::npos)
+    return false;
+
+  if (!ParseInt32 (str.substr (0, sep), &fromHeight)
+        || !ParseInt32 (str.substr (sep + 1), &toHeight))
+    return false;
+
+  return fromHeight >= 0 && fromHeight <= toHeight;
+}
+
+bool
+ReplayGameSteps (int fromHeight, int toHeight, bool checkDeterminism)
+{
+  const Consensus::Params& params = Params ().GetConsensus ();
+
+  /* Collect the block indices to replay first.  The game engine itself
+     does not need cs_main, so we only hold it for the lookup.  */
+  std::vector<const CBlockIndex*> blocks;
+  uint256 hashStart;
+  {
+    LOCK (cs_main);
+    if (toHeight > chainActive.Height ())
+      return error ("%s: height %d is beyond the chain tip at %d",
+                    __func__, toHeight, chainActive.Height ());
+
+    for (int h = fromHeight; h <= toHeight; ++h)
+      blocks.push_back (chainActive[h]);
+    if (fromHeight > 0)
+      hashStart = chainActive[fromHeight - 1]->GetBlockHash ();
+  }
+
+  /* The state "before" the genesis block is the default-constructed one.
+     Otherwise use the game db, which fills in from the closest state
+     it has stored.  The recomputed state is not stored, so that the
+     replay does not modify the database.  */
+  GameState startState(params);
+  if (!hashStart.IsNull ())
+    {
+      LogPrintf ("replay: looking up game state at height %d...\n",
+                 fromHeight - 1);
+      const int64_t nStart = GetTimeMillis ();
+      const GameStatePtr state = pgameDb->getNoStore (hashStart);
+      if (!state)
+        return error ("%s: failed to get the initial game state", __func__);
+      startState = *state;
+      LogPrintf ("replay: initial game state loaded in %dms\n",
+                 static_cast<int> (GetTimeMillis () - nStart));
+    }
+
+  LogPrintf ("replay: replaying game steps from height %d to %d\n",
+             fromHeight, toHeight);
+  std::vector<uint256> digests;
+  if (!ReplayRun (blocks, startState, digests))
+    return false;
+
+  if (!checkDeterminism)
+    return true;
+
+  /* The engine sets the caches it carries over between steps from each
+     step's input state, so the second run does not see anything left
+     behind by the first one.  */
+  LogPrintf ("replay: replaying again to check determinism\n");
+  std::vector<uint256> digestsCheck;
+  if (!ReplayRun (blocks, startState, digestsCheck))
+    return false;
+
+  assert (digests.size () == blocks.size ()
+            && digestsCheck.size () == blocks.size ());
+  for (unsigned i = 0; i < blocks.size (); ++i)
+    if (digests[i] != digestsCheck[i])
+      return error ("%s: replays differ at height %d: %s vs %s", __func__,
+                    blocks[i]->nHeight, digests[i].GetHex (),
+                    digestsCheck[i].GetHex ());
+  LogPrintf ("replay: both replays match\n");
+
+  return true;
+}
@@ -0,0 +1,47 @@
+// Copyright (C) 2016 Crypto Realities Ltd
+
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef GAME_REPLAY_H
+#define GAME_REPLAY_H
+
+#include <string>
+
+/* Offline replay of the game engine (-replaygame).  The blocks of the
+   active chain in a given height range are read from disk and the game
+   steps for them performed again, starting from the closest game state
+   that is known to CGameDB.  The resulting states are not stored anywhere,
+   so that this can be used to profile the engine without touching the
+   chain state.  */
+
+/**
+ * Parse a replay range given as "<from>:<to>" (both inclusive).
+ * @param str The string to parse.
+ * @param fromHeight Set to the first height to replay.
+ * @param toHeight Set to the last height to replay.
+ * @return True iff the string is a valid range.
+ */
+bool ParseGameReplayRange (const std::string& str,
+                           int& fromHeight, int& toHeight);
+
+/**
+ * Replay the game steps for the blocks in the given height range of
+ * the active chain and log timing and a state digest per block.
+ * If checkDeterminism is set, the range is replayed a second time and
+ * the digests of both runs are compared against each other.
+ * @return False if the replay failed or the runs differ.
+ */
+bool ReplayGameSteps (int fromHeight, int toHeight, bool checkDeterminism);
+
+#endif // GAME_REPLAY_H
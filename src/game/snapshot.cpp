@@ -0,0 +1,308 @@
+// Copyright (C) 2016 Crypto Realities Ltd
+
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "game/snapshot.h"
+
+#include "chain.h"
+#include "chainparams.h"
+#include "clientversion.h"
+#include "coins.h"
+#include "consensus/validation.h"
+#include "game/db.h"
+#include "game/digest.h"
+#include "game/move.h"
+#include "game/state.h"
+#include "hash.h"
+#include "init.h"
+#include "main.h"
+#include "names/common.h"
+#include "streams.h"
+#include "util.h"
+#include "utiltime.h"
+
+#include <map>
+#include <vector>
+
+#include <boost/thread.hpp>
+
+/* Format of the snapshot file.  Everything up to the checksum is hashed
+   into it:
+
+     magic, version, genesis block hash,
+     block hash, height, game state, game state digest,
+     map of player names to their name data,
+     checksum.  */
+static const uint32_t SNAPSHOT_MAGIC = 0x534e5347; // "GSNS"
+static const int SNAPSHOT_VERSION = 1;
+
+typedef std::map<valtype, CNameData> NameDataMap;
+
+/* Write an object to the file and also to the checksum.  */
+template<typename T>
+  static void
+  WriteHashed (CAutoFile& file, CHashWriter& hasher, const T& obj)
+{
+  file << obj;
+  hasher << obj;
+}
+
+/* Read an object from the file and add it to the checksum.  */
+template<typename T>
+  static void
+  ReadHashed (CAutoFile& file, CHashWriter& hasher, T& obj)
+{
+  file >> obj;
+  hasher << obj;
+}
+
+bool
+WriteGameStateSnapshot (const boost::filesystem::path& file)
+{
+  const CChainParams& chainparams = Params ();
+
+  /* Collect everything at the same chain tip, so that the names match
+     the game state.  The file is written without holding cs_main.  */
+  GameStatePtr pstate;
+  uint256 digest;
+  NameDataMap names;
+  {
+    LOCK (cs_main);
+    pstate = pgameDb->getTip ();
+    if (!pstate || !pgameDb->getDigest (pstate->hashBlock, digest))
+      return error ("%s: failed to get the game state", __func__);
+
+    for (PlayerStateMap::const_iterator mi = pstate->players.begin ();
+         mi != pstate->players.end (); ++mi)
+      {
+        const valtype vchName = ValtypeFromString (mi->first);
+        CNameData data;
+        if (!pcoinsTip->GetName (vchName, data))
+          return error ("%s: player %s is not in the name database",
+                        __func__, mi->first.c_str ());
+        names.insert (std::make_pair (vchName, data));
+      }
+  }
+
+  const GameState& state = *pstate;
+  CAutoFile fileout(fopen (file.string ().c_str (), "wb"),
+                    SER_DISK, CLIENT_VERSION);
+  if (fileout.IsNull ())
+    return error ("%s: failed to open %s", __func__, file.string ());
+
+  try
+    {
+      CHashWriter hasher(SER_DISK, CLIENT_VERSION);
+      WriteHashed (fileout, hasher, SNAPSHOT_MAGIC);
+      WriteHashed (fileout, hasher, SNAPSHOT_VERSION);
+      WriteHashed (fileout, hasher, chainparams.GetConsensus ().hashGenesisBlock);
+      WriteHashed (fileout, hasher, state.hashBlock);
+      WriteHashed (fileout, hasher, state.nHeight);
+      WriteHashed (fileout, hasher, state);
+      WriteHashed (fileout, hasher, digest);
+      WriteHashed (fileout, hasher, names);
+      fileout << hasher.GetHash ();
+    }
+  catch (const std::exception& e)
+    {
+      return error ("%s: I/O error - %s", __func__, e.what ());
+    }
+
+  LogPrintf ("Wrote game state snapshot at height %d (%s) to %s\n",
+             state.nHeight, state.hashBlock.GetHex (), file.string ());
+  return true;
+}
+
+bool
+LoadGameStateSnapshot (const boost::filesystem::path& file)
+{
+  const CChainParams& chainparams = Params ();
+
+  CAutoFile filein(fopen (file.string ().c_str (), "rb"),
+                   SER_DISK, CLIENT_VERSION);
+  if (filein.IsNull ())
+    return error ("%s: failed to open %s", __func__, file.string ());
+
+  GameState state(chainparams.GetConsensus ());
+  uint256 hashBlock, digest;
+  int nHeight;
+  NameDataMap names;
+  try
+    {
+      CHashWriter hasher(SER_DISK, CLIENT_VERSION);
+
+      uint32_t nMagic;
+      int nVersion;
+      uint256 hashGenesis;
+      ReadHashed (filein, hasher, nMagic);
+      ReadHashed (filein, hasher, nVersion);
+      if (nMagic != SNAPSHOT_MAGIC || nVersion != SNAPSHOT_VERSION)
+        return error ("%s: %s is not a game state snapshot", __func__,
+                      file.string ());
+      ReadHashed (filein, hasher, hashGenesis);
+      if (hashGenesis != chainparams.GetConsensus ().hashGenesisBlock)
+        return error ("%s: snapshot is for a different network", __func__);
+
+      ReadHashed (filein, hasher, hashBlock);
+      ReadHashed (filein, hasher, nHeight);
+
+      /* -loadgamestate may stay set across restarts.  Do not import the
+         state again, which would also queue it for verification again.  */
+      if (pgameDb->isImported (hashBlock))
+        {
+          LogPrintf ("Game state at height %d (%s) has already been"
+                     " imported\n", nHeight, hashBlock.GetHex ());
+          return true;
+        }
+
+      ReadHashed (filein, hasher, state);
+      ReadHashed (filein, hasher, digest);
+      ReadHashed (filein, hasher, names);
+
+      uint256 hashChecksum;
+      filein >> hashChecksum;
+      if (hashChecksum != hasher.GetHash ())
+        return error ("%s: checksum mismatch", __func__);
+    }
+  catch (const std::exception& e)
+    {
+      return error ("%s: deserialize or I/O error - %s", __func__, e.what ());
+    }
+
+  if (state.hashBlock != hashBlock || state.nHeight != nHeight)
+    return error ("%s: game state does not match the snapshot header",
+                  __func__);
+  if (GameStateDigest::Compute (state).GetHash () != digest)
+    return error ("%s: game state does not match its digest", __func__);
+
+  {
+    LOCK (cs_main);
+    const BlockMap::const_iterator mi = mapBlockIndex.find (hashBlock);
+    if (mi == mapBlockIndex.end () || mi->second->nHeight != nHeight)
+      return error ("%s: snapshot block %s is not in the block index",
+                    __func__, hashBlock.GetHex ());
+
+    /* The names are not imported, since the name database is part of the
+       chain state and comes with it.  They are only a cross-check, which
+       can be done if our chain state is at the snapshot block.  Otherwise,
+       the names are validated against the game state as the chain is
+       connected forward.  */
+    if (pcoinsTip->GetBestBlock () == hashBlock)
+      {
+        for (NameDataMap::const_iterator ni = names.begin ();
+             ni != names.end (); ++ni)
+          {
+            CNameData data;
+            if (!pcoinsTip->GetName (ni->first, data)
+                  || SerializeHash (data) != SerializeHash (ni->second))
+              return error ("%s: name %s does not match the chain state",
+                            __func__, ValtypeToString (ni->first).c_str ());
+          }
+      }
+    else
+      LogPrintf ("%s: chain state is not at the snapshot block,"
+                 " not checking %u names\n",
+                 __func__, static_cast<unsigned> (names.size ()));
+  }
+
+  pgameDb->storeTrusted (state, digest);
+  LogPrintf ("Loaded trusted game state at height %d (%s) from %s\n",
+             nHeight, hashBlock.GetHex (), file.string ());
+
+  return true;
+}
+
+/* Replay the game steps from genesis to the given block and compare
+   the result to the expected digest.  */
+static bool
+VerifyGameState (const uint256& hash, const uint256& expected)
+{
+  const Consensus::Params& params = Params ().GetConsensus ();
+
+  std::vector<const CBlockIndex*> blocks;
+  {
+    LOCK (cs_main);
+    const BlockMap::const_iterator mi = mapBlockIndex.find (hash);
+    if (mi == mapBlockIndex.end ())
+      return error ("%s: block %s not found", __func__, hash.GetHex ());
+    for (const CBlockIndex* pindex = mi->second; pindex;
+         pindex = pindex->pprev)
+      blocks.push_back (pindex);
+  }
+
+  LogPrintf ("Verifying trusted game state at height %d...\n",
+             blocks.front ()->nHeight);
+  const int64_t nStart = GetTimeMillis ();
+
+  GameState stateIn(params);
+  GameState stateOut(params);
+  while (!blocks.empty ())
+    {
+      boost::this_thread::interruption_point ();
+
+      const CBlockIndex* pindex = blocks.back ();
+      blocks.pop_back ();
+      assert (stateIn.nHeight + 1 == pindex->nHeight);
+
+      CBlock block;
+      if (!ReadBlockFromDisk (block, pindex, params))
+        return error ("%s: failed to read block at height %d",
+                      __func__, pindex->nHeight);
+
+      CValidationState valid;
+      StepResult res;
+      if (!PerformStep (block, stateIn, NULL, valid, res, stateOut))
+        return error ("%s: game step failed at height %d",
+                      __func__, pindex->nHeight);
+
+      stateIn = stateOut;
+    }
+
+  const uint256 digest = GameStateDigest::Compute (stateIn).GetHash ();
+  LogPrintf ("Replayed game history up to height %d in %ds\n",
+             stateIn.nHeight,
+             static_cast<int> ((GetTimeMillis () - nStart) / 1000));
+
+  return digest == expected;
+}
+
+void
+ThreadVerifyTrustedGameStates ()
+{
+  const std::vector<uint256> trusted = pgameDb->getTrusted ();
+  for (std::vector<uint256>::const_iterator i = trusted.begin ();
+       i != trusted.end (); ++i)
+    {
+      uint256 digest;
+      if (!pgameDb->getDigest (*i, digest))
+        {
+          error ("%s: no digest for trusted game state %s",
+                 __func__, i->GetHex ());
+          continue;
+        }
+
+      if (VerifyGameState (*i, digest))
+        {
+          pgameDb->markVerified (*i);
+          LogPrintf ("Trusted game state %s verified\n", i->GetHex ());
+        }
+      else
+        {
+          strMiscWarning = _("Warning: The imported game state does not"
+                             " match the chain history!");
+          LogPrintf ("*** Trusted game state %s does not match the chain"
+                     " history\n", i->GetHex ());
+        }
+    }
+}
@@ -0,0 +1,60 @@
+// Copyright (C) 2016 Crypto Realities Ltd
+
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef GAME_SNAPSHOT_H
+#define GAME_SNAPSHOT_H
+
+#include <boost/filesystem/path.hpp>
+
+/* Game state snapshots (dumpgamestate and -loadgamestate).  A snapshot
+   holds the game state at the chain tip together with the name database
+   entries of its players and a checksum over everything.  Importing it
+   stores the state in CGameDB as "trusted", so that game states of later
+   blocks are computed from there instead of replaying every step since
+   the genesis block.  This is meant for bootstrapping a node from a copy
+   of the block files and chain state.  The names are not imported, they
+   come with the chain state and are only compared against it.  A state
+   that has been imported before is not imported again, so -loadgamestate
+   can stay set.  With -verifygamestate, trusted states are checked
+   against a full replay in the background.  */
+
+/** Default for -verifygamestate.  */
+static const bool DEFAULT_VERIFYGAMESTATE = false;
+
+/**
+ * Write a snapshot of the game state at the current chain tip.
+ * @param file The file to write.
+ * @return True iff successful.
+ */
+bool WriteGameStateSnapshot (const boost::filesystem::path& file);
+
+/**
+ * Import a snapshot file and store its game state as trusted in the
+ * game db.  The block must be known in the block index.  If the chain
+ * state is at the same block, the name entries are checked against it.
+ * If the state has been imported already, nothing is done.
+ * @param file The file to read.
+ * @return True iff successful.
+ */
+bool LoadGameStateSnapshot (const boost::filesystem::path& file);
+
+/**
+ * Replay the game steps from genesis up to each trusted game state and
+ * mark it verified if the digests match.  This is run in its own thread
+ * with -verifygamestate.
+ */
+void ThreadVerifyTrustedGameStates ();
+
+#endif // GAME_SNAPSHOT_H
@@ -15,14 +15,19 @@
 
 #include "game/state.h"
 
+#include "game/aikernels.h"
 #include "game/map.h"
 #include "game/move.h"
+#include "game/perf.h"
 #include "rpc/server.h"
+#include "sync.h"
 #include "util.h"
 #include "utilstrencodings.h"
 
 #include <boost/foreach.hpp>
 
+#include <algorithm>
+#include <atomic>
 #include <functional>
 
 
@@ -351,6 +356,7 @@ int64_t AI_coinmap[MAP_HEIGHT][MAP_WIDTH];
 int AI_merchantbasemap[MAP_HEIGHT][MAP_WIDTH];
 
 uint256 AI_rng_seed_hashblock; // use hash from previous block
+unsigned AI_poi_evaluations; // for the game-bench statistics
 
 int AI_dbg_total_choices = 0;
 int AI_dbg_sum_result = 0;
@@ -612,6 +618,49 @@ int Cache_timeslot_blockcount = 0;
 int Cache_timeslot_start = 0;
 int nCalculatedActiveDlevel = 0;
 
+/* The caches above (and the AI's scratch data) are shared by all steps.
+   Steps may be computed outside of cs_main (e.g. for block templates),
+   so they are serialised by this lock instead.  */
+static CCriticalSection cs_gameEngine;
+
+/* Number of regular (non-speculative) steps waiting for or holding
+   cs_gameEngine.  Speculative steps give way to them, so that they do
+   not hold up connecting a block.  */
+static std::atomic<int> nRegularStepsPending(0);
+
+/* Mark a regular step as pending for the lifetime of the object.  */
+class RegularStepScope
+{
+public:
+    RegularStepScope() { ++nRegularStepsPending; }
+    ~RegularStepScope() { --nRegularStepsPending; }
+};
+
+/* Return true if a speculative step should be aborted.  */
+static inline bool
+SpeculationPreempted(bool fSpeculative)
+{
+    return fSpeculative && nRegularStepsPending > 0;
+}
+
+/* Set the caches that are carried over from one step to the next from
+   the state the step builds on.  When connecting a single chain, they
+   hold these values anyway (all minimum versions from 2020800 on behave
+   the same).  Setting them here makes a step independent of whatever
+   steps were computed before, e.g. on another branch, in an earlier
+   replay run or for background verification.  */
+static void
+LoadStepCaches(const GameState &inState)
+{
+    AssertLockHeld(cs_gameEngine);
+
+    Gamecache_dyncheckpointheight1 = inState.dcpoint_height1;
+    Gamecache_dyncheckpointhash1 = inState.dcpoint_hash1;
+    Gamecache_dyncheckpointheight2 = inState.dcpoint_height2;
+    Gamecache_dyncheckpointhash2 = inState.dcpoint_hash2;
+    Cache_min_version = inState.dao_MinVersion;
+}
+
 
 /* ************************************************************************** */
 /* AttackableCharacter and CharactersOnTiles.  */
@@ -1492,6 +1541,30 @@ void CharacterState::MoveTowardsWaypointX_Learn_From_WP(int out_height)
         }
     }
 }
+// Run one of the AI kernels over the square of radius "range" around x,y.
+// The result is indexed like Distance_To_Tile: bit AI_NAV_CENTER+i of
+// rows[AI_NAV_CENTER+j] belongs to the tile at x+i,y+j.  Tiles outside
+// the map are left clear.
+template<typename ScanRow>
+static void AI_ScanWindow(int x, int y, int range, uint32_t rows[AI_NAV_SIZE], ScanRow scanRow)
+{
+    for (int j = 0; j < AI_NAV_SIZE; j++)
+        rows[j] = 0;
+
+    int u0 = std::max(x - range, 0);
+    int u1 = std::min(x + range, MAP_WIDTH - 1);
+    int v0 = std::max(y - range, 0);
+    int v1 = std::min(y + range, MAP_HEIGHT - 1);
+    if (u0 > u1) return;
+
+    for (int v = v0; v <= v1; v++)
+        rows[AI_NAV_CENTER + v - y] = scanRow(v, u0, u1 - u0 + 1) << (AI_NAV_CENTER + u0 - x);
+}
+inline bool AI_WINDOW_HAS(const uint32_t rows[AI_NAV_SIZE], int i, int j)
+{
+    return (rows[AI_NAV_CENTER + j] >> (AI_NAV_CENTER + i)) & 1;
+}
+
 // SMC basic conversion -- part 22: extended version of MoveTowardsWaypoint (part 2)
 void CharacterState::MoveTowardsWaypointX_Pathfinder(RandomGenerator &rnd, int color_of_moving_char, int out_height, int out_monster)
 {
@@ -1631,6 +1704,22 @@ void CharacterState::MoveTowardsWaypointX_Pathfinder(RandomGenerator &rnd, int c
         if (max_range > AI_NAV_CENTER)
             max_range = AI_NAV_CENTER;
 
+        // tiles with at least one foe that the current weapon could hit
+        // (resist flags are never changed by the damage flags set below)
+        unsigned int target_resists = 0;
+        if (rpg_slot_spell == AI_ATTACK_XBOW) target_resists = RESIST_DEATH0;
+        else if (rpg_slot_spell == AI_ATTACK_XBOW3) target_resists = RESIST_DEATH0 | RESIST_DEATH1;
+        else if (rpg_slot_spell == AI_ATTACK_LIGHTNING) target_resists = RESIST_LIGHTNING0;
+        else if ((rpg_slot_spell == AI_ATTACK_DEATH) && (clevel < 3)) target_resists = RESIST_DEATH0 | RESIST_DEATH1;
+        else if ((rpg_slot_spell == AI_ATTACK_FIRE) && (clevel < 3)) target_resists = RESIST_FIRE0 | RESIST_FIRE1;
+
+        uint32_t target_rows[AI_NAV_SIZE];
+        AI_ScanWindow(x, y, max_range, target_rows, [&](int v, int u0, int n) {
+            if (target_resists)
+                return AI_kernels->targetMask(&AI_playermap[v][u0], &AI_RESISTFLAGMAP[v][u0], n, color_of_moving_char, target_resists);
+            return AI_kernels->foeMask(&AI_playermap[v][u0], n, color_of_moving_char);
+        });
+
         // attack nearest target
         // in case of equal distance, prefer the one in front (or on left side) of you
         int ustart = x - max_range;
@@ -1694,6 +1783,8 @@ void CharacterState::MoveTowardsWaypointX_Pathfinder(RandomGenerator &rnd, int c
                     return;
                 }
 
+                if (!AI_WINDOW_HAS(target_rows, i, j)) continue;
+
                 for (int k = 0; k < STATE_NUM_TEAM_COLORS; k++)
                 {
                     if (k == color_of_moving_char) continue; // same team
@@ -2064,6 +2155,17 @@ void CharacterState::MoveTowardsWaypointX_Pathfinder(RandomGenerator &rnd, int c
                 int best_v = y;
                 int current_dist = 0;
 
+                // tiles with hostiles, and tiles with hostiles weaker than us (monsters only)
+                uint32_t foe_rows[AI_NAV_SIZE];
+                uint32_t weak_foe_rows[AI_NAV_SIZE];
+                if (!(AI_IS_SAFEZONE(x, y)))
+                    AI_ScanWindow(x, y, AI_NAV_CENTER, foe_rows, [&](int v, int u0, int n) {
+                        return AI_kernels->foeMask(&AI_playermap[v][u0], n, color_of_moving_char);
+                    });
+                if ((NPCROLE_IS_MONSTER(ai_npc_role)) && (!on_the_run))
+                    AI_ScanWindow(x, y, AI_NAV_CENTER, weak_foe_rows, [&](int v, int u0, int n) {
+                        return AI_kernels->weakFoeMask(&AI_playermap[v][u0], n, color_of_moving_char, myscore);
+                    });
 
                 for (int u = x - AI_NAV_CENTER; u <= x + AI_NAV_CENTER; u++) // <= or == ???
                 for (int v = y - AI_NAV_CENTER; v <= y + AI_NAV_CENTER; v++)
@@ -2124,6 +2226,12 @@ void CharacterState::MoveTowardsWaypointX_Pathfinder(RandomGenerator &rnd, int c
                         int n0 = ai_foe_count; // ai_foe_count is just unsigned char, could overflow
                         int n1 = 0;            // all hostiles (my level or higher) on this tile
 
+                        // without hostiles on this tile, there is only our own team to count
+                        bool foes_on_tile = AI_WINDOW_HAS(foe_rows, i, j);
+                        if ((!foes_on_tile) && (color_of_moving_char >= 0) && (color_of_moving_char < STATE_NUM_TEAM_COLORS))
+                            total_score_friendlies += AI_playermap[v][u][color_of_moving_char];
+
+                        if (foes_on_tile)
                         for (int k = 0; k < STATE_NUM_TEAM_COLORS; k++)
                         {
                             int n2 = AI_playermap[v][u][k];
@@ -2239,6 +2347,7 @@ void CharacterState::MoveTowardsWaypointX_Pathfinder(RandomGenerator &rnd, int c
                     if ((NPCROLE_IS_MONSTER(ai_npc_role)) && (!on_the_run) && (dist <= AI_MONSTER_DETECTION_RANGE))
                     if (!(AI_IS_SAFEZONE(u, v)))
                     if (best < 2*COIN / dist)
+                    if (AI_WINDOW_HAS(weak_foe_rows, i, j))
                     {
                         for (int c = 0; c < STATE_NUM_TEAM_COLORS; c++)
                         {
@@ -2509,6 +2618,7 @@ void CharacterState::MoveTowardsWaypointX_Pathfinder(RandomGenerator &rnd, int c
                 }
 
                 // choose a Point of Interest
+                AI_poi_evaluations++;
                 int k_best = -1;
                 int d_best = AI_DIST_INFINITE;
 
@@ -5472,6 +5582,8 @@ static void sanitize_string(const std::string& s)
 void
 GameState::PrintPlayerStats()
 {
+    AssertLockHeld(cs_main);
+
     if ( (!IsInitialBlockDownload()) &&
           ((GetTime() > LastDumpStatsTime + 5) || (LastDumpStatsTime == 0)) )
     {
@@ -5981,12 +6093,19 @@ CollectedBounty::UpdateAddress (const GameState& state)
   address = i->second.address;
 }
 
-bool PerformStep(const GameState &inState, const StepData &stepData, GameState &outState, StepResult &stepResult)
+/* First phase of a game step, which does not depend on the new block's
+   hash.  outState is set to the intermediate state.  If fSpeculative is
+   set, this returns false early when a regular step is waiting.  */
+static bool
+PerformStepFirstPhase(const GameState &inState, const StepData &stepData,
+                      GameState &outState, StepResult &stepResult,
+                      StepPhaseData &phase, bool fSpeculative)
 {
     BOOST_FOREACH(const Move &m, stepData.vMoves)
         if (!m.IsValid(inState))
             return false;
 
+    LoadStepCaches(inState);
     outState = inState;
 
     /* Initialise basic stuff.  The disaster height is set to the old
@@ -5994,7 +6113,7 @@ bool PerformStep(const GameState &inState, const StepData &stepData, GameState &
        a disaster happens at this block.  */
     outState.nHeight = inState.nHeight + 1;
     outState.nDisasterHeight = inState.nDisasterHeight;
-    outState.hashBlock = stepData.newHash;
+    outState.hashBlock.SetNull();
     outState.dead_players_chat.clear();
 
     stepResult = StepResult();
@@ -6024,20 +6143,30 @@ bool PerformStep(const GameState &inState, const StepData &stepData, GameState &
     // SMC basic conversion -- part 29: cache some data for the game
     int64_t ai_nStart = GetTimeMillis();
     AI_rng_seed_hashblock = inState.hashBlock;
-    outState.Pass0_CacheDataForGame();
+    AI_poi_evaluations = 0;
+    {
+        GamePerfScope perf(GAMEPERF_PASS0);
+        outState.Pass0_CacheDataForGame();
+    }
 
     // SMC basic conversion -- part 30: bounties and voting
-    outState.Pass1_DAO();
+    {
+        GamePerfScope perf(GAMEPERF_PASS1);
+        outState.Pass1_DAO();
+    }
     if (STATE_VERSION < outState.dao_MinVersion)
     {
         printf("OBSOLETE VERSION: current %d, minimum %d\n", STATE_VERSION, outState.dao_MinVersion);
         return false;
     }
+    if (SpeculationPreempted(fSpeculative))
+        return false;
 
 
     /* Pay out game fees (except for spawns) to the game fund.  This also
        keeps track of the total fees paid into the game world by moves.  */
-    CAmount moneyIn = 0;
+    CAmount& moneyIn = phase.moneyIn;
+    moneyIn = 0;
     BOOST_FOREACH(const Move& m, stepData.vMoves)
       if (!m.IsSpawn ())
         {
@@ -6053,7 +6182,8 @@ bool PerformStep(const GameState &inState, const StepData &stepData, GameState &
         moneyIn += m.newLocked;
 
     // Apply attacks
-    CharactersOnTiles attackedTiles;
+    CharactersOnTiles& attackedTiles = phase.attackedTiles;
+    attackedTiles = CharactersOnTiles();
     attackedTiles.ApplyAttacks (outState, stepData.vMoves);
     if (outState.ForkInEffect (FORK_LIFESTEAL))
       attackedTiles.DefendMutualAttacks (outState);
@@ -6095,11 +6225,19 @@ bool PerformStep(const GameState &inState, const StepData &stepData, GameState &
         printf("AI RNG seed %s\n", AI_rng_seed_hashblock.ToString().c_str());
         printf("AI main function start %dms\n", (int)(GetTimeMillis() - ai_nStart));
     }
-    outState.Pass2_Melee();
+    {
+        GamePerfScope perf(GAMEPERF_PASS2);
+        outState.Pass2_Melee();
+    }
 
     // For all alive players perform path-finding
+    int64_t ai_nStartLoop = GetTimeMicros();
+    unsigned ai_characters = 0;
     BOOST_FOREACH(PAIRTYPE(const PlayerID, PlayerState) &p, outState.players)
     {
+        if (SpeculationPreempted(fSpeculative))
+            return false;
+
         // Dungeon levels part 2
         if (p.second.dlevel != nCalculatedActiveDlevel)
         {
@@ -6131,6 +6269,7 @@ bool PerformStep(const GameState &inState, const StepData &stepData, GameState &
             // SMC basic conversion -- part 34
             CharacterState &ch = pc.second;
 
+            ai_characters++;
             pc.second.MoveTowardsWaypointX_Merchants(rnd0, p.second.color, outState.nHeight);
             if (!(ch.ai_state2 & AI_STATE2_STASIS))
             {
@@ -6144,30 +6283,38 @@ bool PerformStep(const GameState &inState, const StepData &stepData, GameState &
         if ((dl >= 0) && (dl <= outState.dao_DlevelMax / 2) && (outState.dao_MinVersion >= 2020600))
             p.second.dlevel = dl;
     }
+    GamePerfAddTime(GAMEPERF_AI, GetTimeMicros() - ai_nStartLoop);
+    GamePerfAddCount(GAMEPERF_CHARACTERS, ai_characters);
+    GamePerfAddCount(GAMEPERF_POI_EVALUATIONS, AI_poi_evaluations);
 
 
     // SMC basic conversion -- part 35: process all weapon damage, and deposit loot that was sent by another character
-    outState.Pass3_PaymentAndHitscan();
-    outState.Pass4_Refund();
+    {
+        GamePerfScope perf(GAMEPERF_PASS3);
+        outState.Pass3_PaymentAndHitscan();
+    }
+    {
+        GamePerfScope perf(GAMEPERF_PASS4);
+        outState.Pass4_Refund();
+    }
 
     Displaycache_blockheight = outState.nHeight;
     if (fDebug)
         printf("AI main function height %d finished %dms\n", outState.nHeight, (int)(GetTimeMillis() - ai_nStart));
 
-//#ifdef GUI
-    // alphatest -- stat lists
-    if (fDebug)
-        outState.PrintPlayerStats();
-//#endif
+    /* The stat lists are printed by ConnectBlock for the new tip's state.
+       The step itself may run on a helper thread while ConnectBlock holds
+       cs_main, or for block templates, so it must not print them.  */
 
 
-    bool respawn_crown = false;
-    outState.UpdateCrownState(respawn_crown);
+    phase.respawnCrown = false;
+    outState.UpdateCrownState(phase.respawnCrown);
 
     // Caution: banking must not depend on the randomized events, because they depend on the hash -
     // miners won't be able to compute tax amount if it depends on the hash.
 
     // Banking
+    int64_t nStartBanking = GetTimeMicros();
     BOOST_FOREACH(PAIRTYPE(const PlayerID, PlayerState) &p, outState.players)
         BOOST_FOREACH(PAIRTYPE(const int, CharacterState) &pc, p.second.characters)
         {
@@ -6198,12 +6345,26 @@ bool PerformStep(const GameState &inState, const StepData &stepData, GameState &
                 ch.loot = CollectedLootInfo();
             }
         }
+    GamePerfAddTime(GAMEPERF_BANKING, GetTimeMicros() - nStartBanking);
 
-    // Miners set hashBlock to 0 in order to compute tax and include it into the coinbase.
-    // At this point the tax is fully computed, so we can return.
-    if (outState.hashBlock.IsNull ())
-        return true;
+    GamePerfAddCount(GAMEPERF_RNG_DRAWS, rnd0.GetDraws());
 
+    phase.minVersion = Cache_min_version;
+    phase.activeDlevel = nCalculatedActiveDlevel;
+    phase.heartsSpawn = Rpg_hearts_spawn;
+
+    return true;
+}
+
+/* Second phase of a game step, which uses the new block's hash as
+   random seed.  outState must be the intermediate state from the first
+   phase with hashBlock set.  */
+static bool
+PerformStepSecondPhase(const GameState &inState, const StepData &stepData,
+                       const StepPhaseData &phase,
+                       GameState &outState, StepResult &stepResult)
+{
+    assert(!outState.hashBlock.IsNull());
     RandomGenerator rnd(outState.hashBlock);
 
     /* Decide about whether or not this will be a disaster.  It should be
@@ -6221,7 +6382,7 @@ bool PerformStep(const GameState &inState, const StepData &stepData, GameState &
     /* Transfer life from attacks.  This is done randomly, but the decision
        about who dies is non-random and already set above.  */
     if (outState.ForkInEffect (FORK_LIFESTEAL))
-      attackedTiles.DistributeDrawnLife (rnd, outState);
+      phase.attackedTiles.DistributeDrawnLife (rnd, outState);
 
     // Spawn new players
     BOOST_FOREACH(const Move &m, stepData.vMoves)
@@ -6263,7 +6424,10 @@ bool PerformStep(const GameState &inState, const StepData &stepData, GameState &
     assert(nTotalTreasure + nCrownBonus == stepData.nTreasureAmount);
 
     // Players collect loot
-    outState.DivideLootAmongPlayers();
+    {
+        GamePerfScope perf(GAMEPERF_LOOT);
+        outState.DivideLootAmongPlayers();
+    }
     outState.CrownBonus(nCrownBonus);
 
 
@@ -6325,7 +6489,8 @@ bool PerformStep(const GameState &inState, const StepData &stepData, GameState &
     }
 
     outState.CollectHearts(rnd);
-    outState.CollectCrown(rnd, respawn_crown);
+    outState.CollectCrown(rnd, phase.respawnCrown);
+    GamePerfAddCount(GAMEPERF_RNG_DRAWS, rnd.GetDraws());
 
     /* Compute total money out of the game world via bounties paid.  */
     CAmount moneyOut = stepResult.nTaxAmount;
@@ -6336,12 +6501,12 @@ bool PerformStep(const GameState &inState, const StepData &stepData, GameState &
        we have a bug in the logic.  Better not accept the new game state.  */
     const CAmount moneyBefore = inState.GetCoinsOnMap () + inState.gameFund;
     const CAmount moneyAfter = outState.GetCoinsOnMap () + outState.gameFund;
-    if (moneyBefore + stepData.nTreasureAmount + moneyIn
+    if (moneyBefore + stepData.nTreasureAmount + phase.moneyIn
           != moneyAfter + moneyOut)
       {
         LogPrintf ("Old game state: %ld (@%d)\n", moneyBefore, inState.nHeight);
         LogPrintf ("New game state: %ld\n", moneyAfter);
-        LogPrintf ("Money in:  %ld\n", moneyIn);
+        LogPrintf ("Money in:  %ld\n", phase.moneyIn);
         LogPrintf ("Money out: %ld\n", moneyOut);
         LogPrintf ("Treasure placed: %ld\n", stepData.nTreasureAmount);
         return error ("total amount before and after step mismatch");
@@ -6349,3 +6514,76 @@ bool PerformStep(const GameState &inState, const StepData &stepData, GameState &
 
     return true;
 }
+
+bool PerformStep(const GameState &inState, const StepData &stepData, GameState &outState, StepResult &stepResult)
+{
+    RegularStepScope regular;
+    LOCK(cs_gameEngine);
+    GamePerfScope perfStep(GAMEPERF_STEP);
+
+    StepPhaseData phase;
+    if (!PerformStepFirstPhase(inState, stepData, outState, stepResult, phase, false))
+        return false;
+
+    // Miners set hashBlock to 0 in order to compute tax and include it into the coinbase.
+    // At this point the tax is fully computed, so we can return.
+    if (stepData.newHash.IsNull())
+        return true;
+
+    outState.hashBlock = stepData.newHash;
+    return PerformStepSecondPhase(inState, stepData, phase, outState, stepResult);
+}
+
+bool PrepareStep(const GameState &inState, const StepData &stepData, PreparedStep &prep)
+{
+    RegularStepScope regular;
+    LOCK(cs_gameEngine);
+    GamePerfScope perfStep(GAMEPERF_STEP);
+    return PerformStepFirstPhase(inState, stepData, prep.state, prep.result, prep.phase, false);
+}
+
+bool PrepareStepSpeculative(const GameState &inState, const StepData &stepData, PreparedStep &prep, bool &fAborted)
+{
+    fAborted = false;
+    if (SpeculationPreempted(true))
+    {
+        fAborted = true;
+        return false;
+    }
+
+    LOCK(cs_gameEngine);
+    if (SpeculationPreempted(true))
+    {
+        fAborted = true;
+        return false;
+    }
+
+    GamePerfScope perfStep(GAMEPERF_STEP);
+    if (PerformStepFirstPhase(inState, stepData, prep.state, prep.result, prep.phase, true))
+        return true;
+
+    fAborted = SpeculationPreempted(true);
+    return false;
+}
+
+bool FinishStep(const GameState &inState, const StepData &stepData, const PreparedStep &prep, GameState &outState, StepResult &stepResult)
+{
+    RegularStepScope regular;
+    LOCK(cs_gameEngine);
+    GamePerfScope perfStep(GAMEPERF_FINISH);
+
+    assert(!stepData.newHash.IsNull());
+    assert(prep.state.nHeight == inState.nHeight + 1);
+    assert(prep.state.hashBlock.IsNull());
+
+    outState = prep.state;
+    outState.hashBlock = stepData.newHash;
+    stepResult = prep.result;
+
+    LoadStepCaches(inState);
+    Cache_min_version = prep.phase.minVersion;
+    nCalculatedActiveDlevel = prep.phase.activeDlevel;
+    Rpg_hearts_spawn = prep.phase.heartsSpawn;
+
+    return PerformStepSecondPhase(inState, stepData, prep.phase, outState, stepResult);
+}
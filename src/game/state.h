@@ -780,6 +780,17 @@ struct GameState
       READWRITE (loot);
       READWRITE (hearts);
       READWRITE (banks);
+      SerializationOpGlobals (s, ser_action, nType, nVersion);
+    }
+
+    /* Serialise the "global" fields, i. e., everything except for the
+       player, loot, heart and bank containers.  This is split out so that
+       the state digest can hash them separately from the container
+       elements.  */
+    template<typename Stream, typename Operation>
+      inline void SerializationOpGlobals (Stream& s, Operation ser_action,
+                                          int nType, int nVersion)
+    {
       READWRITE (crownPos);
       READWRITE (crownHolder.player);
       if (!crownHolder.player.empty ())
@@ -906,6 +917,7 @@ struct GameState
     void Pass2_Melee ();
     void Pass3_PaymentAndHitscan ();
     void Pass4_Refund ();
+    /* Dump the html stat lists.  Needs cs_main.  */
     void PrintPlayerStats ();
 
 
@@ -1069,11 +1081,83 @@ public:
 
 };
 
+/**
+ * Data carried over from the first to the second phase of a game step,
+ * apart from the intermediate game state and step result.
+ */
+struct StepPhaseData
+{
+
+  /** Attacked characters, for distributing drawn life.  */
+  CharactersOnTiles attackedTiles;
+
+  /** Whether the crown should be respawned.  */
+  bool respawnCrown;
+
+  /** Total coins put into the game world by the moves.  */
+  CAmount moneyIn;
+
+  /* Values of the engine's global caches that are computed during the
+     first phase and used during the second.  They are restored from here
+     when the second phase is run for a prepared step, since other steps
+     may have been computed in the mean time.  */
+  int minVersion;
+  int activeDlevel;
+  bool heartsSpawn;
+
+  inline StepPhaseData ()
+    : attackedTiles(), respawnCrown(false), moneyIn(0),
+      minVersion(0), activeDlevel(0), heartsSpawn(false)
+  {}
+
+};
+
+/**
+ * The result of the first phase of a game step.  This phase (which includes
+ * the whole AI) depends only on the previous state and the moves, but not
+ * on the new block's hash.  It is also all that miners need to compute
+ * the tax amount.  Once prepared, the step can be finished cheaply for any
+ * block with the same moves on top of the same previous state.
+ */
+struct PreparedStep
+{
+
+  /** The intermediate game state (with null hashBlock).  */
+  GameState state;
+
+  /** The step result so far (with the final tax amount).  */
+  StepResult result;
+
+  /** Additional data for the second phase.  */
+  StepPhaseData phase;
+
+  /** Time (in microseconds) at which the step was prepared.  */
+  int64_t nTimePrepared;
+
+  explicit inline PreparedStep (const Consensus::Params& p)
+    : state(p), result(), phase(), nTimePrepared(0)
+  {}
+
+};
+
 // All moves happen simultaneously, so this function must work identically
 // for any ordering of the moves, except non-critical cases (e.g. finding
 // an empty cell to spawn new player)
 bool PerformStep(const GameState &inState, const StepData &stepData, GameState &outState, StepResult &stepResult);
 
+/* Perform only the first, hash-independent phase of a game step.  */
+bool PrepareStep(const GameState &inState, const StepData &stepData, PreparedStep &prep);
+
+/* Like PrepareStep, but for speculative work in the background.  This gives
+   way to regular steps (e.g. when connecting a block):  It is aborted as
+   soon as one is waiting for the engine, and fAborted is set then.  */
+bool PrepareStepSpeculative(const GameState &inState, const StepData &stepData, PreparedStep &prep, bool &fAborted);
+
+/* Finish a step prepared with PrepareStep for the same inState and moves.
+   stepData.newHash must be set.  The result is the same as that of
+   PerformStep for inState and stepData.  */
+bool FinishStep(const GameState &inState, const StepData &stepData, const PreparedStep &prep, GameState &outState, StepResult &stepResult);
+
 
 // SMC basic conversion -- part 15: variables declaration
 #define ALTNAME_LEN_MAX 18
@@ -16,12 +16,16 @@
 #include "checkpoints.h"
 #include "compat/sanity.h"
 #include "consensus/validation.h"
+#include "game/aikernels.h"
 #include "game/db.h"
+#include "game/replay.h"
+#include "game/snapshot.h"
 #include "httpserver.h"
 #include "httprpc.h"
 #include "key.h"
 #include "main.h"
 #include "miner.h"
+#include "names/main.h"
 #include "netbase.h"
 #include "net.h"
 #include "policy/policy.h"
@@ -29,6 +33,7 @@
 #include "rpc/register.h"
 #include "script/standard.h"
 #include "script/sigcache.h"
+#include "scrypt/scrypt.h"
 #include "scheduler.h"
 #include "timedata.h"
 #include "txdb.h"
@@ -342,6 +347,9 @@ std::string HelpMessage(HelpMessageMode mode)
     if (showDebug)
         strUsage += HelpMessageOpt("-feefilter", strprintf("Tell other nodes to filter invs to us by our mempool min fee (default: %u)", DEFAULT_FEEFILTER));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file on startup"));
+    strUsage += HelpMessageOpt("-loadgamestate=<file>", _("Imports a trusted game state snapshot written by dumpgamestate on startup, unless it was imported before"));
+    strUsage += HelpMessageOpt("-checkgamedigests", strprintf(_("Check game states read from disk against their digests, this needs a full pass over each state read or written (default: %u)"), DEFAULT_CHECKGAMEDIGESTS));
+    strUsage += HelpMessageOpt("-verifygamestate", strprintf(_("Verify imported game states against the full chain history in the background (default: %u)"), DEFAULT_VERIFYGAMESTATE));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
     strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
     strUsage += HelpMessageOpt("-mempoolexpiry=<n>", strprintf(_("Do not keep transactions in the mempool longer than <n> hours (default: %u)"), DEFAULT_MEMPOOL_EXPIRY));
@@ -358,7 +366,9 @@ std::string HelpMessage(HelpMessageMode mode)
 #ifndef WIN32
     strUsage += HelpMessageOpt("-sysperms", _("Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)"));
 #endif
+    strUsage += HelpMessageOpt("-gametxindex", strprintf(_("Store the game transactions of each block in the block index database, so that they can be read without the undo files (default: %u)"), DEFAULT_GAMETXINDEX));
     strUsage += HelpMessageOpt("-txindex", strprintf(_("Maintain a full transaction index, used by the getrawtransaction rpc call (default: %u)"), DEFAULT_TXINDEX));
+    strUsage += HelpMessageOpt("-nameaddressindex", strprintf(_("Maintain an index from addresses to the names they own, used by the name_byaddress rpc call (default: %u)"), DEFAULT_NAMEADDRESSINDEX));
     strUsage += HelpMessageOpt("-namehistory", strprintf(_("Keep track of the full name history (default: %u)"), 0));
 
     strUsage += HelpMessageGroup(_("Connection options:"));
@@ -422,10 +432,14 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-checkblockindex", strprintf("Do a full consistency check for mapBlockIndex, setBlockIndexCandidates, chainActive and mapBlocksUnlinked occasionally. Also sets -checkmempool (default: %u)", Params(CBaseChainParams::MAIN).DefaultConsistencyChecks()));
         strUsage += HelpMessageOpt("-checkmempool=<n>", strprintf("Run checks every <n> transactions (default: %u)", Params(CBaseChainParams::MAIN).DefaultConsistencyChecks()));
         strUsage += HelpMessageOpt("-checkpoints", strprintf("Disable expensive verification for known chain history (default: %u)", DEFAULT_CHECKPOINTS_ENABLED));
+        strUsage += HelpMessageOpt("-powhashcache=<n>", strprintf("Keep the scrypt proof-of-work hashes of up to <n> recently checked blocks in memory (default: %u, 0 to disable)", DEFAULT_POWHASHCACHE));
+        strUsage += HelpMessageOpt("-paranoidblockreads", strprintf("Verify the proof of work of every block read from disk, also if it is already validated in the block index.  Blocks and headers sent to peers are always verified, since the block hash does not cover the auxpow (default: %u)", DEFAULT_PARANOID_BLOCK_READS));
         strUsage += HelpMessageOpt("-disablesafemode", strprintf("Disable safemode, override a real safe mode event (default: %u)", DEFAULT_DISABLE_SAFEMODE));
         strUsage += HelpMessageOpt("-testsafemode", strprintf("Force safe mode (default: %u)", DEFAULT_TESTSAFEMODE));
         strUsage += HelpMessageOpt("-dropmessagestest=<n>", "Randomly drop 1 of every <n> network messages");
         strUsage += HelpMessageOpt("-fuzzmessagestest=<n>", "Randomly fuzz 1 of every <n> network messages");
+        strUsage += HelpMessageOpt("-replaygame=<from>:<to>", "Replay the game steps of the active chain between the given heights, log timing and state digests and exit");
+        strUsage += HelpMessageOpt("-replaygamecheck", "With -replaygame, replay twice and check that the resulting game states match (default: 0)");
         strUsage += HelpMessageOpt("-stopafterblockimport", strprintf("Stop running after importing blocks from disk (default: %u)", DEFAULT_STOPAFTERBLOCKIMPORT));
         strUsage += HelpMessageOpt("-limitancestorcount=<n>", strprintf("Do not accept transactions if number of in-mempool ancestors is <n> or more (default: %u)", DEFAULT_ANCESTOR_LIMIT));
         strUsage += HelpMessageOpt("-limitancestorsize=<n>", strprintf("Do not accept transactions whose size with all in-mempool ancestors exceeds <n> kilobytes (default: %u)", DEFAULT_ANCESTOR_SIZE_LIMIT));
@@ -433,7 +447,7 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-limitdescendantsize=<n>", strprintf("Do not accept transactions if any ancestor would have more than <n> kilobytes of in-mempool descendants (default: %u).", DEFAULT_DESCENDANT_SIZE_LIMIT));
         strUsage += HelpMessageOpt("-bip9params=deployment:start:end", "Use given start/end times for specified BIP9 deployment (regtest-only)");
     }
-    string debugCategories = "addrman, alert, bench, coindb, db, http, libevent, lock, mempool, mempoolrej, net, proxy, prune, rand, reindex, rpc, selectcoins, tor, zmq, names, game"; // Don't translate these and qt below
+    string debugCategories = "addrman, alert, bench, coindb, db, http, libevent, lock, mempool, mempoolrej, net, proxy, prune, rand, reindex, rpc, selectcoins, tor, zmq, names, game, game-bench"; // Don't translate these and qt below
     if (mode == HMM_BITCOIN_QT)
         debugCategories += ", qt";
     strUsage += HelpMessageOpt("-debug=<category>", strprintf(_("Output debugging information (default: %u, supplying <category> is optional)"), 0) + ". " +
@@ -477,6 +491,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-blockmaxweight=<n>", strprintf(_("Set maximum BIP141 block weight (default: %d)"), DEFAULT_BLOCK_MAX_WEIGHT));
     strUsage += HelpMessageOpt("-blockmaxsize=<n>", strprintf(_("Set maximum block size in bytes (default: %d)"), DEFAULT_BLOCK_MAX_SIZE));
     strUsage += HelpMessageOpt("-blockprioritysize=<n>", strprintf(_("Set maximum size of high-priority/low-fee transactions in bytes (default: %d)"), DEFAULT_BLOCK_PRIORITY_SIZE));
+    strUsage += HelpMessageOpt("-speculativegamestep", strprintf(_("Precompute the game step of the next block template in the background whenever the tip or pending moves change (default: %u)"), DEFAULT_SPECULATIVE_GAMESTEP));
     if (showDebug)
         strUsage += HelpMessageOpt("-blockversion=<n>", "Override block version to test forking scenarios");
 
@@ -1104,6 +1119,8 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         mempool.setSanityCheck(1.0 / ratio);
     }
     fCheckBlockIndex = GetBoolArg("-checkblockindex", chainparams.DefaultConsistencyChecks());
+    fParanoidBlockReads = GetBoolArg("-paranoidblockreads", DEFAULT_PARANOID_BLOCK_READS);
+    SetPowHashCacheSize(std::max<int64_t>(0, GetArg("-powhashcache", DEFAULT_POWHASHCACHE)));
     fCheckpointsEnabled = GetBoolArg("-checkpoints", DEFAULT_CHECKPOINTS_ENABLED);
 
     // mempool limits
@@ -1271,10 +1288,14 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     LogPrintf("Using config file %s\n", GetConfigFile(GetArg("-conf", BITCOIN_CONF_FILENAME)).string());
     LogPrintf("Using at most %i connections (%i file descriptors available)\n", nMaxConnections, nFD);
 
-    LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
+    scrypt_detect_multi();
+
+    LogPrintf("Using %u threads for script and header verification\n", nScriptCheckThreads);
     if (nScriptCheckThreads) {
         for (int i=0; i<nScriptCheckThreads-1; i++)
             threadGroup.create_thread(&ThreadScriptCheck);
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadHeaderCheck);
     }
 
     // Start the lightweight task scheduler thread
@@ -1287,6 +1308,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     Calculate_distance_to_POI();
     Calculate_distance_to_tiles();
     Calculate_merchantbasemap();
+    AI_DetectKernels();
 //    printf("AI initialized %15"PRI64d"ms\n", GetTimeMillis() - nStart);
 
 
@@ -1551,11 +1573,26 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                     strLoadError = _("You need to rebuild the database using -reindex-chainstate to change -txindex");
                     break;
                 }
+                // Check for changed -gametxindex state
+                if (fGameTxIndex != GetBoolArg("-gametxindex", DEFAULT_GAMETXINDEX)) {
+                    strLoadError = _("You need to rebuild the database using -reindex-chainstate to change -gametxindex");
+                    break;
+                }
+                // Check for changed -nameaddressindex state
+                if (fNameAddressIndex != GetBoolArg("-nameaddressindex", DEFAULT_NAMEADDRESSINDEX)) {
+                    strLoadError = _("You need to rebuild the database using -reindex-chainstate to change -nameaddressindex");
+                    break;
+                }
                 // Check for changed -namehistory state
                 if (fNameHistory != GetBoolArg("-namehistory", false)) {
                     strLoadError = _("You need to rebuild the database using -reindex to change -namehistory");
                     break;
                 }
+                // Convert name history from older versions to per-entry keys
+                if (fNameHistory && !pcoinsdbview->UpgradeNameHistory()) {
+                    strLoadError = _("Error upgrading name history database");
+                    break;
+                }
 
                 // Check for changed -prune state.  What we are concerned about is a user who has pruned blocks
                 // in the past, but is now trying to run unpruned.
@@ -1564,6 +1601,14 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                     break;
                 }
 
+                // Import a trusted game state, so that the game states needed
+                // below are computed from it instead of from the genesis block
+                if (mapArgs.count("-loadgamestate") && !fReindex) {
+                    uiInterface.InitMessage(_("Loading game state..."));
+                    if (!LoadGameStateSnapshot(GetArg("-loadgamestate", "")))
+                        return InitError(_("Failed to load the game state snapshot, see debug.log for details"));
+                }
+
                 if (!fReindex && chainActive.Tip() != NULL) {
                     uiInterface.InitMessage(_("Rewinding blocks..."));
                     if (!RewindBlockIndex(chainparams)) {
@@ -1634,6 +1679,19 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     }
     LogPrintf(" block index %15dms\n", GetTimeMillis() - nStart);
 
+    // Replay game steps for profiling and exit, if requested
+    if (mapArgs.count("-replaygame"))
+    {
+        int nReplayFrom, nReplayTo;
+        if (!ParseGameReplayRange(GetArg("-replaygame", ""), nReplayFrom, nReplayTo))
+            return InitError(strprintf(_("Invalid -replaygame range: '%s'"), GetArg("-replaygame", "")));
+        if (!ReplayGameSteps(nReplayFrom, nReplayTo, GetBoolArg("-replaygamecheck", false)))
+            return InitError(_("Replaying the game steps failed, see debug.log for details"));
+        LogPrintf("Game replay finished. Exiting.\n");
+        StartShutdown();
+        return true;
+    }
+
     boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
     CAutoFile est_filein(fopen(est_path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
     // Allowed to fail as this file IS missing on first startup.
@@ -1641,6 +1699,13 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         mempool.ReadFeeEstimates(est_filein);
     fFeeEstimatesInitialized = true;
 
+    // Start the name mempool at the loaded chain tip, so that NAME_NEW
+    // hashes get the right expiry before the next block is connected.
+    {
+        LOCK(cs_main);
+        mempool.setNameBestHeight(std::max(chainActive.Height(), 0));
+    }
+
     // ********************************************************* Step 8: load wallet
 #ifdef ENABLE_WALLET
     if (!CWallet::InitLoadWallet())
@@ -1747,6 +1812,13 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     SetRPCWarmupFinished();
     uiInterface.InitMessage(_("Done loading"));
 
+    if (GetBoolArg("-speculativegamestep", DEFAULT_SPECULATIVE_GAMESTEP))
+        threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "specstep", &ThreadSpeculativeGameStep));
+    if (GetBoolArg("-verifygamestate", DEFAULT_VERIFYGAMESTATE))
+        threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "gamestatecheck", &ThreadVerifyTrustedGameStates));
+    if (GetArg("-checknamedb", chainparams.DefaultCheckNameDB()) != -1)
+        threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "checknamedb", &ThreadCheckNameDB));
+
 #ifdef ENABLE_WALLET
     if (pwalletMain) {
         // Run a thread to flush wallet periodically
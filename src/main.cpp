@@ -17,6 +17,7 @@
 #include "consensus/validation.h"
 #include "game/db.h"
 #include "game/move.h"
+#include "game/perf.h"
 #include "game/state.h"
 #include "game/tx.h"
 #include "hash.h"
@@ -44,6 +45,8 @@
 #include "versionbits.h"
 
 #include <atomic>
+#include <exception>
+#include <list>
 #include <sstream>
 
 #include <boost/algorithm/string/replace.hpp>
@@ -75,11 +78,13 @@ int nScriptCheckThreads = 0;
 bool fImporting = false;
 bool fReindex = false;
 bool fTxIndex = false;
+bool fGameTxIndex = false;
 bool fHavePruned = false;
 bool fPruneMode = false;
 bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
 bool fRequireStandard = true;
 bool fCheckBlockIndex = false;
+bool fParanoidBlockReads = DEFAULT_PARANOID_BLOCK_READS;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
 size_t nCoinCacheUsage = 5000 * 300;
 uint64_t nPruneTarget = 0;
@@ -1231,7 +1236,7 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         }
     }
 
-    if (!pool.checkNameOps(tx))
+    if (!pool.checkNameOps(tx, setConflicts))
         return false;
     }
 
@@ -1330,7 +1335,21 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
             }
         }
 
+        /* Check the move (if any) against the game rules at the current
+           chain state, so that invalid moves never make it into the pool
+           and into block templates.  The parsed move is kept on the entry.  */
+        std::shared_ptr<const Move> move;
+        if (tx.IsNamecoin()) {
+            const GameStatePtr gameState = pgameDb->get(pcoinsTip->GetBestBlock());
+            if (!gameState)
+                return state.Error("AcceptToMemoryPool: failed to read game state");
+            CValidationState moveState;
+            if (!CheckMoveTransaction(tx, *gameState, &view, moveState, move))
+                return state.DoS(0, false, REJECT_INVALID, "bad-game-move");
+        }
+
         CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height(), pool.HasNoInputsOf(tx), inChainInputValue, fSpendsCoinbase, nSigOpsCost, lp);
+        entry.setMove(move);
         unsigned int nSize = entry.GetTxSize();
 
         // Check that the transaction doesn't have an excessive number of
@@ -1671,6 +1690,23 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::P
         }
     }
 
+    if (fGameTxIndex) {
+        uint256 hashGameBlock;
+        std::vector<CTransaction> vGameTx;
+        if (pblocktree->ReadGameTxIndex(hash, hashGameBlock)) {
+            if (!pblocktree->ReadGameTx(hashGameBlock, vGameTx))
+                return error("%s: game tx of block %s not found", __func__, hashGameBlock.ToString());
+            BOOST_FOREACH(const CTransaction &tx, vGameTx) {
+                if (tx.GetHash() == hash) {
+                    txOut = tx;
+                    hashBlock = hashGameBlock;
+                    return true;
+                }
+            }
+            return error("%s: game tx %s missing in block %s", __func__, hash.ToString(), hashGameBlock.ToString());
+        }
+    }
+
     if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
         int nHeight = -1;
         {
@@ -1684,7 +1720,7 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::P
     }
 
     /* Note that this won't work for game transactions.  For them,
-       the tx index is the only chance.  */
+       the tx index or the game tx index is the only chance.  */
     /* TODO: Fix this if important.  We could read also the undo file
        and go over the game tx.  */
 
@@ -1714,7 +1750,80 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::P
 // CBlock and CBlockIndex
 //
 
-bool CheckProofOfWork(const CBlockHeader& block, const Consensus::Params& params)
+/**
+ * Bounded LRU cache of scrypt PoW hashes by block hash.  The block hash
+ * commits to the full pure header, so it determines the PoW hash.  This
+ * lets repeated checks of the same header (e.g. by AcceptBlockHeader and
+ * then CheckBlock) skip the scrypt computation.  Only hashes of headers
+ * with valid PoW are stored.
+ */
+class CPowHashCache
+{
+private:
+    typedef std::list<std::pair<uint256, uint256> > EntryList;
+
+    /** Entries with the most recently used first.  */
+    EntryList entries;
+    boost::unordered_map<uint256, EntryList::iterator, BlockHasher> index;
+    size_t nMaxSize;
+
+    CCriticalSection cs;
+
+public:
+    CPowHashCache() : nMaxSize(DEFAULT_POWHASHCACHE) {}
+
+    void SetMaxSize(size_t nMaxSizeIn)
+    {
+        LOCK(cs);
+        nMaxSize = nMaxSizeIn;
+        Trim();
+    }
+
+    bool Lookup(const uint256& hash, uint256& powHash)
+    {
+        LOCK(cs);
+        const auto mit = index.find(hash);
+        if (mit == index.end())
+            return false;
+        entries.splice(entries.begin(), entries, mit->second);
+        powHash = mit->second->second;
+        return true;
+    }
+
+    void Insert(const uint256& hash, const uint256& powHash)
+    {
+        LOCK(cs);
+        if (nMaxSize == 0 || index.count(hash))
+            return;
+        entries.push_front(std::make_pair(hash, powHash));
+        index[hash] = entries.begin();
+        Trim();
+    }
+
+private:
+    void Trim()
+    {
+        AssertLockHeld(cs);
+        while (entries.size() > nMaxSize) {
+            index.erase(entries.back().first);
+            entries.pop_back();
+        }
+    }
+};
+
+static CPowHashCache powHashCache;
+
+void SetPowHashCacheSize(size_t nEntries)
+{
+    powHashCache.SetMaxSize(nEntries);
+}
+
+/**
+ * Check the proof of work of a block header.  If powHash is not NULL, it
+ * is the already computed PoW hash of the header and used instead of
+ * hashing it again (only for headers without auxpow).
+ */
+static bool CheckProofOfWork(const CBlockHeader& block, const uint256* powHash, const Consensus::Params& params)
 {
     const PowAlgo algo = block.GetAlgo();
 
@@ -1736,8 +1845,23 @@ bool CheckProofOfWork(const CBlockHeader& block, const Consensus::Params& params
             return error("%s : no auxpow on block with auxpow version",
                          __func__);
 
-        if (!CheckProofOfWork(block.GetPowHash(algo), block.nBits, algo, params))
+        /* SHA256D PoW hashes are the block hash and cheap anyway.  */
+        if (algo != ALGO_SCRYPT) {
+            if (!CheckProofOfWork(powHash ? *powHash : block.GetPowHash(algo), block.nBits, algo, params))
+                return error("%s : non-AUX proof of work failed", __func__);
+            return true;
+        }
+
+        const uint256 hash = block.GetHash();
+        uint256 scryptHash;
+        if (powHash)
+            scryptHash = *powHash;
+        else if (!powHashCache.Lookup(hash, scryptHash))
+            scryptHash = block.GetPowHash(algo);
+
+        if (!CheckProofOfWork(scryptHash, block.nBits, algo, params))
             return error("%s : non-AUX proof of work failed", __func__);
+        powHashCache.Insert(hash, scryptHash);
 
         return true;
     }
@@ -1766,6 +1890,115 @@ bool CheckProofOfWork(const CBlockHeader& block, const Consensus::Params& params
     return true;
 }
 
+bool CheckProofOfWork(const CBlockHeader& block, const Consensus::Params& params)
+{
+    return CheckProofOfWork(block, NULL, params);
+}
+
+/**
+ * Context-free PoW check of a range of headers from a headers message.
+ * The outcome for each header is written to a shared result vector, so
+ * that the check itself never fails and all headers are examined.
+ */
+class CHeaderPoWCheck
+{
+private:
+    const std::vector<const CBlockHeader*>* pheaders;
+    const Consensus::Params* pparams;
+    std::vector<char>* pvValid;
+    size_t nBegin;
+    size_t nEnd;
+
+public:
+    CHeaderPoWCheck() : pheaders(NULL), pparams(NULL), pvValid(NULL), nBegin(0), nEnd(0) {}
+    CHeaderPoWCheck(const std::vector<const CBlockHeader*>& headers, const Consensus::Params& params,
+                    std::vector<char>& vValid, size_t nBeginIn, size_t nEndIn)
+        : pheaders(&headers), pparams(&params), pvValid(&vValid), nBegin(nBeginIn), nEnd(nEndIn) {}
+
+    bool operator()();
+
+    void swap(CHeaderPoWCheck& check) {
+        std::swap(pheaders, check.pheaders);
+        std::swap(pparams, check.pparams);
+        std::swap(pvValid, check.pvValid);
+        std::swap(nBegin, check.nBegin);
+        std::swap(nEnd, check.nEnd);
+    }
+};
+
+bool CHeaderPoWCheck::operator()()
+{
+    /* Hash the headers without auxpow together per algo, so that scrypt
+       headers go through the multi-buffer implementation.  */
+    std::vector<const CPureBlockHeader*> vBatch[NUM_ALGOS];
+    std::vector<size_t> vIndices[NUM_ALGOS];
+    for (size_t i = nBegin; i < nEnd; ++i) {
+        const CBlockHeader& header = *(*pheaders)[i];
+        if (header.auxpow) {
+            (*pvValid)[i] = CheckProofOfWork(header, NULL, *pparams);
+            continue;
+        }
+        const PowAlgo algo = header.GetAlgo();
+        vBatch[algo].push_back(&header);
+        vIndices[algo].push_back(i);
+    }
+
+    std::vector<uint256> vHashes;
+    for (int algo = 0; algo < NUM_ALGOS; ++algo) {
+        CPureBlockHeader::GetPowHashes(vBatch[algo], static_cast<PowAlgo>(algo), vHashes);
+        for (size_t j = 0; j < vIndices[algo].size(); ++j) {
+            const size_t i = vIndices[algo][j];
+            (*pvValid)[i] = CheckProofOfWork(*(*pheaders)[i], &vHashes[j], *pparams);
+        }
+    }
+
+    return true;
+}
+
+/** Number of headers handled by one CHeaderPoWCheck.  */
+static const size_t HEADER_CHECK_BATCH = 8;
+
+static CCheckQueue<CHeaderPoWCheck> headercheckqueue(4);
+
+void ThreadHeaderCheck() {
+    RenameThread("bitcoin-headerch");
+    headercheckqueue.Thread();
+}
+
+/**
+ * Check the proof of work of many headers at once, spreading the work
+ * over the header check threads.  vValid is set to whether the PoW
+ * of each header is valid.  The headers are checked in order, one round
+ * of batches (one per thread) at a time.  Once a round contains an
+ * invalid header, the remaining ones are left unchecked (and marked as
+ * not valid), so that a peer sending bad headers can not make us hash
+ * all of them.
+ */
+static void CheckHeadersProofOfWork(const std::vector<const CBlockHeader*>& headers, const Consensus::Params& params, std::vector<char>& vValid)
+{
+    vValid.assign(headers.size(), 0);
+    const size_t nRound = HEADER_CHECK_BATCH * std::max(nScriptCheckThreads, 1);
+    for (size_t nStart = 0; nStart < headers.size(); nStart += nRound) {
+        const size_t nEnd = std::min(nStart + nRound, headers.size());
+        std::vector<CHeaderPoWCheck> vChecks;
+        for (size_t i = nStart; i < nEnd; i += HEADER_CHECK_BATCH)
+            vChecks.push_back(CHeaderPoWCheck(headers, params, vValid, i, std::min(i + HEADER_CHECK_BATCH, nEnd)));
+
+        if (nScriptCheckThreads) {
+            CCheckQueueControl<CHeaderPoWCheck> control(&headercheckqueue);
+            control.Add(vChecks);
+            control.Wait();
+        } else {
+            BOOST_FOREACH(CHeaderPoWCheck& check, vChecks)
+                check();
+        }
+
+        for (size_t i = nStart; i < nEnd; ++i)
+            if (!vValid[i])
+                return;
+    }
+}
+
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
 {
     // Open history file to append
@@ -1791,7 +2024,7 @@ bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHea
    both a block and its header.  */
 
 template<typename T>
-static bool ReadBlockOrHeader(T& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
+static bool ReadBlockOrHeader(T& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams, bool fCheckPOW=true)
 {
     block.SetNull();
 
@@ -1809,16 +2042,24 @@ static bool ReadBlockOrHeader(T& block, const CDiskBlockPos& pos, const Consensu
     }
 
     // Check the header
-    if (!CheckProofOfWork(block, consensusParams))
+    if (fCheckPOW && !CheckProofOfWork(block, consensusParams))
         return error("ReadBlockFromDisk: Errors in block header at %s", pos.ToString());
 
     return true;
 }
 
 template<typename T>
-static bool ReadBlockOrHeader(T& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams)
+static bool ReadBlockOrHeader(T& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams, bool fCheckPOW)
 {
-    if (!ReadBlockOrHeader(block, pindex->GetBlockPos(), consensusParams))
+    /* The PoW of a block whose header is valid in the index has already
+       been checked when the header was accepted.  If the hash we read
+       matches the index, the pure header is unchanged.  The hash does not
+       cover the auxpow, though.  A corrupted auxpow on disk is only caught
+       if fCheckPOW is set, which callers do for data that is sent to
+       peers, or with -paranoidblockreads.  */
+    const bool fKnownValid = !fCheckPOW && !fParanoidBlockReads && pindex->IsValid(BLOCK_VALID_TREE);
+
+    if (!ReadBlockOrHeader(block, pindex->GetBlockPos(), consensusParams, !fKnownValid))
         return false;
     if (block.GetHash() != pindex->GetBlockHash())
         return error("ReadBlockFromDisk(CBlock&, CBlockIndex*): GetHash() doesn't match index for %s at %s",
@@ -1831,14 +2072,14 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
     return ReadBlockOrHeader(block, pos, consensusParams);
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams)
+bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams, bool fCheckPOW)
 {
-    return ReadBlockOrHeader(block, pindex, consensusParams);
+    return ReadBlockOrHeader(block, pindex, consensusParams, fCheckPOW);
 }
 
 bool ReadBlockFromDisk(CBlock& block, std::vector<CTransaction>& vGameTx, const CBlockIndex* pindex, const Consensus::Params& consensusParams)
 {
-    if (!ReadBlockFromDisk(block, pindex, consensusParams))
+    if (!ReadBlockFromDisk(block, pindex, consensusParams, false))
         return false;
 
     /* If this is the genesis block, skip reading the undo file as it does
@@ -1848,6 +2089,11 @@ bool ReadBlockFromDisk(CBlock& block, std::vector<CTransaction>& vGameTx, const
         return true;
     }
 
+    /* With the game tx index, they are a single lookup.  Fall back to the
+       undo file for blocks that have not been indexed.  */
+    if (fGameTxIndex && pblocktree->ReadGameTx(pindex->GetBlockHash(), vGameTx))
+        return true;
+
     /* Read also the game tx array from the undo file.  */
     CAutoFile undo(OpenUndoFile(pindex->GetUndoPos(), true), SER_DISK, CLIENT_VERSION);
     if (undo.IsNull())
@@ -1862,7 +2108,9 @@ bool ReadBlockFromDisk(CBlock& block, std::vector<CTransaction>& vGameTx, const
 
 bool ReadBlockHeaderFromDisk(CBlockHeader& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams)
 {
-    return ReadBlockOrHeader(block, pindex, consensusParams);
+    /* Headers are read from disk only for their auxpow, and mostly to be
+       sent to peers.  Always check it.  */
+    return ReadBlockOrHeader(block, pindex, consensusParams, true);
 }
 
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
@@ -2514,6 +2762,48 @@ static int64_t nTimeIndex = 0;
 static int64_t nTimeCallbacks = 0;
 static int64_t nTimeTotal = 0;
 
+/**
+ * The game step of a block being connected.  When script checks are done
+ * by the check queue, it is run on its own thread so that the engine
+ * overlaps with script verification (in which the calling thread takes
+ * part while waiting for the queue).  Exceptions are passed back to
+ * the calling thread.
+ */
+struct ConnectBlockGameStep
+{
+    const CBlock& block;
+    GameStatePtr stateIn;
+    const CCoinsView* pview;
+    GameState& stateOut;
+
+    CValidationState valid;
+    StepResult result;
+    bool fOk;
+    std::exception_ptr exception;
+
+    ConnectBlockGameStep(const CBlock& blockIn, const CCoinsView* view,
+                         GameState& newState)
+        : block(blockIn), stateIn(), pview(view), stateOut(newState),
+          valid(), result(), fOk(false), exception()
+    {}
+
+    void Run()
+    {
+        GamePerfConnectScope perfConnect;
+        try {
+            fOk = PerformStep(block, *stateIn, pview, valid, result, stateOut);
+        } catch (...) {
+            exception = std::current_exception();
+        }
+    }
+};
+
+static void ThreadConnectBlockGameStep(ConnectBlockGameStep* step)
+{
+    RenameThread("alifecoin-gamestep");
+    step->Run();
+}
+
 bool ConnectBlockWithGameTx(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view,
                             std::vector<CTransaction>& vGameTx,
                             const CChainParams& chainparams, bool fJustCheck)
@@ -2703,22 +2993,55 @@ bool ConnectBlockWithGameTx(const CBlock& block, CValidationState& state, CBlock
        checks about validity of all moves.  Ignore this for the genesis
        block, since there is no "previous state" to fetch and advance.
        There are no game transactions for it, either.  In this case,
-       the default-constructed StepResult is fine.  */
+       the default-constructed StepResult is fine.
+
+       The step only reads the view, which is not touched by the script
+       checks.  Thus it can run in parallel to them.  The previous state
+       is fetched beforehand, since that may need cs_main (held by us)
+       for recomputation, and the new state stored afterwards for
+       the same reason.  */
+    GamePerfConnectScope perfConnect;
     const bool isGenesis = (block.GetHash() == chainparams.GetConsensus().hashGenesisBlock);
-    StepResult stepResult;
+    std::shared_ptr<GameState> newGameState(new GameState(chainparams.GetConsensus ()));
+    ConnectBlockGameStep gameStep(block, &view, *newGameState);
+    boost::thread gameStepThread;
     if (!isGenesis)
       {
-        GameState prevGameState(chainparams.GetConsensus ());
-        if (!pgameDb->get (*pindex->pprev->phashBlock, prevGameState))
+        gameStep.stateIn = pgameDb->get (*pindex->pprev->phashBlock);
+        if (!gameStep.stateIn)
           return state.Error ("ConnectBlock: failed to read prev game state");
 
-        GameState newGameState(chainparams.GetConsensus ());
-        if (!PerformStep (block, prevGameState, &view, state,
-                          stepResult, newGameState))
-          return state.Invalid (error ("%s: game engine step failed",
-                                       __func__));
+        if (fScriptChecks && nScriptCheckThreads)
+          gameStepThread = boost::thread(&ThreadConnectBlockGameStep,
+                                         &gameStep);
+        else
+          gameStep.Run();
+      }
 
-        pgameDb->store (block.GetHash (), newGameState);
+    const bool fScriptsOk = control.Wait();
+
+    const StepResult& stepResult = gameStep.result;
+    if (!isGenesis)
+      {
+        if (gameStepThread.joinable())
+          gameStepThread.join();
+        if (gameStep.exception)
+          std::rethrow_exception(gameStep.exception);
+
+        if (!gameStep.fOk)
+          {
+            state = gameStep.valid;
+            return state.Invalid (error ("%s: game engine step failed",
+                                         __func__));
+          }
+
+        // alphatest -- stat lists (on our thread, since they need cs_main)
+        if (fDebug)
+            newGameState->PrintPlayerStats();
+
+        assert(newGameState->hashBlock == block.GetHash());
+        pgameDb->storeHandle (newGameState);
+        GamePerfLogStep (pindex->nHeight);
       }
     nFees += stepResult.nTaxAmount;
 
@@ -2742,7 +3065,7 @@ bool ConnectBlockWithGameTx(const CBlock& block, CValidationState& state, CBlock
                                block.vtx[0].GetValueOut(), blockReward),
                                REJECT_INVALID, "bad-cb-amount");
 
-    if (!control.Wait())
+    if (!fScriptsOk)
         return state.DoS(100, false);
     int64_t nTime4 = GetTimeMicros(); nTimeVerify += nTime4 - nTime2;
     LogPrint("bench", "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs]\n", nInputs - 1, 0.001 * (nTime4 - nTime2), nInputs <= 1 ? 0 : 0.001 * (nTime4 - nTime2) / (nInputs-1), nTimeVerify * 0.000001);
@@ -2791,6 +3114,10 @@ bool ConnectBlockWithGameTx(const CBlock& block, CValidationState& state, CBlock
         if (!pblocktree->WriteTxIndex(vPos))
             return AbortNode(state, "Failed to write transaction index");
 
+    if (fGameTxIndex && !isGenesis)
+        if (!pblocktree->WriteGameTx(pindex->GetBlockHash(), vGameTx))
+            return AbortNode(state, "Failed to write game transaction index");
+
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
 
@@ -3009,12 +3336,55 @@ void static UpdateTip(CBlockIndex *pindexNew, const CChainParams& chainParams) {
 
 }
 
+/**
+ * Revalidate the moves of pending name updates after the tip changed from
+ * the block hashOld to the current tip.  Only moves whose validity may
+ * differ between the two game states (see IsMoveAffected) are checked
+ * again.  Those that are no longer valid are removed from the mempool.
+ */
+static void UpdateMempoolMoves(const uint256& hashOld, std::list<CTransaction>& removed)
+{
+    AssertLockHeld(cs_main);
+
+    std::vector<CTransaction> vInvalid;
+    {
+        LOCK(mempool.cs);
+        const CNameMemPool::NameOpsByName& ops = mempool.getNameOps();
+        if (ops.empty())
+            return;
+
+        const GameStatePtr stateOld = pgameDb->get(hashOld);
+        const GameStatePtr stateNew = pgameDb->getTip();
+        if (!stateOld || !stateNew) {
+            error("%s: failed to read game states", __func__);
+            return;
+        }
+
+        CCoinsViewMemPool viewMemPool(pcoinsTip, mempool);
+        for (CNameMemPool::NameOpsByName::const_iterator it = ops.begin(); it != ops.end(); ++it) {
+            const CTxMemPool::txiter mi = mempool.mapTx.find(it->txid);
+            assert(mi != mempool.mapTx.end());
+            const std::shared_ptr<const Move>& move = mi->getMove();
+            if (!move || !IsMoveAffected(*move, *stateOld, *stateNew))
+                continue;
+
+            CValidationState valid;
+            if (!CheckMove(*move, mi->GetTx(), *stateNew, &viewMemPool, valid))
+                vInvalid.push_back(mi->GetTx());
+        }
+    }
+
+    BOOST_FOREACH(const CTransaction& tx, vInvalid) {
+        LogPrint("mempool", "%s: removing %s with an invalid move\n", __func__, tx.GetHash().ToString());
+        mempool.removeRecursive(tx, removed);
+    }
+}
+
 /** Disconnect chainActive's tip. You probably want to call mempool.removeForReorg and manually re-limit mempool size after this, with cs_main held. */
 bool static DisconnectTip(CValidationState& state, const CChainParams& chainparams, bool fBare = false)
 {
     CBlockIndex *pindexDelete = chainActive.Tip();
     assert(pindexDelete);
-    CheckNameDB (true);
     // Read block from disk.
     CBlock block;
     std::vector<CTransaction> vGameTx;
@@ -3071,7 +3441,9 @@ bool static DisconnectTip(CValidationState& state, const CChainParams& chainpara
 
     // Update chainActive and related variables.
     UpdateTip(pindexDelete->pprev, chainparams);
-    CheckNameDB (true);
+    CheckNameDB(block, vGameTx, true);
+    if (!fBare)
+        UpdateMempoolMoves(pindexDelete->GetBlockHash(), txNameConflicts);
     // Tell wallet about transactions that went from mempool
     // to conflicted:
     BOOST_FOREACH(const CTransaction &tx, txNameConflicts) {
@@ -3102,7 +3474,6 @@ static int64_t nTimePostConnect = 0;
 bool static ConnectTip(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexNew, const CBlock* pblock, std::list<CTransaction> &txConflicted, std::list<CTransaction> &txNameConflicts, std::vector<std::tuple<CTransaction,CBlockIndex*,int>> &txChanged)
 {
     assert(pindexNew->pprev == chainActive.Tip());
-    CheckNameDB (true);
     // Read block from disk.
     int64_t nTime1 = GetTimeMicros();
     CBlock block;
@@ -3145,7 +3516,9 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     mempool.removeForBlock(allTx, pindexNew->nHeight, txConflicted, txNameConflicts, !IsInitialBlockDownload());
     // Update chainActive & related variables.
     UpdateTip(pindexNew, chainparams);
-    CheckNameDB (false);
+    CheckNameDB(*pblock, vGameTx, false);
+    if (pindexNew->pprev)
+        UpdateMempoolMoves(pindexNew->pprev->GetBlockHash(), txNameConflicts);
 
     for(unsigned int i=0; i < allTx.size(); i++)
         txChanged.emplace_back(allTx[i], pindexNew, i);
@@ -3950,7 +4323,7 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, const Co
     return true;
 }
 
-static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex=NULL)
+static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex=NULL, bool fCheckPOW=true)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
@@ -3969,7 +4342,7 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
             return true;
         }
 
-        if (!CheckBlockHeader(block, state, chainparams.GetConsensus()))
+        if (!CheckBlockHeader(block, state, chainparams.GetConsensus(), fCheckPOW))
             return error("%s: Consensus::CheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
 
         // Get prev block index
@@ -4385,9 +4758,15 @@ bool static LoadBlockIndexDB()
     pblocktree->ReadFlag("txindex", fTxIndex);
     LogPrintf("%s: transaction index %s\n", __func__, fTxIndex ? "enabled" : "disabled");
 
+    // Check whether we have a game transaction index
+    pblocktree->ReadFlag("gametxindex", fGameTxIndex);
+    LogPrintf("%s: game transaction index %s\n", __func__, fGameTxIndex ? "enabled" : "disabled");
+
     // Check whether we have the name history
     pblocktree->ReadFlag("namehistory", fNameHistory);
     LogPrintf("LoadBlockIndexDB(): name history %s\n", fNameHistory ? "enabled" : "disabled");
+    pblocktree->ReadFlag("nameaddressindex", fNameAddressIndex);
+    LogPrintf("%s: name address index %s\n", __func__, fNameAddressIndex ? "enabled" : "disabled");
 
     // Load pointer to end of best chain
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
@@ -4671,8 +5050,12 @@ bool InitBlockIndex(const CChainParams& chainparams)
     // Use the provided setting for -txindex in the new database
     fTxIndex = GetBoolArg("-txindex", DEFAULT_TXINDEX);
     pblocktree->WriteFlag("txindex", fTxIndex);
+    fGameTxIndex = GetBoolArg("-gametxindex", DEFAULT_GAMETXINDEX);
+    pblocktree->WriteFlag("gametxindex", fGameTxIndex);
     fNameHistory = GetBoolArg("-namehistory", false);
     pblocktree->WriteFlag("namehistory", fNameHistory);
+    fNameAddressIndex = GetBoolArg("-nameaddressindex", DEFAULT_NAMEADDRESSINDEX);
+    pblocktree->WriteFlag("nameaddressindex", fNameAddressIndex);
     LogPrintf("Initializing databases...\n");
 
     // Only add the genesis block if not reindexing (in which case we reuse the one already on disk)
@@ -5185,7 +5568,7 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                 {
                     // Send block from disk
                     CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second, consensusParams))
+                    if (!ReadBlockFromDisk(block, (*mi).second, consensusParams, true))
                         assert(!"cannot load block from disk");
                     if (inv.type == MSG_BLOCK)
                         pfrom->PushMessageWithFlag(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, block);
@@ -5757,7 +6140,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         }
 
         CBlock block;
-        assert(ReadBlockFromDisk(block, it->second, chainparams.GetConsensus()));
+        assert(ReadBlockFromDisk(block, it->second, chainparams.GetConsensus(), true));
 
         BlockTransactions resp(req);
         for (size_t i = 0; i < req.indexes.size(); i++) {
@@ -6210,6 +6593,27 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             }
         }
 
+        // Check the proof of work of the new headers in parallel, without
+        // holding cs_main.  Headers that we already know or that do not
+        // connect to our block tree are left to AcceptBlockHeader.
+        std::vector<char> vPowChecked(nCount, 0);
+        {
+            std::vector<const CBlockHeader*> vToCheck;
+            {
+                LOCK(cs_main);
+                if (nCount > 0 && mapBlockIndex.count(headers[0].hashPrevBlock)) {
+                    BOOST_FOREACH(const CBlockHeader& header, headers) {
+                        if (!mapBlockIndex.count(header.GetHash()))
+                            vToCheck.push_back(&header);
+                    }
+                }
+            }
+            std::vector<char> vPowValid;
+            CheckHeadersProofOfWork(vToCheck, chainparams.GetConsensus(), vPowValid);
+            for (size_t i = 0; i < vToCheck.size(); ++i)
+                vPowChecked[vToCheck[i] - &headers[0]] = vPowValid[i];
+        }
+
         {
         LOCK(cs_main);
 
@@ -6255,13 +6659,14 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         }
 
         CBlockIndex *pindexLast = NULL;
-        BOOST_FOREACH(const CBlockHeader& header, headers) {
+        for (unsigned int n = 0; n < nCount; n++) {
+            const CBlockHeader& header = headers[n];
             CValidationState state;
             if (pindexLast != NULL && header.hashPrevBlock != pindexLast->GetBlockHash()) {
                 Misbehaving(pfrom->GetId(), 20);
                 return error("non-continuous headers sequence");
             }
-            if (!AcceptBlockHeader(header, state, chainparams, &pindexLast)) {
+            if (!AcceptBlockHeader(header, state, chainparams, &pindexLast, !vPowChecked[n])) {
                 int nDoS;
                 if (state.IsInvalid(nDoS)) {
                     if (nDoS > 0)
@@ -6966,7 +7371,7 @@ bool SendMessages(CNode* pto, CConnman& connman)
                             vHeaders.front().GetHash().ToString(), pto->id);
                     //TODO: Shouldn't need to reload block from disk, but requires refactor
                     CBlock block;
-                    assert(ReadBlockFromDisk(block, pBestIndex, consensusParams));
+                    assert(ReadBlockFromDisk(block, pBestIndex, consensusParams, true));
                     CBlockHeaderAndShortTxIDs cmpctblock(block, state.fWantsCmpctWitness);
                     pto->PushMessageWithFlag(state.fWantsCmpctWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::CMPCTBLOCK, cmpctblock);
                     state.pindexBestHeaderSent = pBestIndex;
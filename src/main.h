@@ -148,6 +148,11 @@ static const int64_t DEFAULT_MAX_TIP_AGE = 24 * 60 * 60;
 static const bool DEFAULT_PERMIT_BAREMULTISIG = true;
 static const bool DEFAULT_CHECKPOINTS_ENABLED = true;
 static const bool DEFAULT_TXINDEX = false;
+static const bool DEFAULT_GAMETXINDEX = false;
+/** Default for -powhashcache, the number of cached scrypt PoW hashes */
+static const unsigned int DEFAULT_POWHASHCACHE = 10000;
+/** Default for -paranoidblockreads */
+static const bool DEFAULT_PARANOID_BLOCK_READS = false;
 static const unsigned int DEFAULT_BANSCORE_THRESHOLD = 100;
 
 static const bool DEFAULT_TESTSAFEMODE = false;
@@ -184,9 +189,12 @@ extern bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
 extern bool fTxIndex;
+extern bool fGameTxIndex;
 extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
 extern bool fCheckBlockIndex;
+/** Re-verify the PoW of every block read from disk, even if already validated.  */
+extern bool fParanoidBlockReads;
 extern bool fCheckpointsEnabled;
 extern size_t nCoinCacheUsage;
 /** A fee rate smaller than this is considered zero fee (for relaying, mining and transaction creation) */
@@ -275,6 +283,8 @@ bool ProcessMessages(CNode* pfrom, CConnman& connman);
 bool SendMessages(CNode* pto, CConnman& connman);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the header PoW checking thread */
+void ThreadHeaderCheck();
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Format a string that describes several potential problems detected by the core.
@@ -474,10 +484,18 @@ public:
 };
 
 
+/** Set the maximum number of entries in the scrypt PoW hash cache (0 disables it) */
+void SetPowHashCacheSize(size_t nEntries);
+
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
-bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+/**
+ * Read a block by its index entry.  The PoW is only checked again if fCheckPOW
+ * is set (for blocks sent to peers), if the index entry is not yet valid or
+ * with -paranoidblockreads.
+ */
+bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams, bool fCheckPOW = false);
 bool ReadBlockHeaderFromDisk(CBlockHeader& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, std::vector<CTransaction>& vGameTx,
                        const CBlockIndex* pindex, const Consensus::Params& consensusParams);
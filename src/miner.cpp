@@ -14,6 +14,7 @@
 #include "consensus/validation.h"
 #include "game/db.h"
 #include "game/move.h"
+#include "game/perf.h"
 #include "game/state.h"
 #include "hash.h"
 #include "main.h"
@@ -50,6 +51,9 @@ uint64_t nLastBlockTx = 0;
 uint64_t nLastBlockSize = 0;
 uint64_t nLastBlockWeight = 0;
 
+/** How often to retry creating a block if the tip changes meanwhile.  */
+static const unsigned MAX_CREATE_BLOCK_TRIES = 3;
+
 class ScoreCompare
 {
 public:
@@ -126,13 +130,26 @@ void BlockAssembler::resetBlock()
 }
 
 CBlockTemplate* BlockAssembler::CreateNewBlock(PowAlgo algo, const CScript& scriptPubKeyIn)
+{
+    for (unsigned nTries = 0; nTries < MAX_CREATE_BLOCK_TRIES; ++nTries)
+    {
+        CBlockTemplate* res = TryCreateNewBlock(algo, scriptPubKeyIn);
+        if (res)
+            return res;
+        LogPrint("miner", "%s: tip changed during game step, retrying\n", __func__);
+    }
+
+    throw std::runtime_error(strprintf("%s: tip keeps changing", __func__));
+}
+
+CBlockIndex* BlockAssembler::SelectTransactions(PowAlgo algo)
 {
     resetBlock();
 
     pblocktemplate.reset(new CBlockTemplate());
 
     if(!pblocktemplate.get())
-        return NULL;
+        throw std::runtime_error(strprintf("%s: out of memory", __func__));
     pblock = &pblocktemplate->block; // pointer for convenience
 
     // Add dummy coinbase tx as first transaction
@@ -140,12 +157,15 @@ CBlockTemplate* BlockAssembler::CreateNewBlock(PowAlgo algo, const CScript& scri
     pblocktemplate->vTxFees.push_back(-1); // updated at end
     pblocktemplate->vTxSigOpsCost.push_back(-1); // updated at end
 
+    // Select the transactions and snapshot the previous game state.  Only
+    // this needs the locks, since the mempool entries are copied into the
+    // block and the moves into gameStep.
     LOCK2(cs_main, mempool.cs);
     CBlockIndex* pindexPrev = chainActive.Tip();
     nHeight = pindexPrev->nHeight + 1;
 
-    prevGameState.reset(new GameState(chainparams.GetConsensus()));
-    if (!pgameDb->get(*pindexPrev->phashBlock, *prevGameState))
+    prevGameState = pgameDb->getTip();
+    if (!prevGameState)
         throw std::runtime_error(strprintf("%s: Failed to read prev game state", __func__));
     gameStep.reset(new StepData(*prevGameState));
 
@@ -178,12 +198,36 @@ CBlockTemplate* BlockAssembler::CreateNewBlock(PowAlgo algo, const CScript& scri
     addPriorityTxs();
     addPackageTxs();
 
-    // Compute miner taxes from game step.
+    return pindexPrev;
+}
+
+CBlockTemplate* BlockAssembler::TryCreateNewBlock(PowAlgo algo, const CScript& scriptPubKeyIn)
+{
+    CBlockIndex* pindexPrev = SelectTransactions(algo);
+
+    // Compute miner taxes from game step.  Only the hash-independent phase
+    // is needed for that.  It is remembered, so that TestBlockValidity below
+    // and connecting the block once found only need the second phase.
+    // This is the expensive part, and it runs on the immutable snapshot
+    // without holding cs_main or mempool.cs.
     assert(gameStep->newHash.IsNull());
-    GameState newGameState(chainparams.GetConsensus());
-    StepResult stepResult;
-    if (!PerformStep(*prevGameState, *gameStep, newGameState, stepResult))
+    bool fCached;
+    const std::shared_ptr<const PreparedStep> preparedStep
+        = PrepareGameStep(*prevGameState, *gameStep, &fCached);
+    if (!preparedStep)
         throw std::runtime_error(strprintf("%s: game engine failed to perform step", __func__));
+    const StepResult& stepResult = preparedStep->result;
+    if (fCached)
+    {
+        GamePerfAddCount(GAMEPERF_TEMPLATE_STEP_HITS, 1);
+        GamePerfAddTime(GAMEPERF_TEMPLATE_STEP_AGE, GetTimeMicros() - preparedStep->nTimePrepared);
+    }
+    else
+        GamePerfAddCount(GAMEPERF_TEMPLATE_STEP_MISSES, 1);
+
+    LOCK(cs_main);
+    if (chainActive.Tip() != pindexPrev)
+        return NULL;
 
     nLastBlockTx = nBlockTx;
     nLastBlockSize = nBlockSize;
@@ -217,6 +261,18 @@ CBlockTemplate* BlockAssembler::CreateNewBlock(PowAlgo algo, const CScript& scri
     return pblocktemplate.release();
 }
 
+bool BlockAssembler::PrepareNextGameStep()
+{
+    // The algo only affects the header, not the selected transactions.
+    SelectTransactions(ALGO_SHA256D);
+    bool fAborted;
+    if (PrepareSpeculativeGameStep(*prevGameState, *gameStep, fAborted))
+        return true;
+    if (fAborted)
+        return false;
+    throw std::runtime_error(strprintf("%s: game engine failed to perform step", __func__));
+}
+
 bool BlockAssembler::isStillDependent(CTxMemPool::txiter iter)
 {
     BOOST_FOREACH(CTxMemPool::txiter parent, mempool.GetMemPoolParents(iter))
@@ -390,11 +446,13 @@ void BlockAssembler::AddToBlock(CTxMemPool::txiter iter)
     inBlock.insert(iter);
 
     /* Add the tx to the game step data.  This is necessary for the tax
-       computation.  It also does another check for validity with respect
-       to the game rules, but that one "should" not fail and will lead to
-       an invalid block.  */
+       computation.  Moves are validated against the game rules when they
+       enter the mempool and again when the tip changes, so this "should"
+       not fail.  Address permissions were checked then as well (also for
+       inputs from unconfirmed parents, which pcoinsTip does not have),
+       so they are not checked again here.  */
     CValidationState state;
-    if (!gameStep->addTransaction(iter->GetTx(), pcoinsTip, state))
+    if (!gameStep->addTransaction(iter->GetTx(), NULL, state))
         throw std::runtime_error(strprintf("tx %s not accepted for game step",
                                            iter->GetTx().GetHash().GetHex().c_str()));
 
@@ -682,3 +740,43 @@ void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned
     pblock->vtx[0] = txCoinbase;
     pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
 }
+
+void ThreadSpeculativeGameStep()
+{
+    const CBlockIndex* pindexLast = NULL;
+    unsigned nMovesUpdatedLast = 0;
+    while (true)
+    {
+        MilliSleep(SPECULATIVE_GAMESTEP_POLL_MS);
+        if (IsInitialBlockDownload())
+            continue;
+
+        const CBlockIndex* pindexTip;
+        unsigned nMovesUpdated;
+        {
+            LOCK2(cs_main, mempool.cs);
+            pindexTip = chainActive.Tip();
+            nMovesUpdated = mempool.getMovesUpdated();
+        }
+        if (pindexTip == pindexLast && nMovesUpdated == nMovesUpdatedLast)
+            continue;
+
+        /* The tip or the moves in the mempool changed.  Prepare the step
+           that a block template would contain now.  The timer records how
+           long the prepared step lags behind the change.  If the step was
+           aborted because a regular one (e.g. for connecting a block)
+           needed the engine, try again later.  */
+        const int64_t nStart = GetTimeMicros();
+        try {
+            if (!BlockAssembler(Params()).PrepareNextGameStep())
+                continue;
+        } catch (const std::exception& exc) {
+            LogPrintf("%s: %s\n", __func__, exc.what());
+        }
+        GamePerfAddTime(GAMEPERF_SPECULATIVE, GetTimeMicros() - nStart);
+        GamePerfAddCount(GAMEPERF_SPECULATIVE_STEPS, 1);
+
+        pindexLast = pindexTip;
+        nMovesUpdatedLast = nMovesUpdated;
+    }
+}
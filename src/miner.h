@@ -24,6 +24,10 @@ class CScript;
 class CWallet;
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+/** Default for -speculativegamestep.  */
+static const bool DEFAULT_SPECULATIVE_GAMESTEP = false;
+/** Interval in which the speculative game step checks for changes.  */
+static const int64_t SPECULATIVE_GAMESTEP_POLL_MS = 100;
 
 struct CBlockTemplate
 {
@@ -162,19 +166,33 @@ private:
     int lastFewTxs;
     bool blockFinished;
 
-    // Game state context.
-    std::unique_ptr<GameState> prevGameState;
+    // Game state context.  The previous state is not modified once it has
+    // been read, so that the game step can be computed without holding
+    // cs_main or mempool.cs.
+    std::shared_ptr<const GameState> prevGameState;
     std::unique_ptr<StepData> gameStep;
 
 public:
     BlockAssembler(const CChainParams& chainparams);
     /** Construct a new block template with coinbase to scriptPubKeyIn */
     CBlockTemplate* CreateNewBlock(PowAlgo algo, const CScript& scriptPubKeyIn);
+    /** Select transactions as CreateNewBlock would and prepare their game
+      * step, so that a following CreateNewBlock with the same moves can
+      * reuse it.  Used by the speculative game step thread.  Returns false
+      * if the step was aborted to make way for a regular one.  */
+    bool PrepareNextGameStep();
 
 private:
     // utility functions
     /** Clear the block's state and prepare for assembling a new block */
     void resetBlock();
+    /** Reset the block and select transactions for it on the current tip.
+      * This also reads the previous game state and fills in gameStep.
+      * Returns the tip the block builds on.  */
+    CBlockIndex* SelectTransactions(PowAlgo algo);
+    /** Try to assemble a block on the current tip.  Returns NULL if the tip
+      * changed while the game step was computed without holding cs_main.  */
+    CBlockTemplate* TryCreateNewBlock(PowAlgo algo, const CScript& scriptPubKeyIn);
     /** Add a tx to the block */
     void AddToBlock(CTxMemPool::txiter iter);
 
@@ -221,5 +239,9 @@ private:
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
 bool ProcessBlockFound(const CBlock* pblock, const CChainParams& chainParams);
+/** Background thread for -speculativegamestep.  Whenever the tip or the
+  * moves in the mempool change, the hash-independent phase of the next
+  * block's game step is prepared so that CreateNewBlock can reuse it.  */
+void ThreadSpeculativeGameStep();
 
 #endif // BITCOIN_MINER_H
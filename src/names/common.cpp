@@ -4,9 +4,16 @@
 
 #include "names/common.h"
 
+#include "hash.h"
+#include "random.h"
 #include "script/names.h"
 
+#include <algorithm>
+#include <limits>
+#include <memory>
+
 bool fNameHistory = false;
+bool fNameAddressIndex = false;
 
 /* ************************************************************************** */
 /* CNameData.  */
@@ -52,8 +59,19 @@ private:
   /** "Next" data of the base iterator.  */
   CNameData baseData;
 
-  /** Iterator of the cache's entries.  */
-  CNameCache::EntryMap::const_iterator cacheIter;
+  /** Type of the ordered view of the cache's entries.  */
+  typedef std::vector<const CNameCache::EntryMap::value_type*> SortedEntries;
+
+  /** The cache's entries, sorted like the database.  */
+  SortedEntries sorted;
+  /** Iterator of the sorted entries.  */
+  SortedEntries::const_iterator cacheIter;
+
+  /* Compare sorted entries (also to names for seeking).  */
+  static bool compareEntries (const CNameCache::EntryMap::value_type* a,
+                              const CNameCache::EntryMap::value_type* b);
+  static bool compareToName (const CNameCache::EntryMap::value_type* a,
+                             const valtype& b);
 
   /* Call the base iterator's next() routine to fill in the internal
      "cache" for the next entry.  This already skips entries that are
@@ -81,6 +99,13 @@ public:
 CCacheNameIterator::CCacheNameIterator (const CNameCache& c, CNameIterator* b)
   : cache(c), base(b)
 {
+  /* The cache entries are only sorted here, when they are iterated.  */
+  sorted.reserve (cache.entries.size ());
+  for (CNameCache::EntryMap::const_iterator i = cache.entries.begin ();
+       i != cache.entries.end (); ++i)
+    sorted.push_back (&*i);
+  std::sort (sorted.begin (), sorted.end (), &compareEntries);
+
   /* Add a seek-to-start to ensure that everything is consistent.  This call
      may be superfluous if we seek to another position afterwards anyway,
      but it should also not hurt too much.  */
@@ -92,6 +117,22 @@ CCacheNameIterator::~CCacheNameIterator ()
   delete base;
 }
 
+bool
+CCacheNameIterator::compareEntries (const CNameCache::EntryMap::value_type* a,
+                                    const CNameCache::EntryMap::value_type* b)
+{
+  CNameCache::NameComparator cmp;
+  return cmp (a->first, b->first);
+}
+
+bool
+CCacheNameIterator::compareToName (const CNameCache::EntryMap::value_type* a,
+                                   const valtype& b)
+{
+  CNameCache::NameComparator cmp;
+  return cmp (a->first, b);
+}
+
 void
 CCacheNameIterator::advanceBaseIterator ()
 {
@@ -104,7 +145,8 @@ CCacheNameIterator::advanceBaseIterator ()
 void
 CCacheNameIterator::seek (const valtype& start)
 {
-  cacheIter = cache.entries.lower_bound (start);
+  cacheIter = std::lower_bound (sorted.begin (), sorted.end (), start,
+                                &compareToName);
   base->seek (start);
 
   baseHasMore = true;
@@ -116,21 +158,21 @@ CCacheNameIterator::next (valtype& name, CNameData& data)
 {
   /* Exit early if no more data is available in either the cache
      nor the base iterator.  */
-  if (!baseHasMore && cacheIter == cache.entries.end ())
+  if (!baseHasMore && cacheIter == sorted.end ())
     return false;
 
   /* Determine which source to use for the next.  */
   bool useBase;
   if (!baseHasMore)
     useBase = false;
-  else if (cacheIter == cache.entries.end ())
+  else if (cacheIter == sorted.end ())
     useBase = true;
   else
     {
       /* A special case is when both iterators are equal.  In this case,
          we want to use the cached version.  We also have to advance
          the base iterator.  */
-      if (baseName == cacheIter->first)
+      if (baseName == (*cacheIter)->first)
         advanceBaseIterator ();
 
       /* Due to advancing the base iterator above, it may happen that
@@ -139,10 +181,10 @@ CCacheNameIterator::next (valtype& name, CNameData& data)
         useBase = false;
       else
         {
-          assert (baseName != cacheIter->first);
+          assert (baseName != (*cacheIter)->first);
 
           CNameCache::NameComparator cmp;
-          useBase = cmp (baseName, cacheIter->first);
+          useBase = cmp (baseName, (*cacheIter)->first);
         }
     }
 
@@ -155,14 +197,128 @@ CCacheNameIterator::next (valtype& name, CNameData& data)
     }
   else
     {
-      name = cacheIter->first;
-      data = cacheIter->second;
+      name = (*cacheIter)->first;
+      data = (*cacheIter)->second;
       ++cacheIter;
     }
 
   return true;
 }
 
+/* ************************************************************************** */
+/* CAddressNameIterator.  */
+
+/**
+ * Name iterator that skips all names not owned by a given address.  This
+ * is put on top of a cache iterator, whose cached entries may have any
+ * address.
+ */
+class CAddressNameIterator : public CNameIterator
+{
+
+private:
+
+  /** The address to filter for.  */
+  const CScript addr;
+
+  /** The base iterator.  */
+  std::unique_ptr<CNameIterator> base;
+
+public:
+
+  /**
+   * Construct the iterator.  This takes ownership of the base iterator.
+   * @param a The address to filter for.
+   * @param b The base iterator.
+   */
+  CAddressNameIterator (const CScript& a, CNameIterator* b)
+    : addr(a), base(b)
+  {}
+
+  void
+  seek (const valtype& name)
+  {
+    base->seek (name);
+  }
+
+  bool
+  next (valtype& name, CNameData& data)
+  {
+    while (base->next (name, data))
+      if (data.getAddress () == addr)
+        return true;
+
+    return false;
+  }
+
+};
+
+/* ************************************************************************** */
+/* CNameSnapshot.  */
+
+CNameSnapshot::~CNameSnapshot ()
+{
+  /* Nothing to be done here.  This may be overwritten by
+     subclasses if they need a destructor.  */
+}
+
+/**
+ * Snapshot combining a base snapshot with a copy of the name entries of
+ * a cache.  The history changes are not copied, since name iteration
+ * does not need them.
+ */
+class CCacheNameSnapshot : public CNameSnapshot
+{
+
+private:
+
+  /** Frozen copy of the cached name changes.  */
+  CNameCache cache;
+
+  /** Snapshot of the base view.  */
+  std::unique_ptr<CNameSnapshot> base;
+
+public:
+
+  /**
+   * Construct the snapshot.  This takes ownership of the base snapshot.
+   * @param c The cache object to copy.
+   * @param b The base snapshot.
+   */
+  CCacheNameSnapshot (const CNameCache& c, CNameSnapshot* b);
+
+  CNameIterator* iterateNames () const;
+
+};
+
+CCacheNameSnapshot::CCacheNameSnapshot (const CNameCache& c,
+                                        CNameSnapshot* b)
+  : base(b)
+{
+  cache.entries = c.entries;
+  cache.deleted = c.deleted;
+}
+
+CNameIterator*
+CCacheNameSnapshot::iterateNames () const
+{
+  return cache.iterateNames (base->iterateNames ());
+}
+
+/* ************************************************************************** */
+/* SaltedNameHasher.  */
+
+SaltedNameHasher::SaltedNameHasher ()
+  : k0(GetRand (std::numeric_limits<uint64_t>::max ())),
+    k1(GetRand (std::numeric_limits<uint64_t>::max ()))
+{}
+
+size_t
+SaltedNameHasher::operator() (const valtype& name) const
+{
+  return CSipHasher (k0, k1).Write (name.data (), name.size ()).Finalize ();
+}
+
 /* ************************************************************************** */
 /* CNameCache.  */
 
@@ -180,15 +336,27 @@ CNameCache::get (const valtype& name, CNameData& data) const
 void
 CNameCache::set (const valtype& name, const CNameData& data)
 {
-  const std::set<valtype>::iterator di = deleted.find (name);
+  const DeletedSet::iterator di = deleted.find (name);
   if (di != deleted.end ())
-    deleted.erase (di);
+    {
+      nInnerUsage -= memusage::DynamicUsage (*di);
+      deleted.erase (di);
+    }
 
-  const EntryMap::iterator ei = entries.find (name);
+  /* Count the usage of the stored elements, not of the arguments.  The
+     capacities may differ, e. g. an assigned value keeps the old one.  */
+  EntryMap::iterator ei = entries.find (name);
   if (ei != entries.end ())
-    ei->second = data;
+    {
+      nInnerUsage -= ei->second.DynamicMemoryUsage ();
+      ei->second = data;
+    }
   else
-    entries.insert (std::make_pair (name, data));
+    {
+      ei = entries.insert (std::make_pair (name, data)).first;
+      nInnerUsage += memusage::DynamicUsage (ei->first);
+    }
+  nInnerUsage += ei->second.DynamicMemoryUsage ();
 }
 
 void
@@ -196,9 +364,15 @@ CNameCache::remove (const valtype& name)
 {
   const EntryMap::iterator ei = entries.find (name);
   if (ei != entries.end ())
-    entries.erase (ei);
+    {
+      nInnerUsage -= memusage::DynamicUsage (ei->first)
+                      + ei->second.DynamicMemoryUsage ();
+      entries.erase (ei);
+    }
 
-  deleted.insert (name);
+  const std::pair<DeletedSet::iterator, bool> ins = deleted.insert (name);
+  if (ins.second)
+    nInnerUsage += memusage::DynamicUsage (*ins.first);
 }
 
 CNameIterator*
@@ -207,43 +381,121 @@ CNameCache::iterateNames (CNameIterator* base) const
   return new CCacheNameIterator (*this, base);
 }
 
-bool
-CNameCache::getHistory (const valtype& name, CNameHistory& res) const
+CNameIterator*
+CNameCache::iterateNamesForAddress (const CScript& addr,
+                                    CNameIterator* base) const
+{
+  return new CAddressNameIterator (addr, iterateNames (base));
+}
+
+CNameSnapshot*
+CNameCache::snapshotNames (CNameSnapshot* base) const
+{
+  return new CCacheNameSnapshot (*this, base);
+}
+
+const CNameCache::HistoryChanges*
+CNameCache::getHistory (const valtype& name) const
 {
   assert (fNameHistory);
 
-  const std::map<valtype, CNameHistory>::const_iterator i = history.find (name);
+  const HistoryMap::const_iterator i = history.find (name);
   if (i == history.end ())
-    return false;
+    return NULL;
 
-  res = i->second;
-  return true;
+  return &i->second;
+}
+
+size_t
+CNameCache::historyUsage (const HistoryChanges& changes)
+{
+  size_t res = memusage::DynamicUsage (changes.entries);
+  for (std::map<unsigned, CNameData>::const_iterator i
+        = changes.entries.begin (); i != changes.entries.end (); ++i)
+    res += i->second.DynamicMemoryUsage ();
+
+  return res;
+}
+
+CNameCache::HistoryChanges&
+CNameCache::getHistoryChanges (const valtype& name, unsigned nSize)
+{
+  HistoryMap::iterator i = history.find (name);
+  if (i == history.end ())
+    {
+      HistoryChanges changes;
+      changes.nBaseSize = nSize;
+      changes.nLowWater = nSize;
+      changes.nSize = nSize;
+      i = history.insert (std::make_pair (name, changes)).first;
+      nInnerUsage += memusage::DynamicUsage (i->first);
+    }
+
+  assert (i->second.nSize == nSize);
+  return i->second;
 }
 
 void
-CNameCache::setHistory (const valtype& name, const CNameHistory& data)
+CNameCache::pushHistory (const valtype& name, unsigned nSize,
+                         const CNameData& data)
 {
   assert (fNameHistory);
 
-  const std::map<valtype, CNameHistory>::iterator ei = history.find (name);
-  if (ei != history.end ())
-    ei->second = data;
-  else
-    history.insert (std::make_pair (name, data));
+  HistoryChanges& changes = getHistoryChanges (name, nSize);
+  assert (changes.entries.count (changes.nSize) == 0);
+  const CNameData& stored = changes.entries[changes.nSize] = data;
+  ++changes.nSize;
+  nInnerUsage += stored.DynamicMemoryUsage ()
+                  + memusage::IncrementalDynamicUsage (changes.entries);
+}
+
+void
+CNameCache::popHistory (const valtype& name, unsigned nSize)
+{
+  assert (fNameHistory && nSize > 0);
+
+  HistoryChanges& changes = getHistoryChanges (name, nSize);
+  --changes.nSize;
+  const std::map<unsigned, CNameData>::iterator i
+    = changes.entries.find (changes.nSize);
+  if (i != changes.entries.end ())
+    {
+      nInnerUsage -= i->second.DynamicMemoryUsage ()
+                      + memusage::IncrementalDynamicUsage (changes.entries);
+      changes.entries.erase (i);
+    }
+  changes.nLowWater = std::min (changes.nLowWater, changes.nSize);
 }
 
 void
 CNameCache::apply (const CNameCache& cache)
 {
+  entries.reserve (entries.size () + cache.entries.size ());
   for (EntryMap::const_iterator i = cache.entries.begin ();
        i != cache.entries.end (); ++i)
     set (i->first, i->second);
 
-  for (std::set<valtype>::const_iterator i = cache.deleted.begin ();
+  deleted.reserve (deleted.size () + cache.deleted.size ());
+  for (DeletedSet::const_iterator i = cache.deleted.begin ();
        i != cache.deleted.end (); ++i)
     remove (*i);
 
-  for (std::map<valtype, CNameHistory>::const_iterator i
-        = cache.history.begin (); i != cache.history.end (); ++i)
-    setHistory (i->first, i->second);
+  history.reserve (history.size () + cache.history.size ());
+  for (HistoryMap::const_iterator i = cache.history.begin ();
+       i != cache.history.end (); ++i)
+    {
+      const HistoryChanges& child = i->second;
+      HistoryChanges& changes = getHistoryChanges (i->first, child.nBaseSize);
+      nInnerUsage -= historyUsage (changes);
+
+      /* Our entries below the child's low water mark are still valid,
+         everything above is replaced by the child's entries.  */
+      changes.entries.erase (changes.entries.lower_bound (child.nLowWater),
+                             changes.entries.end ());
+      changes.entries.insert (child.entries.begin (), child.entries.end ());
+      changes.nLowWater = std::min (changes.nLowWater, child.nLowWater);
+      changes.nSize = child.nSize;
+
+      nInnerUsage += historyUsage (changes);
+    }
 }
@@ -6,6 +6,7 @@
 #define H_BITCOIN_NAMES_COMMON
 
 #include "compat/endian.h"
+#include "core_memusage.h"
 #include "primitives/transaction.h"
 #include "script/script.h"
 #include "serialize.h"
@@ -14,12 +15,22 @@
 #include <map>
 #include <set>
 
+#include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
+
+class CCoinsView;
 class CNameScript;
 class CDBBatch;
 
 /** Whether or not name history is enabled.  */
 extern bool fNameHistory;
 
+/** Default for -nameaddressindex.  */
+static const bool DEFAULT_NAMEADDRESSINDEX = false;
+
+/** Whether or not the index from addresses to names is enabled.  */
+extern bool fNameAddressIndex;
+
 /**
  * Construct a valtype (e. g., name) from a string.
  * @param str The string input.
@@ -83,6 +94,13 @@ public:
     READWRITE (*(CScriptBase*)(&addr));
   }
 
+  /* Dynamic memory used by this object.  */
+  inline size_t
+  DynamicMemoryUsage () const
+  {
+    return memusage::DynamicUsage (value) + RecursiveDynamicUsage (addr);
+  }
+
   /* Compare for equality.  */
   friend inline bool
   operator== (const CNameData& a, const CNameData& b)
@@ -277,22 +295,68 @@ public:
 
 };
 
+/* ************************************************************************** */
+/* CNameSnapshot.  */
+
+/**
+ * Frozen state of the name database.  It is taken while holding cs_main,
+ * but can then be iterated without it.  Later changes to the database
+ * are not visible in the snapshot.
+ */
+class CNameSnapshot
+{
+
+public:
+
+  // Virtual destructor in case subclasses need them.
+  virtual ~CNameSnapshot ();
+
+  /**
+   * Return a new iterator over the snapshot, which is owned by the caller
+   * and must not outlive the snapshot.  Different iterators can be used
+   * concurrently from different threads.
+   */
+  virtual CNameIterator* iterateNames () const = 0;
+
+};
+
 /* ************************************************************************** */
 /* CNameCache.  */
 
+/**
+ * Salted hasher for names, used for the hash tables in CNameCache.  The
+ * salt makes it hard to attack the tables with colliding names.
+ */
+class SaltedNameHasher
+{
+
+private:
+
+  /** Salt.  */
+  uint64_t k0, k1;
+
+public:
+
+  SaltedNameHasher ();
+
+  size_t operator() (const valtype& name) const;
+
+};
+
 /**
  * Cache / record of updates to the name database.  In addition to
  * new names (or updates to them), this also keeps track of deleted names
- * (when rolling back changes).
+ * (when rolling back changes).  The changes are kept in hash tables,
+ * an ordered view of them is only built when iterating.
  */
 class CNameCache
 {
 
-private:
+public:
 
   /**
    * Special comparator class for names that compares by length first.
-   * This is used to sort the cache entry map in the same way as the
+   * This is used to sort the cache entries in the same way as the
    * database is sorted.
    */
   class NameComparator
@@ -310,35 +374,86 @@ private:
 
 public:
 
-  /**
-   * Type of name entry map.  This is public because it is also used
-   * by the unit tests.
-   */
-  typedef std::map<valtype, CNameData, NameComparator> EntryMap;
+  /** Type of the name entry table.  */
+  typedef boost::unordered_map<valtype, CNameData, SaltedNameHasher> EntryMap;
+  /** Type of the set of deleted names.  */
+  typedef boost::unordered_set<valtype, SaltedNameHasher> DeletedSet;
 
 private:
 
   /** New or updated names.  */
   EntryMap entries;
   /** Deleted names.  */
-  std::set<valtype> deleted;
+  DeletedSet deleted;
+
+public:
 
   /**
-   * New or updated history stacks.  If they are empty, the corresponding
-   * database entry is deleted instead.
+   * Changes to the history stack of a single name.  The database stores
+   * each stack entry under its own key (name, index), so that updating
+   * the history only touches the entries that actually changed.  Entries
+   * below nLowWater are unchanged from the base view, those from
+   * nLowWater up to nSize are held in "entries".  Base entries from nSize
+   * up to nBaseSize have been popped and are erased when writing.
    */
-  std::map<valtype, CNameHistory> history;
+  struct HistoryChanges
+  {
+    /** Size of the stack in the base view.  */
+    unsigned nBaseSize;
+    /** Lowest index that was changed.  */
+    unsigned nLowWater;
+    /** Current size of the stack.  */
+    unsigned nSize;
+    /** Current entries with indices in [nLowWater, nSize).  */
+    std::map<unsigned, CNameData> entries;
+  };
+
+  /** Type of the table of history changes.  */
+  typedef boost::unordered_map<valtype, HistoryChanges, SaltedNameHasher>
+      HistoryMap;
+
+private:
+
+  /** Changed history stacks.  */
+  HistoryMap history;
+
+  /**
+   * Dynamic memory used by the names and data in the tables.  The memory
+   * of the tables themselves is computed when queried.
+   */
+  size_t nInnerUsage;
+
+  /* Dynamic memory used by the data of a history changes record.  */
+  static size_t historyUsage (const HistoryChanges& changes);
+
+  /* Get the changes record for a name, creating it for a base stack
+     of the given size if it does not yet exist.  */
+  HistoryChanges& getHistoryChanges (const valtype& name, unsigned nSize);
 
   friend class CCacheNameIterator;
+  friend class CCacheNameSnapshot;
 
 public:
 
+  CNameCache ()
+    : nInnerUsage(0)
+  {}
+
   inline void
   clear ()
   {
     entries.clear ();
     deleted.clear ();
     history.clear ();
+    nInnerUsage = 0;
+  }
+
+  /* Return the dynamic memory used by the cached changes.  */
+  size_t
+  DynamicMemoryUsage () const
+  {
+    return memusage::DynamicUsage (entries) + memusage::DynamicUsage (deleted)
+            + memusage::DynamicUsage (history) + nInnerUsage;
   }
 
   /**
@@ -382,20 +497,39 @@ public:
      ownership of.  */
   CNameIterator* iterateNames (CNameIterator* base) const;
 
+  /* Return an iterator over the names owned by the given address.  The
+     base iterator must yield only (and all) names of the address in the
+     underlying view.  It is taken ownership of.  */
+  CNameIterator* iterateNamesForAddress (const CScript& addr,
+                                         CNameIterator* base) const;
+
+  /* Return a snapshot that combines a "base" snapshot with a frozen copy
+     of the name changes in the cache.  The base snapshot is taken
+     ownership of.  */
+  CNameSnapshot* snapshotNames (CNameSnapshot* base) const;
+
   /**
-   * Query for an history entry.
+   * Query for the history changes of a name.
    * @param name The name to look up.
-   * @param res Put the resulting history entry here.
-   * @return True iff the name was found in the cache.
+   * @return The changes or NULL if the history was not changed.
    */
-  bool getHistory (const valtype& name, CNameHistory& res) const;
+  const HistoryChanges* getHistory (const valtype& name) const;
 
   /**
-   * Set a name history entry.
+   * Push an entry onto a name's history stack.
    * @param name The name to modify.
-   * @param data The new history entry.
+   * @param nSize Current size of the history stack.
+   * @param data The entry to push.
    */
-  void setHistory (const valtype& name, const CNameHistory& data);
+  void pushHistory (const valtype& name, unsigned nSize,
+                    const CNameData& data);
+
+  /**
+   * Pop the top entry off a name's history stack.
+   * @param name The name to modify.
+   * @param nSize Current size of the history stack.
+   */
+  void popHistory (const valtype& name, unsigned nSize);
 
   /* Apply all the changes in the passed-in record on top of this one.  */
   void apply (const CNameCache& cache);
@@ -403,6 +537,10 @@ public:
   /* Write all cached changes to a database batch update object.  */
   void writeBatch (CDBBatch& batch) const;
 
+  /* Write the changes to the address index implied by the cached changes.
+     The base view is used to look up the previous addresses of the names.  */
+  void writeAddressIndex (CDBBatch& batch, const CCoinsView& base) const;
+
 };
 
 #endif // H_BITCOIN_NAMES_COMMON
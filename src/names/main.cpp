@@ -9,6 +9,10 @@
 #include "consensus/validation.h"
 #include "hash.h"
 #include "dbwrapper.h"
+#include "memusage.h"
+#include "game/db.h"
+#include "game/state.h"
+#include "game/tx.h"
 #include "../main.h"
 #include "script/interpreter.h"
 #include "script/names.h"
@@ -17,6 +21,8 @@
 #include "util.h"
 #include "utilstrencodings.h"
 
+#include <boost/thread.hpp>
+
 /* ************************************************************************** */
 /* CNameTxUndo.  */
 
@@ -42,23 +48,11 @@ CNameTxUndo::apply (CCoinsViewCache& view) const
 uint256
 CNameMemPool::getTxForName (const valtype& name) const
 {
-  NameTxMap::const_iterator mi;
-
-  mi = mapNameRegs.find (name);
-  if (mi != mapNameRegs.end ())
-    {
-      assert (mapNameUpdates.count (name) == 0);
-      return mi->second;
-    }
-
-  mi = mapNameUpdates.find (name);
-  if (mi != mapNameUpdates.end ())
-    {
-      assert (mapNameRegs.count (name) == 0);
-      return mi->second;
-    }
+  const NameOpsByName::const_iterator mi = getNameOps ().find (name);
+  if (mi == getNameOps ().end ())
+    return uint256 ();
 
-  return uint256 ();
+  return mi->txid;
 }
 
 void
@@ -69,44 +63,109 @@ CNameMemPool::addUnchecked (const uint256& hash, const CTxMemPoolEntry& entry)
   if (entry.isNameNew ())
     {
       const valtype& newHash = entry.getNameNewHash ();
-      const NameTxMap::const_iterator mit = mapNameNews.find (newHash);
+      const NameNewSet::iterator mit = mapNameNews.find (newHash);
       if (mit != mapNameNews.end ())
-        assert (mit->second == hash);
+        {
+          /* The tx is back in the mempool, e. g., after a reorg.  */
+          assert (mit->txid == hash);
+          NameNewEntry newEntry = *mit;
+          newEntry.nExpiry = NAME_NEW_PENDING;
+          mapNameNews.replace (mit, newEntry);
+        }
       else
-        mapNameNews.insert (std::make_pair (newHash, hash));
+        {
+          NameNewEntry newEntry;
+          newEntry.hash = newHash;
+          newEntry.txid = hash;
+          newEntry.nExpiry = NAME_NEW_PENDING;
+          mapNameNews.insert (newEntry);
+          nNameNewsUsage += nameNewUsage (newEntry);
+          limitNameNews ();
+        }
+    }
+
+  if (entry.isNameRegistration () || entry.isNameUpdate ())
+    {
+      NameOpEntry op;
+      op.name = entry.getName ();
+      op.txid = hash;
+      op.fRegistration = entry.isNameRegistration ();
+
+      const bool inserted = nameOps.insert (op).second;
+      assert (inserted);
+      ++nMovesUpdated;
     }
+}
+
+void
+CNameMemPool::remove (const CTxMemPoolEntry& entry)
+{
+  AssertLockHeld (pool.cs);
 
-  if (entry.isNameRegistration ())
+  /* Keep the NAME_NEW hash until it has matured.  If the tx is removed
+     because it was mined, this is the block being connected.  */
+  if (entry.isNameNew ())
     {
-      const valtype& name = entry.getName ();
-      assert (mapNameRegs.count (name) == 0);
-      mapNameRegs.insert (std::make_pair (name, hash));
+      const NameNewSet::iterator mit
+        = mapNameNews.find (entry.getNameNewHash ());
+      assert (mit != mapNameNews.end ());
+      NameNewEntry newEntry = *mit;
+      newEntry.nExpiry = nBestHeight + 1 + MIN_FIRSTUPDATE_DEPTH;
+      mapNameNews.replace (mit, newEntry);
     }
 
-  if (entry.isNameUpdate ())
+  if (entry.isNameRegistration () || entry.isNameUpdate ())
     {
-      const valtype& name = entry.getName ();
-      assert (mapNameUpdates.count (name) == 0);
-      mapNameUpdates.insert (std::make_pair (name, hash));
+      typedef NameOpSet::index<NameOpByTxid>::type NameOpsByTxid;
+      NameOpsByTxid& byTxid = nameOps.get<NameOpByTxid> ();
+      const NameOpsByTxid::iterator mit = byTxid.find (entry.GetTx ().GetHash ());
+      assert (mit != byTxid.end () && mit->name == entry.getName ());
+      byTxid.erase (mit);
+      ++nMovesUpdated;
     }
 }
 
+size_t
+CNameMemPool::nameNewUsage (const NameNewEntry& entry)
+{
+  /* Like for mapTx, estimate the overhead of the multi-index container
+     with a couple of pointers.  */
+  return memusage::MallocUsage (sizeof (NameNewEntry) + 6 * sizeof (void*))
+          + memusage::DynamicUsage (entry.hash);
+}
+
 void
-CNameMemPool::remove (const CTxMemPoolEntry& entry)
+CNameMemPool::limitNameNews ()
 {
-  AssertLockHeld (pool.cs);
+  typedef NameNewSet::index<NameNewByExpiry>::type ByExpiry;
+  ByExpiry& byExpiry = mapNameNews.get<NameNewByExpiry> ();
 
-  if (entry.isNameRegistration ())
+  while (nNameNewsUsage > MAX_NAME_NEWS_USAGE)
     {
-      const NameTxMap::iterator mit = mapNameRegs.find (entry.getName ());
-      assert (mit != mapNameRegs.end ());
-      mapNameRegs.erase (mit);
+      const ByExpiry::iterator mit = byExpiry.begin ();
+      if (mit == byExpiry.end () || mit->nExpiry == NAME_NEW_PENDING)
+        break;
+
+      nNameNewsUsage -= nameNewUsage (*mit);
+      byExpiry.erase (mit);
+      ++nNameNewsEvicted;
     }
-  if (entry.isNameUpdate ())
+}
+
+void
+CNameMemPool::expireNameNews (unsigned nHeight)
+{
+  AssertLockHeld (pool.cs);
+  nBestHeight = nHeight;
+
+  typedef NameNewSet::index<NameNewByExpiry>::type ByExpiry;
+  ByExpiry& byExpiry = mapNameNews.get<NameNewByExpiry> ();
+
+  while (!byExpiry.empty () && byExpiry.begin ()->nExpiry < nHeight)
     {
-      const NameTxMap::iterator mit = mapNameUpdates.find (entry.getName ());
-      assert (mit != mapNameUpdates.end ());
-      mapNameUpdates.erase (mit);
+      nNameNewsUsage -= nameNewUsage (*byExpiry.begin ());
+      byExpiry.erase (byExpiry.begin ());
+      ++nNameNewsExpired;
     }
 }
 
@@ -125,10 +184,10 @@ CNameMemPool::removeConflicts (const CTransaction& tx,
       if (nameOp.isNameOp () && nameOp.getNameOp () == OP_NAME_FIRSTUPDATE)
         {
           const valtype& name = nameOp.getOpName ();
-          const NameTxMap::const_iterator mit = mapNameRegs.find (name);
-          if (mit != mapNameRegs.end ())
+          const NameOpsByName::const_iterator mit = getNameOps ().find (name);
+          if (mit != getNameOps ().end () && mit->fRegistration)
             {
-              const CTxMemPool::txiter mit2 = pool.mapTx.find (mit->second);
+              const CTxMemPool::txiter mit2 = pool.mapTx.find (mit->txid);
               assert (mit2 != pool.mapTx.end ());
               pool.removeRecursive (mit2->GetTx (), removed);
             }
@@ -144,13 +203,15 @@ CNameMemPool::removeReviveConflicts (const std::set<valtype>& revived,
 
   BOOST_FOREACH (const valtype& name, revived)
     {
+      const NameOpsByName::const_iterator mit = getNameOps ().find (name);
+      const bool registered
+        = (mit != getNameOps ().end () && mit->fRegistration);
       LogPrint ("names", "revived: %s, mempool: %u\n",
-                ValtypeToString (name).c_str (), mapNameRegs.count (name));
+                ValtypeToString (name).c_str (), registered ? 1 : 0);
 
-      const NameTxMap::const_iterator mit = mapNameRegs.find (name);
-      if (mit != mapNameRegs.end ())
+      if (registered)
         {
-          const CTxMemPool::txiter mit2 = pool.mapTx.find (mit->second);
+          const CTxMemPool::txiter mit2 = pool.mapTx.find (mit->txid);
           assert (mit2 != pool.mapTx.end ());
           pool.removeRecursive (mit2->GetTx (), removed);
         }
@@ -162,68 +223,49 @@ CNameMemPool::check (const CCoinsView& coins) const
 {
   AssertLockHeld (pool.cs);
 
-  std::set<valtype> nameRegs;
-  std::set<valtype> nameUpdates;
+  typedef NameOpSet::index<NameOpByTxid>::type NameOpsByTxid;
+  const NameOpsByTxid& byTxid = nameOps.get<NameOpByTxid> ();
+
+  unsigned nNameOps = 0;
   BOOST_FOREACH (const CTxMemPoolEntry& entry, pool.mapTx)
     {
       const uint256 txHash = entry.GetTx ().GetHash ();
       if (entry.isNameNew ())
         {
           const valtype& newHash = entry.getNameNewHash ();
-          const NameTxMap::const_iterator mit = mapNameNews.find (newHash);
+          const NameNewSet::const_iterator mit = mapNameNews.find (newHash);
 
           assert (mit != mapNameNews.end ());
-          assert (mit->second == txHash);
+          assert (mit->txid == txHash);
+          assert (mit->nExpiry == NAME_NEW_PENDING);
         }
 
-      if (entry.isNameRegistration ())
+      if (entry.isNameRegistration () || entry.isNameUpdate ())
         {
           const valtype& name = entry.getName ();
 
-          const NameTxMap::const_iterator mit = mapNameRegs.find (name);
-          assert (mit != mapNameRegs.end ());
-          assert (mit->second == txHash);
-
-          assert (nameRegs.count (name) == 0);
-          nameRegs.insert (name);
+          const NameOpsByTxid::const_iterator mit = byTxid.find (txHash);
+          assert (mit != byTxid.end ());
+          assert (mit->name == name);
+          assert (mit->fRegistration == entry.isNameRegistration ());
+          ++nNameOps;
 
+          /* A name can only be registered if it does not exist at the
+             moment, and only be updated if it does.  */
           CNameData data;
-          if (coins.GetName (name, data))
-            assert (data.isDead ());
-        }
-
-      if (entry.isNameUpdate ())
-        {
-          const valtype& name = entry.getName ();
-
-          const NameTxMap::const_iterator mit = mapNameUpdates.find (name);
-          assert (mit != mapNameUpdates.end ());
-          assert (mit->second == txHash);
-
-          assert (nameUpdates.count (name) == 0);
-          nameUpdates.insert (name);
-
-          CNameData data;
-          if (!coins.GetName (name, data))
-            assert (false);
-          assert (!data.isDead ());
+          const bool alive = coins.GetName (name, data) && !data.isDead ();
+          assert (alive == entry.isNameUpdate ());
         }
     }
 
-  assert (nameRegs.size () == mapNameRegs.size ());
-  assert (nameUpdates.size () == mapNameUpdates.size ());
-
-  /* Check that nameRegs and nameUpdates are disjoint.  They must be since
-     a name can only be in either category, depending on whether it exists
-     at the moment or not.  */
-  BOOST_FOREACH (const valtype& name, nameRegs)
-    assert (nameUpdates.count (name) == 0);
-  BOOST_FOREACH (const valtype& name, nameUpdates)
-    assert (nameRegs.count (name) == 0);
+  /* The name index is unique, so this also ensures that there is at most
+     one pending operation for each name.  */
+  assert (nNameOps == nameOps.size ());
 }
 
 bool
-CNameMemPool::checkTx (const CTransaction& tx) const
+CNameMemPool::checkTx (const CTransaction& tx,
+                       const std::set<uint256>& setConflicts) const
 {
   AssertLockHeld (pool.cs);
 
@@ -233,7 +275,8 @@ CNameMemPool::checkTx (const CTransaction& tx) const
   /* In principle, multiple name_updates could be performed within the
      mempool at once (building upon each other).  This is disallowed, though,
      since the current mempool implementation does not like it.  (We keep
-     track of only a single update tx for each name.)  */
+     track of only a single update tx for each name.)  The pending operation
+     can be replaced, though, by a tx double-spending it.  */
 
   BOOST_FOREACH (const CTxOut& txout, tx.vout)
     {
@@ -246,25 +289,19 @@ CNameMemPool::checkTx (const CTransaction& tx) const
         case OP_NAME_NEW:
           {
             const valtype& newHash = nameOp.getOpHash ();
-            std::map<valtype, uint256>::const_iterator mi;
-            mi = mapNameNews.find (newHash);
-            if (mi != mapNameNews.end () && mi->second != tx.GetHash ())
+            const NameNewSet::const_iterator mi = mapNameNews.find (newHash);
+            if (mi != mapNameNews.end () && mi->txid != tx.GetHash ())
               return false;
             break;
           }
 
         case OP_NAME_FIRSTUPDATE:
-          {
-            const valtype& name = nameOp.getOpName ();
-            if (registersName (name))
-              return false;
-            break;
-          }
-
         case OP_NAME_UPDATE:
           {
             const valtype& name = nameOp.getOpName ();
-            if (updatesName (name))
+            const NameOpsByName::const_iterator mi = getNameOps ().find (name);
+            if (mi != getNameOps ().end ()
+                  && setConflicts.count (mi->txid) == 0)
               return false;
             break;
           }
@@ -551,27 +588,171 @@ ApplyNameTransaction (const CTransaction& tx, unsigned nHeight,
     }
 }
 
+/* Request flag for the background check, protected by cs_checkNameDB.  */
+static CCriticalSection cs_checkNameDB;
+static bool fFullCheckRequested = false;
+
+/**
+ * Collect the names touched by a block together with the name outputs
+ * that it creates.  Name operations are in the outputs of the ordinary
+ * transactions, while the game transactions killing players spend
+ * name outputs without creating new ones.
+ */
+static void
+CollectBlockNames (const CBlock& block, const std::vector<CTransaction>& vGameTx,
+                   std::map<valtype, std::vector<COutPoint> >& names)
+{
+  BOOST_FOREACH (const CTransaction& tx, block.vtx)
+    for (unsigned i = 0; i < tx.vout.size (); ++i)
+      {
+        const CNameScript op(tx.vout[i].scriptPubKey);
+        if (op.isNameOp () && op.isAnyUpdate ())
+          names[op.getOpName ()].push_back (COutPoint (tx.GetHash (), i));
+      }
+
+  BOOST_FOREACH (const CTransaction& tx, vGameTx)
+    BOOST_FOREACH (const CTxIn& txin, tx.vin)
+      {
+        valtype name;
+        if (NameFromGameTransactionInput (txin.scriptSig, name))
+          names[name];
+      }
+}
+
+/**
+ * Verify a single name touched by a block against the UTXO set and the
+ * game state.  A living name must be a player with matching locked coins,
+ * and its update outpoint must be an unspent output holding the name.
+ * Of the name outputs created by the block, only this one may be unspent.
+ */
+static bool
+CheckBlockName (const valtype& name, const std::vector<COutPoint>& outputs,
+                const GameState& state, CCoinsViewCache& view)
+{
+  const std::string nameStr = ValtypeToString (name);
+  const PlayerStateMap::const_iterator mi = state.players.find (nameStr);
+
+  CNameData data;
+  const bool alive = view.GetName (name, data) && !data.isDead ();
+  if (!alive)
+    {
+      if (mi != state.players.end ())
+        return error ("%s: player %s is not alive in the name database",
+                      __func__, nameStr.c_str ());
+    }
+  else
+    {
+      if (mi == state.players.end ())
+        return error ("%s: name %s is not in the game state",
+                      __func__, nameStr.c_str ());
+
+      const COutPoint& prevout = data.getUpdateOutpoint ();
+      const CCoins* coins = view.AccessCoins (prevout.hash);
+      if (!coins || !coins->IsAvailable (prevout.n))
+        return error ("%s: update outpoint of name %s is not in the UTXO set",
+                      __func__, nameStr.c_str ());
+
+      const CTxOut& txout = coins->vout[prevout.n];
+      const CNameScript op(txout.scriptPubKey);
+      if (!op.isNameOp () || !op.isAnyUpdate () || op.getOpName () != name)
+        return error ("%s: update outpoint of name %s does not hold the name",
+                      __func__, nameStr.c_str ());
+      if (txout.nValue != mi->second.lockedCoins)
+        return error ("%s: locked coins of name %s do not match the game",
+                      __func__, nameStr.c_str ());
+    }
+
+  BOOST_FOREACH (const COutPoint& out, outputs)
+    {
+      if (alive && out == data.getUpdateOutpoint ())
+        continue;
+      const CCoins* coins = view.AccessCoins (out.hash);
+      if (coins && coins->IsAvailable (out.n))
+        return error ("%s: stale output of name %s is unspent",
+                      __func__, nameStr.c_str ());
+    }
+
+  return true;
+}
+
 void
-CheckNameDB (bool disconnect)
+CheckNameDB (const CBlock& block, const std::vector<CTransaction>& vGameTx,
+             bool disconnect)
 {
+  AssertLockHeld (cs_main);
   const int option = GetArg ("-checknamedb", Params ().DefaultCheckNameDB ());
 
   if (option == -1)
     return;
-
   assert (option >= 0);
-  if (option != 0)
+
+  std::map<valtype, std::vector<COutPoint> > names;
+  CollectBlockNames (block, vGameTx, names);
+
+  bool ok = true;
+  if (!names.empty ())
     {
-      if (disconnect || chainActive.Height () % option != 0)
-        return;
-    }
+      const GameStatePtr state = pgameDb->getTip ();
+      if (!state)
+        {
+          LogPrintf ("ERROR: %s : failed to read game state\n", __func__);
+          assert (false);
+        }
 
-  pcoinsTip->Flush ();
-  const bool ok = pcoinsTip->ValidateNameDB (*pgameDb);
+      typedef std::map<valtype, std::vector<COutPoint> > NameOutputsMap;
+      for (NameOutputsMap::const_iterator i = names.begin ();
+           ok && i != names.end (); ++i)
+        ok = CheckBlockName (i->first, i->second, *state, *pcoinsTip);
+    }
 
   if (!ok)
     {
-      LogPrintf ("ERROR: %s : name database is inconsistent\n", __func__);
+      LogPrintf ("ERROR: %s : name database is inconsistent after %s"
+                 " block %s\n", __func__,
+                 disconnect ? "disconnecting" : "connecting",
+                 block.GetHash ().GetHex ());
       assert (false);
     }
+
+  if (option == 0 || (!disconnect && chainActive.Height () % option == 0))
+    {
+      LOCK (cs_checkNameDB);
+      fFullCheckRequested = true;
+    }
+}
+
+void
+ThreadCheckNameDB ()
+{
+  /* Best block on disk at the last full check.  */
+  uint256 hashChecked;
+
+  while (true)
+    {
+      MilliSleep (CHECKNAMEDB_POLL_MS);
+      boost::this_thread::interruption_point ();
+
+      {
+        LOCK (cs_checkNameDB);
+        if (!fFullCheckRequested)
+          continue;
+        fFullCheckRequested = false;
+      }
+
+      /* This checks the state last flushed to disk.  If that has not
+         changed since the last check, it is skipped and the request
+         kept until the next flush.  */
+      const uint256 hashBefore = hashChecked;
+      if (!pcoinsTip->ValidateNameDB (*pgameDb, hashChecked))
+        {
+          LogPrintf ("ERROR: %s : name database is inconsistent\n", __func__);
+          assert (false);
+        }
+
+      if (hashChecked == hashBefore)
+        {
+          LOCK (cs_checkNameDB);
+          fFullCheckRequested = true;
+        }
+    }
 }
@@ -6,6 +6,7 @@
 #define H_BITCOIN_NAMES_MAIN
 
 #include "amount.h"
+#include "coins.h"
 #include "names/common.h"
 #include "primitives/transaction.h"
 #include "serialize.h"
@@ -15,10 +16,15 @@
 #include <map>
 #include <set>
 #include <string>
+#include <vector>
 
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/hashed_index.hpp>
+#include <boost/multi_index/member.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+
+class CBlock;
 class CBlockUndo;
-class CCoinsView;
-class CCoinsViewCache;
 class CTxMemPool;
 class CTxMemPoolEntry;
 class CValidationState;
@@ -31,6 +37,16 @@ static const unsigned MIN_FIRSTUPDATE_DEPTH = 2;
 /** Amount to lock (at least for minimum) in name_new.  */
 static const CAmount NAMENEW_COIN_AMOUNT = COIN / 5;
 
+/**
+ * Memory limit for the NAME_NEW hashes remembered by the mempool.  Only
+ * hashes whose tx is no longer in the mempool are evicted when it is
+ * reached, those closest to expiry first.
+ */
+static const size_t MAX_NAME_NEWS_USAGE = 16 * 1000 * 1000;
+
+/** Poll interval of the background name database check.  */
+static const unsigned CHECKNAMEDB_POLL_MS = 1000;
+
 /* ************************************************************************** */
 /* CNameTxUndo.  */
 
@@ -101,24 +117,121 @@ private:
   /** The parent mempool object.  Used to, e. g., remove conflicting tx.  */
   CTxMemPool& pool;
 
-  /** Type used for internal indices.  */
-  typedef std::map<valtype, uint256> NameTxMap;
+public:
 
   /**
-   * Keep track of names that are registered by transactions in the pool.
-   * Map name to registering transaction.
+   * A pending registration or update of a name.  Since a name is either
+   * registered or exists (and can be updated), there is at most one
+   * pending operation for each name.
    */
-  NameTxMap mapNameRegs;
+  struct NameOpEntry
+  {
+    valtype name;
+    uint256 txid;
+    /** True for name_firstupdate, false for name_update.  */
+    bool fRegistration;
+  };
+
+  /** Tags for the indices of the pending name operations.  */
+  struct NameOpByName {};
+  struct NameOpByTxid {};
+
+  /** Pending name operations, indexed by name and by txid.  */
+  typedef boost::multi_index_container<
+    NameOpEntry,
+    boost::multi_index::indexed_by<
+      boost::multi_index::ordered_unique<
+        boost::multi_index::tag<NameOpByName>,
+        boost::multi_index::member<NameOpEntry, valtype,
+                                   &NameOpEntry::name> >,
+      boost::multi_index::hashed_unique<
+        boost::multi_index::tag<NameOpByTxid>,
+        boost::multi_index::member<NameOpEntry, uint256,
+                                   &NameOpEntry::txid>,
+        SaltedTxidHasher>
+    >
+  > NameOpSet;
+
+  /** The index of pending name operations by name.  */
+  typedef NameOpSet::index<NameOpByName>::type NameOpsByName;
 
-  /** Map pending name updates to transaction IDs.  */
-  NameTxMap mapNameUpdates;
+private:
+
+  /** The pending registrations and updates of names in the pool.  */
+  NameOpSet nameOps;
 
   /**
-   * Map NAME_NEW hashes to the corresponding transaction IDs.  This is
-   * data that is kept only in memory but never cleared (until a restart).
-   * It is used to prevent "name_new stealing", at least in a "soft" way.
+   * A NAME_NEW hash seen in the mempool together with its transaction ID.
+   * While the tx is in the mempool, nExpiry is NAME_NEW_PENDING.  Once it
+   * leaves (usually because it was mined), the entry is kept until the
+   * NAME_NEW has matured and expires when the chain grows past nExpiry.
    */
-  NameTxMap mapNameNews;
+  struct NameNewEntry
+  {
+    valtype hash;
+    uint256 txid;
+    unsigned nExpiry;
+  };
+
+  /** Expiry value of entries whose tx is still in the mempool.  */
+  static const unsigned NAME_NEW_PENDING = static_cast<unsigned> (-1);
+
+  /** Tag for the index of NAME_NEW entries by expiry height.  */
+  struct NameNewByExpiry {};
+
+  /** NAME_NEW entries, indexed by hash and by expiry height.  */
+  typedef boost::multi_index_container<
+    NameNewEntry,
+    boost::multi_index::indexed_by<
+      boost::multi_index::hashed_unique<
+        boost::multi_index::member<NameNewEntry, valtype,
+                                   &NameNewEntry::hash>,
+        SaltedNameHasher>,
+      boost::multi_index::ordered_non_unique<
+        boost::multi_index::tag<NameNewByExpiry>,
+        boost::multi_index::member<NameNewEntry, unsigned,
+                                   &NameNewEntry::nExpiry> >
+    >
+  > NameNewSet;
+
+  /**
+   * NAME_NEW hashes with their transaction IDs.  They are used to prevent
+   * "name_new stealing", at least in a "soft" way:  A hash is kept while
+   * its tx is in the mempool and after that until the NAME_NEW has
+   * matured, which is the window in which the name could be stolen.
+   */
+  NameNewSet mapNameNews;
+
+  /** Memory used by mapNameNews (estimated).  */
+  size_t nNameNewsUsage;
+
+  /** Height of the last block connected, as seen by expireNameNews.  */
+  unsigned nBestHeight;
+
+  /** Number of NAME_NEW entries that expired.  */
+  uint64_t nNameNewsExpired;
+  /** Number of NAME_NEW entries evicted due to the memory limit.  */
+  uint64_t nNameNewsEvicted;
+
+  /**
+   * Counter that is incremented whenever a name registration or update
+   * (i. e., a game move) enters or leaves the pool.  This is used to
+   * detect changes to the moves that would go into the next block.
+   */
+  unsigned nMovesUpdated;
+
+  /**
+   * Estimate the memory used by an entry in mapNameNews.
+   * @param entry The entry.
+   * @return Its memory usage in bytes.
+   */
+  static size_t nameNewUsage (const NameNewEntry& entry);
+
+  /**
+   * Evict NAME_NEW entries whose tx is no longer in the mempool while
+   * the memory limit is exceeded.
+   */
+  void limitNameNews ();
 
 public:
 
@@ -127,9 +240,20 @@ public:
    * @param p The parent pool.
    */
   explicit inline CNameMemPool (CTxMemPool& p)
-    : pool(p), mapNameRegs(), mapNameUpdates(), mapNameNews()
+    : pool(p), nameOps(), mapNameNews(),
+      nNameNewsUsage(0), nBestHeight(0),
+      nNameNewsExpired(0), nNameNewsEvicted(0), nMovesUpdated(0)
   {}
 
+  /** Statistics about the remembered NAME_NEW hashes.  */
+  struct NameNewsStats
+  {
+    size_t nEntries;
+    size_t nUsage;
+    uint64_t nExpired;
+    uint64_t nEvicted;
+  };
+
   /**
    * Check whether a particular name is being registered by
    * some transaction in the mempool.  Does not lock, this is
@@ -140,7 +264,8 @@ public:
   inline bool
   registersName (const valtype& name) const
   {
-    return mapNameRegs.count (name) > 0;
+    const NameOpsByName::const_iterator mi = getNameOps ().find (name);
+    return mi != getNameOps ().end () && mi->fRegistration;
   }
 
   /**
@@ -151,7 +276,8 @@ public:
   inline bool
   updatesName (const valtype& name) const
   {
-    return mapNameUpdates.count (name) > 0;
+    const NameOpsByName::const_iterator mi = getNameOps ().find (name);
+    return mi != getNameOps ().end () && !mi->fRegistration;
   }
 
   /**
@@ -162,15 +288,53 @@ public:
    */
   uint256 getTxForName (const valtype& name) const;
 
+  /**
+   * Return the pending name operations sorted by name.  This allows
+   * to look up or list them without going through the whole mempool.
+   * Does not lock.
+   * @return The index of pending name operations by name.
+   */
+  inline const NameOpsByName&
+  getNameOps () const
+  {
+    return nameOps.get<NameOpByName> ();
+  }
+
   /**
    * Clear all data.
    */
   inline void
   clear ()
   {
-    mapNameRegs.clear ();
-    mapNameUpdates.clear ();
+    nameOps.clear ();
     mapNameNews.clear ();
+    nNameNewsUsage = 0;
+    ++nMovesUpdated;
+  }
+
+  /**
+   * Return statistics about the NAME_NEW hashes.  Does not lock.
+   * @return The current statistics.
+   */
+  inline NameNewsStats
+  getNameNewsStats () const
+  {
+    NameNewsStats res;
+    res.nEntries = mapNameNews.size ();
+    res.nUsage = nNameNewsUsage;
+    res.nExpired = nNameNewsExpired;
+    res.nEvicted = nNameNewsEvicted;
+    return res;
+  }
+
+  /**
+   * Return the counter of changes to the moves in the pool.  Does not lock.
+   * @return The current counter value.
+   */
+  inline unsigned
+  getMovesUpdated () const
+  {
+    return nMovesUpdated;
   }
 
   /**
@@ -187,6 +351,26 @@ public:
    */
   void remove (const CTxMemPoolEntry& entry);
 
+  /**
+   * Expire NAME_NEW hashes that have matured at the given height.  This is
+   * called when a block is connected.
+   * @param nHeight The height of the new block.
+   */
+  void expireNameNews (unsigned nHeight);
+
+  /**
+   * Set the height of the current chain tip without expiring anything.
+   * This is called when the chain has been loaded at startup, so that
+   * NAME_NEW hashes of txs removed before the next block is connected
+   * get the right expiry height.
+   * @param nHeight The height of the chain tip.
+   */
+  inline void
+  setBestHeight (unsigned nHeight)
+  {
+    nBestHeight = nHeight;
+  }
+
   /**
    * Remove conflicts for the given tx, based on name operations.  I. e.,
    * if the tx registers a name that conflicts with another registration
@@ -214,11 +398,16 @@ public:
 
   /**
    * Check if a tx can be added (based on name criteria) without
-   * causing a conflict.
+   * causing a conflict.  A pending operation on the same name does not
+   * conflict if it is replaced by the tx, i. e., if it is one of the
+   * mempool tx that the new one double-spends.  This is the case for
+   * a newer move of the same player.
    * @param tx The transaction to check.
+   * @param setConflicts The mempool tx that would be replaced by it.
    * @return True if it doesn't conflict.
    */
-  bool checkTx (const CTransaction& tx) const;
+  bool checkTx (const CTransaction& tx,
+                const std::set<uint256>& setConflicts) const;
 
 };
 
@@ -250,11 +439,27 @@ void ApplyNameTransaction (const CTransaction& tx, unsigned nHeight,
                            CCoinsViewCache& view, CBlockUndo& undo);
 
 /**
- * Check the name database consistency.  This calls CCoinsView::ValidateNameDB,
- * but only if applicable depending on the -checknamedb setting.  If it fails,
+ * Check the name database consistency after a block has been connected
+ * or disconnected, depending on the -checknamedb setting (-1 disables
+ * all checks).  Only the names touched by the block are verified against
+ * the UTXO set and the game state of the new tip.  This does not flush
+ * the coins cache.  In addition, a full check with
+ * CCoinsView::ValidateNameDB is requested from the background thread
+ * every n blocks (or as often as possible for n = 0).  If a check fails,
  * this throws an assertion failure.
- * @param disconnect Whether we are disconnecting blocks.
+ * @param block The block that was connected or disconnected.
+ * @param vGameTx The block's game transactions.
+ * @param disconnect Whether the block was disconnected.
+ */
+void CheckNameDB (const CBlock& block, const std::vector<CTransaction>& vGameTx,
+                  bool disconnect);
+
+/**
+ * Thread that runs the full name database check when requested by
+ * CheckNameDB.  The check works on a database snapshot and does not
+ * need cs_main.  It is only repeated once the best block on disk has
+ * changed, until then the request stays pending.
  */
-void CheckNameDB (bool disconnect);
+void ThreadCheckNameDB ();
 
 #endif // H_BITCOIN_NAMES_MAIN
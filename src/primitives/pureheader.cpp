@@ -9,6 +9,8 @@
 #include "scrypt/scrypt.h"
 #include "utilstrencodings.h"
 
+#include <string.h>
+
 uint256 CPureBlockHeader::GetHash() const
 {
     return SerializeHash(*this);
@@ -46,3 +48,28 @@ uint256 CPureBlockHeader::GetPowHash(PowAlgo algo) const
             assert (false);
     }
 }
+
+void CPureBlockHeader::GetPowHashes(const std::vector<const CPureBlockHeader*>& headers,
+                                    PowAlgo algo, std::vector<uint256>& hashes)
+{
+    hashes.resize(headers.size());
+    if (algo != ALGO_SCRYPT)
+    {
+        for (unsigned i = 0; i < headers.size(); ++i)
+            hashes[i] = headers[i]->GetPowHash(algo);
+        return;
+    }
+
+    /* The multi-buffer scrypt wants the inputs contiguously.  Like
+       GetPowHash, this relies on the header fields being laid out as
+       they are serialised.  */
+    if (headers.empty())
+        return;
+    std::vector<char> input(80 * headers.size());
+    std::vector<char> output(32 * headers.size());
+    for (unsigned i = 0; i < headers.size(); ++i)
+        memcpy(&input[80 * i], BEGIN(headers[i]->nVersion), 80);
+    scrypt_1024_1_1_256_multi(&input[0], &output[0], headers.size());
+    for (unsigned i = 0; i < headers.size(); ++i)
+        memcpy(hashes[i].begin(), &output[32 * i], 32);
+}
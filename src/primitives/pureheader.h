@@ -10,6 +10,8 @@
 #include "serialize.h"
 #include "uint256.h"
 
+#include <vector>
+
 /**
  * A block header without auxpow information.  This "intermediate step"
  * in constructing the full header is useful, because it breaks the cyclic
@@ -73,6 +75,17 @@ public:
     uint256 GetHash() const;
     uint256 GetPowHash(PowAlgo algo) const;
 
+    /**
+     * Compute the PoW hashes of several headers at once.  For scrypt, this
+     * uses the multi-buffer implementation, which is considerably faster
+     * than hashing the headers one by one.
+     * @param headers The headers to hash.
+     * @param algo The algorithm to use for all of them.
+     * @param hashes Set to the hashes, in the same order as headers.
+     */
+    static void GetPowHashes(const std::vector<const CPureBlockHeader*>& headers,
+                             PowAlgo algo, std::vector<uint256>& hashes);
+
     int64_t GetBlockTime() const
     {
         return (int64_t)nTime;
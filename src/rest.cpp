@@ -650,6 +650,43 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+/**
+ * Look up multiple names at once, requested as /rest/name/many/a/b/c.json.
+ * The names are separated by slashes, so a slash within a name must be
+ * encoded.  Only JSON is supported.
+ */
+static bool rest_name_many(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string encodedNames;
+    const RetFormat rf = ParseDataFormat(encodedNames, strURIPart);
+    if (rf != RF_JSON)
+        return RESTERR(req, HTTP_NOT_FOUND,
+                       "output format not found (available: json)");
+
+    std::vector<std::string> parts;
+    boost::split(parts, encodedNames, boost::is_any_of("/"));
+    if (parts.size() > MAX_NAMES_INFO)
+        return RESTERR(req, HTTP_BAD_REQUEST, strprintf("Error: max names exceeded (max: %u, tried: %u)", MAX_NAMES_INFO, parts.size()));
+
+    std::vector<valtype> names;
+    names.reserve(parts.size());
+    BOOST_FOREACH(const std::string& part, parts)
+    {
+        valtype plainName;
+        if (!DecodeName(plainName, part))
+            return RESTERR(req, HTTP_BAD_REQUEST,
+                           "Invalid encoded name: " + part);
+        names.push_back(plainName);
+    }
+
+    const std::string strJSON = getNamesInfo(names).write() + "\n";
+    req->WriteHeader("Content-Type", "application/json");
+    req->WriteReply(HTTP_OK, strJSON);
+    return true;
+}
+
 static bool rest_name(HTTPRequest* req, const std::string& strURIPart)
 {
     if (!CheckWarmup(req))
@@ -663,9 +700,12 @@ static bool rest_name(HTTPRequest* req, const std::string& strURIPart)
                        "Invalid encoded name: " + encodedName);
 
     CNameData data;
-    if (!pcoinsTip->GetName(plainName, data))
-        return RESTERR(req, HTTP_NOT_FOUND,
-                       "'" + ValtypeToString(plainName) + "' not found");
+    {
+        LOCK(cs_main);
+        if (!pcoinsTip->GetName(plainName, data))
+            return RESTERR(req, HTTP_NOT_FOUND,
+                           "'" + ValtypeToString(plainName) + "' not found");
+    }
 
     switch (rf)
     {
@@ -717,6 +757,7 @@ static const struct {
       {"/rest/mempool/contents", rest_mempool_contents},
       {"/rest/headers/", rest_headers},
       {"/rest/getutxos", rest_getutxos},
+      {"/rest/name/many/", rest_name_many},
       {"/rest/name/", rest_name},
 };
 
@@ -1302,6 +1302,12 @@ UniValue mempoolInfoToJSON()
     ret.push_back(Pair("maxmempool", (int64_t) maxmempool));
     ret.push_back(Pair("mempoolminfee", ValueFromAmount(mempool.GetMinFee(maxmempool).GetFeePerK())));
 
+    const CNameMemPool::NameNewsStats nameNews = mempool.getNameNewsStats();
+    ret.push_back(Pair("namenews", (int64_t) nameNews.nEntries));
+    ret.push_back(Pair("namenewsusage", (int64_t) nameNews.nUsage));
+    ret.push_back(Pair("namenewsexpired", (int64_t) nameNews.nExpired));
+    ret.push_back(Pair("namenewsevicted", (int64_t) nameNews.nEvicted));
+
     return ret;
 }
 
@@ -1317,7 +1323,11 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp)
             "  \"bytes\": xxxxx,              (numeric) Sum of all tx sizes\n"
             "  \"usage\": xxxxx,              (numeric) Total memory usage for the mempool\n"
             "  \"maxmempool\": xxxxx,         (numeric) Maximum memory usage for the mempool\n"
-            "  \"mempoolminfee\": xxxxx       (numeric) Minimum fee for tx to be accepted\n"
+            "  \"mempoolminfee\": xxxxx,      (numeric) Minimum fee for tx to be accepted\n"
+            "  \"namenews\": xxxxx,           (numeric) Number of remembered name_new hashes\n"
+            "  \"namenewsusage\": xxxxx,      (numeric) Memory usage for the name_new hashes\n"
+            "  \"namenewsexpired\": xxxxx,    (numeric) Number of name_new hashes that expired after maturing\n"
+            "  \"namenewsevicted\": xxxxx     (numeric) Number of name_new hashes evicted due to the memory limit\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getmempoolinfo", "")
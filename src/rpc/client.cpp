@@ -112,7 +112,11 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "setban", 3 },
     { "getmempoolancestors", 1 },
     { "getmempooldescendants", 1 },
+    { "name_show_many", 0 },
+    { "name_history", 1 },
+    { "name_history", 2 },
     { "name_scan", 1 },
+    { "name_byaddress", 2 },
     { "name_filter", 1 },
     { "name_filter", 2 },
     { "name_filter", 3 },
@@ -120,6 +124,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "sendtoname", 4 },
     { "game_getpath", 0 },
     { "game_getpath", 1 },
+    { "getgameperfinfo", 0 },
 };
 
 class CRPCConvertTable
@@ -17,6 +17,8 @@
 #include "game/common.h"
 #include "game/db.h"
 #include "game/movecreator.h"
+#include "game/perf.h"
+#include "game/snapshot.h"
 #include "game/state.h"
 #include "game/tx.h"
 #include "main.h"
@@ -150,18 +152,18 @@ game_getplayerstate (const UniValue& params, bool fHelp)
       throw JSONRPCError (RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
   }
 
-  GameState state(Params ().GetConsensus ());
-  if (!pgameDb->get (hash, state))
+  const GameStatePtr state = pgameDb->get (hash);
+  if (!state)
     throw JSONRPCError (RPC_DATABASE_ERROR, "Failed to fetch game state");
 
   const PlayerID name = params[0].get_str ();
-  PlayerStateMap::const_iterator mi = state.players.find (name);
-  if (mi == state.players.end ())
+  PlayerStateMap::const_iterator mi = state->players.find (name);
+  if (mi == state->players.end ())
     throw JSONRPCError (RPC_INVALID_ADDRESS_OR_KEY, "No such player");
 
   int crownIndex = -1;
-  if (name == state.crownHolder.player)
-    crownIndex = state.crownHolder.index;
+  if (name == state->crownHolder.player)
+    crownIndex = state->crownHolder.index;
 
   return mi->second.ToJsonValue (crownIndex);
 }
@@ -177,7 +179,8 @@ game_getstate (const UniValue& params, bool fHelp)
         "\nArguments:\n"
         "1. \"blockhash\"    (string, optional) the block hash\n"
         "\nResult:\n"
-        "JSON representation of the game state\n"
+        "JSON representation of the game state, including its"
+        " order-independent \"digest\"\n"
         "\nExamples:\n"
         + HelpExampleCli ("game_getstate", "")
         + HelpExampleCli ("game_getstate", "\"7125a396097e238e6f47662aaa3fa3b97af9125b8bcfea0dbd01aeedaae1faeb\"")
@@ -196,11 +199,15 @@ game_getstate (const UniValue& params, bool fHelp)
       throw JSONRPCError (RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
   }
 
-  GameState state(Params ().GetConsensus ());
-  if (!pgameDb->get (hash, state))
+  const GameStatePtr state = pgameDb->get (hash);
+  uint256 digest;
+  if (!state || !pgameDb->getDigest (hash, digest))
     throw JSONRPCError (RPC_DATABASE_ERROR, "Failed to fetch game state");
 
-  return state.ToJsonValue ();
+  UniValue res = state->ToJsonValue ();
+  res.push_back (Pair ("digest", digest.GetHex ()));
+
+  return res;
 }
 
 /* ************************************************************************** */
@@ -238,12 +245,12 @@ game_waitforchange (const UniValue& params, bool fHelp)
         const uint256 bestHash = *chainActive.Tip ()->phashBlock;
         if (hash != bestHash)
           {
-            GameState state(Params ().GetConsensus ());
-            if (!pgameDb->get (bestHash, state))
+            const GameStatePtr state = pgameDb->getTip ();
+            if (!state)
               throw JSONRPCError (RPC_DATABASE_ERROR,
                                   "Failed to fetch game state");
 
-            return state.ToJsonValue ();
+            return state->ToJsonValue ();
           }
       }
 
@@ -308,6 +315,74 @@ game_getpath (const UniValue& params, bool fHelp)
 
 /* ************************************************************************** */
 
+UniValue
+getgameperfinfo (const UniValue& params, bool fHelp)
+{
+  if (fHelp || params.size () > 1)
+    throw std::runtime_error (
+        "getgameperfinfo (reset)\n"
+        "\nReturn timing statistics and counters of the game engine.\n"
+        "\nArguments:\n"
+        "1. reset      (boolean, optional, default=false) reset all statistics"
+        " after returning them\n"
+        "\nResult:\n"
+        "{\n"
+        "  \"window\": n,         (numeric) number of recent samples per timer\n"
+        "  \"timers\": {          (json object) timings of the engine parts\n"
+        "    \"name\": {\n"
+        "      \"count\": n,      (numeric) number of recorded samples\n"
+        "      \"total_ms\": x,   (numeric) total time\n"
+        "      \"max_ms\": x,     (numeric) longest sample\n"
+        "      \"recent\": {...}  (json object) mean, median, p90, p99 and max\n"
+        "                              of the most recent samples\n"
+        "    },\n"
+        "    ...\n"
+        "  },\n"
+        "  \"counters\": {        (json object) total event counts\n"
+        "    \"name\": n,\n"
+        "    ...\n"
+        "  }\n"
+        "}\n"
+        "\nExamples:\n"
+        + HelpExampleCli ("getgameperfinfo", "")
+        + HelpExampleCli ("getgameperfinfo", "true")
+        + HelpExampleRpc ("getgameperfinfo", "")
+      );
+
+  const UniValue res = GamePerfToJSON ();
+  if (params.size () >= 1 && params[0].get_bool ())
+    GamePerfReset ();
+
+  return res;
+}
+
+/* ************************************************************************** */
+
+UniValue
+dumpgamestate (const UniValue& params, bool fHelp)
+{
+  if (fHelp || params.size () != 1)
+    throw std::runtime_error (
+        "dumpgamestate \"filename\"\n"
+        "\nWrite a snapshot of the game state at the current chain tip,"
+        " together with the name data of all players, to a file.  It can be"
+        " imported by another node with -loadgamestate.\n"
+        "\nArguments:\n"
+        "1. \"filename\"    (string, required) the file to write\n"
+        "\nExamples:\n"
+        + HelpExampleCli ("dumpgamestate", "\"gamestate.dat\"")
+        + HelpExampleRpc ("dumpgamestate", "\"gamestate.dat\"")
+      );
+
+  if (!WriteGameStateSnapshot (params[0].get_str ()))
+    throw JSONRPCError (RPC_MISC_ERROR,
+                        "Failed to write the snapshot, see debug.log");
+
+  return NullUniValue;
+}
+
+/* ************************************************************************** */
+
 static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         okSafeMode
   //  --------------------- ------------------------  -----------------------  ----------
@@ -315,6 +390,8 @@ static const CRPCCommand commands[] =
     { "game",               "game_getstate",          &game_getstate,          true },
     { "game",               "game_getpath",           &game_getpath,           true },
     { "game",               "game_waitforchange",     &game_waitforchange,     true },
+    { "game",               "getgameperfinfo",        &getgameperfinfo,        true },
+    { "game",               "dumpgamestate",          &dumpgamestate,          true },
 };
 
 void RegisterGameRPCCommands(CRPCTable &tableRPC)
@@ -17,12 +17,16 @@
 #include "net.h"
 #include "pow.h"
 #include "rpc/server.h"
+#include "scrypt/scrypt.h"
 #include "txmempool.h"
 #include "util.h"
 #include "utilstrencodings.h"
 #include "validationinterface.h"
 
 #include <stdint.h>
+#include <algorithm>
+#include <list>
+#include <map>
 #include <memory>
 #include <utility>
 
@@ -131,6 +135,39 @@ UniValue getnetworkhashps(const UniValue& params, bool fHelp)
     return GetNetworkHashPS(params.size() > 0 ? params[0].get_int() : 120, params.size() > 1 ? params[1].get_int() : -1);
 }
 
+/**
+ * Search nonces of a scrypt header, hashing as many candidates at once as
+ * the multi-buffer scrypt implementation handles.  Behaves like the simple
+ * nonce loop in generateBlocks:  On return, header.nNonce is either the
+ * solution or nInnerLoopCount, or nMaxTries is zero.
+ */
+static void SolveScryptHeader(CPureBlockHeader& header, uint32_t nBits,
+                              uint64_t& nMaxTries, uint32_t nInnerLoopCount)
+{
+    std::vector<CPureBlockHeader> candidates;
+    std::vector<const CPureBlockHeader*> candidatePtrs;
+    std::vector<uint256> hashes;
+    while (nMaxTries > 0 && header.nNonce < nInnerLoopCount) {
+        uint64_t nBatch = std::min<uint64_t>(scrypt_multi->lanes, nMaxTries);
+        nBatch = std::min<uint64_t>(nBatch, nInnerLoopCount - header.nNonce);
+
+        candidates.assign(nBatch, header);
+        candidatePtrs.clear();
+        for (unsigned i = 0; i < nBatch; ++i) {
+            candidates[i].nNonce += i;
+            candidatePtrs.push_back(&candidates[i]);
+        }
+        CPureBlockHeader::GetPowHashes(candidatePtrs, ALGO_SCRYPT, hashes);
+
+        for (unsigned i = 0; i < nBatch; ++i) {
+            if (CheckProofOfWork(hashes[i], nBits, ALGO_SCRYPT, Params().GetConsensus()))
+                return;
+            ++header.nNonce;
+            --nMaxTries;
+        }
+    }
+}
+
 UniValue generateBlocks(boost::shared_ptr<CReserveScript> coinbaseScript, int nGenerate, PowAlgo algo, uint64_t nMaxTries, bool keepScript)
 {
     static const int nInnerLoopCount = 0x10000;
@@ -158,9 +195,13 @@ UniValue generateBlocks(boost::shared_ptr<CReserveScript> coinbaseScript, int nG
         }
         CAuxPow::initAuxPow(*pblock);
         CPureBlockHeader& miningHeader = pblock->auxpow->parentBlock;
-        while (nMaxTries > 0 && miningHeader.nNonce < nInnerLoopCount && !CheckProofOfWork(miningHeader.GetPowHash(algo), pblock->nBits, algo, Params().GetConsensus())) {
-            ++miningHeader.nNonce;
-            --nMaxTries;
+        if (algo == ALGO_SCRYPT)
+            SolveScryptHeader(miningHeader, pblock->nBits, nMaxTries, nInnerLoopCount);
+        else {
+            while (nMaxTries > 0 && miningHeader.nNonce < nInnerLoopCount && !CheckProofOfWork(miningHeader.GetPowHash(algo), pblock->nBits, algo, Params().GetConsensus())) {
+                ++miningHeader.nNonce;
+                --nMaxTries;
+            }
         }
         if (nMaxTries == 0) {
             break;
@@ -963,6 +1004,209 @@ UniValue estimatesmartpriority(const UniValue& params, bool fHelp)
 /* ************************************************************************** */
 /* Merge mining.  */
 
+/**
+ * Cache of the blocks handed out by getauxblock.  The transactions and the
+ * game step (which is the expensive part) are assembled once per tip and
+ * mempool epoch into a shared template.  The per-algo blocks are derived
+ * from it by stamping the header and coinbase, which is cheap.  Blocks that
+ * have been handed out are kept for submission in a bounded LRU list, so
+ * that older ones expire instead of accumulating.
+ */
+class AuxBlockCache
+{
+
+private:
+
+    /** Maximum number of handed-out blocks to remember.  */
+    static const unsigned MAX_BLOCKS = 64;
+
+    /**
+     * Rebuild the shared template if the mempool changed and it is older
+     * than this (in seconds).
+     */
+    static const int64_t TEMPLATE_REFRESH_SECONDS = 60;
+
+    /** A block derived from the shared template for one algo.  */
+    struct CurrentBlock
+    {
+        std::shared_ptr<const CBlock> block;
+        CScript scriptPubKey;
+    };
+
+    /**
+     * Lock held while building a new shared template.  This serialises
+     * rebuilds without holding cs, so that Lookup is not blocked.
+     */
+    CCriticalSection cs_build;
+
+    /** Lock for all the data below.  */
+    CCriticalSection cs;
+
+    /** The shared template.  Its block is built for ALGO_SHA256D.  */
+    std::unique_ptr<CBlockTemplate> sharedTemplate;
+    /** Block the shared template builds on.  */
+    const CBlockIndex* pindexPrev;
+    /** Mempool counter at the time the shared template was built.  */
+    unsigned nTransactionsUpdatedLast;
+    /** Time at which the shared template was built.  */
+    int64_t nStart;
+
+    /** Current blocks derived from sharedTemplate, per algo.  */
+    std::map<PowAlgo, CurrentBlock> currentBlocks;
+
+    /** Blocks handed out, most recently used first.  */
+    std::list<std::shared_ptr<const CBlock>> blocks;
+
+    unsigned nExtraNonce;
+
+    /**
+     * Return true if the shared template is current.  Must be called
+     * with cs held.  Sets nTransactionsUpdated to the mempool counter.
+     */
+    bool IsSharedTemplateCurrent(unsigned& nTransactionsUpdated)
+    {
+        LOCK(cs_main);
+        nTransactionsUpdated = mempool.GetTransactionsUpdated();
+        return sharedTemplate && pindexPrev == chainActive.Tip()
+                && (nTransactionsUpdated == nTransactionsUpdatedLast
+                    || GetTime() - nStart <= TEMPLATE_REFRESH_SECONDS);
+    }
+
+    /**
+     * Make sure that the shared template is current.  Must be called
+     * without cs and cs_main held.  The new template is built without
+     * holding cs, which is only taken to swap it in.
+     */
+    void UpdateSharedTemplate(const CScript& scriptPubKey)
+    {
+        LOCK(cs_build);
+
+        // Store the counter before CreateNewBlock, to avoid races
+        unsigned nTransactionsUpdated;
+        {
+            LOCK(cs);
+            if (IsSharedTemplateCurrent(nTransactionsUpdated))
+                return;
+        }
+
+        /* This does not need cs_main, since CreateNewBlock only locks it
+           while selecting transactions and not for the game step.  */
+        std::unique_ptr<CBlockTemplate> newTemplate(BlockAssembler(Params()).CreateNewBlock(ALGO_SHA256D, scriptPubKey));
+        if (!newTemplate)
+            throw JSONRPCError(RPC_OUT_OF_MEMORY, "out of memory");
+
+        LOCK2(cs, cs_main);
+        const BlockMap::const_iterator mi
+            = mapBlockIndex.find(newTemplate->block.hashPrevBlock);
+        assert(mi != mapBlockIndex.end());
+
+        // Update state only when CreateNewBlock succeeded
+        sharedTemplate = std::move(newTemplate);
+        pindexPrev = mi->second;
+        nTransactionsUpdatedLast = nTransactionsUpdated;
+        nStart = GetTime();
+        currentBlocks.clear();
+    }
+
+    /**
+     * Derive a block for the given algo and coinbase script from the
+     * shared template.  Must be called with cs held.
+     */
+    std::shared_ptr<const CBlock> StampBlock(PowAlgo algo, const CScript& scriptPubKey)
+    {
+        std::shared_ptr<CBlock> block(new CBlock(sharedTemplate->block));
+
+        block->SetAlgo(algo);
+        block->SetChainId(Params().GetConsensus().nAuxpowChainId[algo]);
+
+        CMutableTransaction coinbaseTx(block->vtx[0]);
+        coinbaseTx.vout[0].scriptPubKey = scriptPubKey;
+        block->vtx[0] = coinbaseTx;
+
+        {
+            LOCK(cs_main);
+            // This also sets the difficulty, which depends on the algo.
+            UpdateTime(block.get(), Params().GetConsensus(), pindexPrev);
+            // Finalise it by setting the version and building the merkle root
+            IncrementExtraNonce(block.get(), pindexPrev, nExtraNonce);
+        }
+        block->SetAuxpowVersion(true);
+
+        return block;
+    }
+
+    /** Add a block to the front of the LRU list.  Must be called with cs held.  */
+    void Remember(const std::shared_ptr<const CBlock>& block)
+    {
+        blocks.push_front(block);
+        if (blocks.size() > MAX_BLOCKS)
+            blocks.pop_back();
+    }
+
+public:
+
+    AuxBlockCache()
+        : sharedTemplate(), pindexPrev(nullptr), nTransactionsUpdatedLast(0),
+          nStart(0), currentBlocks(), blocks(), nExtraNonce(0)
+    {}
+
+    /**
+     * Return a block to merge-mine for the given algo and coinbase script.
+     * @param algo The algo to mine.
+     * @param scriptPubKey The coinbase script.
+     * @param nHeight Set to the height of the block.
+     * @return The block.
+     */
+    std::shared_ptr<const CBlock> Get(PowAlgo algo, const CScript& scriptPubKey, int& nHeight)
+    {
+        UpdateSharedTemplate(scriptPubKey);
+
+        LOCK(cs);
+        nHeight = pindexPrev->nHeight + 1;
+
+        const std::map<PowAlgo, CurrentBlock>::const_iterator mit
+            = currentBlocks.find(algo);
+        if (mit != currentBlocks.end() && mit->second.scriptPubKey == scriptPubKey)
+        {
+            /* Mark it as recently used again.  It may have expired already
+               if many other blocks were stamped in the mean time.  */
+            if (!Lookup(mit->second.block->GetHash()))
+                Remember(mit->second.block);
+            return mit->second.block;
+        }
+
+        CurrentBlock cur;
+        cur.block = StampBlock(algo, scriptPubKey);
+        cur.scriptPubKey = scriptPubKey;
+        currentBlocks[algo] = cur;
+        Remember(cur.block);
+
+        return cur.block;
+    }
+
+    /**
+     * Look up a block handed out before by its hash.
+     * @param hash The block hash.
+     * @return The block, or NULL if it is not (or no longer) known.
+     */
+    std::shared_ptr<const CBlock> Lookup(const uint256& hash)
+    {
+        LOCK(cs);
+        for (std::list<std::shared_ptr<const CBlock>>::iterator i = blocks.begin();
+             i != blocks.end(); ++i)
+            if ((*i)->GetHash() == hash)
+            {
+                blocks.splice(blocks.begin(), blocks, i);
+                return blocks.front();
+            }
+
+        return std::shared_ptr<const CBlock>();
+    }
+
+};
+
+static AuxBlockCache auxBlockCache;
+
 UniValue getauxblock(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() > 2)
@@ -1020,14 +1264,6 @@ UniValue getauxblock(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_CLIENT_IN_INITIAL_DOWNLOAD,
                            "Alifecoin is downloading blocks...");
     
-    /* The variables below are used to keep track of created and not yet
-       submitted auxpow blocks.  Lock them to be sure even for multiple
-       RPC threads running in parallel.  */
-    static CCriticalSection cs_auxblockCache;
-    LOCK(cs_auxblockCache);
-    static std::map<uint256, CBlock*> mapNewBlock;
-    static std::vector<std::unique_ptr<CBlockTemplate>> vNewBlockTemplate;
-
     /* Create a new block?  */
     if (params.size() < 2)
     {
@@ -1035,51 +1271,9 @@ UniValue getauxblock(const UniValue& params, bool fHelp)
         if (params.size () >= 1)
           algo = DecodeAlgoParam (params[0]);
 
-        static unsigned nTransactionsUpdatedLast;
-        static const CBlockIndex* pindexPrev = nullptr;
-        static uint64_t nStart;
-        static CBlock* pblock = nullptr;
-        static unsigned nExtraNonce = 0;
-
-        // Update block
-        /* TODO: One could keep a block for each algo ready so that
-           we don't recreate it when the algo parameter is changed.
-           Not sure how much impact this has on practical mining operations.  */
-        {
-        LOCK(cs_main);
-        if (pindexPrev != chainActive.Tip()
-            || pblock->GetAlgo() != algo
-            || (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast
-                && GetTime() - nStart > 60))
-        {
-            if (pindexPrev != chainActive.Tip())
-            {
-                // Clear old blocks since they're obsolete now.
-                mapNewBlock.clear();
-                vNewBlockTemplate.clear();
-                pblock = nullptr;
-            }
-
-            // Create new block with nonce = 0 and extraNonce = 1
-            std::unique_ptr<CBlockTemplate> newBlock(BlockAssembler(Params()).CreateNewBlock(algo, coinbaseScript->reserveScript));
-            if (!newBlock)
-                throw JSONRPCError(RPC_OUT_OF_MEMORY, "out of memory");
-
-            // Update state only when CreateNewBlock succeeded
-            nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
-            pindexPrev = chainActive.Tip();
-            nStart = GetTime();
-
-            // Finalise it by setting the version and building the merkle root
-            IncrementExtraNonce(&newBlock->block, pindexPrev, nExtraNonce);
-            newBlock->block.SetAuxpowVersion(true);
-
-            // Save
-            pblock = &newBlock->block;
-            mapNewBlock[pblock->GetHash()] = pblock;
-            vNewBlockTemplate.push_back(std::move(newBlock));
-        }
-        }
+        int nHeight;
+        const std::shared_ptr<const CBlock> pblock
+            = auxBlockCache.Get(algo, coinbaseScript->reserveScript, nHeight);
 
         arith_uint256 target;
         bool fNegative, fOverflow;
@@ -1094,7 +1288,7 @@ UniValue getauxblock(const UniValue& params, bool fHelp)
         result.push_back(Pair("previousblockhash", pblock->hashPrevBlock.GetHex()));
         result.push_back(Pair("coinbasevalue", (int64_t)pblock->vtx[0].vout[0].nValue));
         result.push_back(Pair("bits", strprintf("%08x", pblock->nBits)));
-        result.push_back(Pair("height", static_cast<int64_t> (pindexPrev->nHeight + 1)));
+        result.push_back(Pair("height", static_cast<int64_t> (nHeight)));
         result.push_back(Pair("_target", HexStr(BEGIN(target), END(target))));
 
         return result;
@@ -1107,10 +1301,11 @@ UniValue getauxblock(const UniValue& params, bool fHelp)
     uint256 hash;
     hash.SetHex(params[0].get_str());
 
-    const std::map<uint256, CBlock*>::iterator mit = mapNewBlock.find(hash);
-    if (mit == mapNewBlock.end())
+    const std::shared_ptr<const CBlock> pblock = auxBlockCache.Lookup(hash);
+    if (!pblock)
         throw JSONRPCError(RPC_INVALID_PARAMETER, "block hash unknown");
-    CBlock& block = *mit->second;
+    /* Work on a copy, since other callers may submit for it as well.  */
+    CBlock block(*pblock);
 
     const std::vector<unsigned char> vchAuxPow = ParseHex(params[1].get_str());
     CDataStream ss(vchAuxPow, SER_GETHASH, PROTOCOL_VERSION);
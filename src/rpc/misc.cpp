@@ -528,15 +528,15 @@ getstatsforheight (const UniValue& params, bool fHelp)
   transactions.push_back (Pair ("name", static_cast<int> (nNameTx)));
   transactions.push_back (Pair ("game", vGameTx.size ()));
 
-  GameState gameState(Params ().GetConsensus ());
-  if (!pgameDb->get (block.GetHash (), gameState))
+  const GameStatePtr gameState = pgameDb->get (block.GetHash ());
+  if (!gameState)
     throw JSONRPCError (RPC_DATABASE_ERROR, "Failed to fetch game state");
   unsigned nHunters = 0;
   BOOST_FOREACH (const PAIRTYPE(const PlayerID, PlayerState)& cur,
-                 gameState.players)
+                 gameState->players)
     nHunters += cur.second.characters.size ();
   UniValue game(UniValue::VOBJ);
-  const unsigned nPlayers = gameState.players.size ();
+  const unsigned nPlayers = gameState->players.size ();
   game.push_back (Pair ("players", static_cast<int> (nPlayers)));
   game.push_back (Pair ("hunters", static_cast<int> (nHunters)));
 
@@ -11,16 +11,23 @@
 #include "primitives/transaction.h"
 #include "rpc/server.h"
 #include "script/names.h"
+#include "sync.h"
 #include "txmempool.h"
+#include "util.h"
 #include "utilstrencodings.h"
 #ifdef ENABLE_WALLET
 # include "wallet/wallet.h"
 #endif
 
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/tuple/tuple.hpp>
 #include <boost/xpressive/xpressive_dynamic.hpp>
 
+#include <algorithm>
 #include <memory>
 #include <sstream>
+#include <vector>
 
 #include <univalue.h>
 
@@ -195,18 +202,106 @@ name_show (const UniValue& params, bool fHelp)
   return getNameInfo (name, data);
 }
 
+/**
+ * Look up the data of multiple names under a single lock of cs_main and
+ * return them as JSON array, in the order of the request.  Names that do
+ * not exist are returned as null.  The lookups are done in the order of
+ * the name database, so that cache misses read LevelDB in sequence.
+ * @param names The names to look up.
+ * @return The JSON array of name info objects.
+ */
+UniValue
+getNamesInfo (const std::vector<valtype>& names)
+{
+  std::vector<size_t> order(names.size ());
+  for (size_t i = 0; i < names.size (); ++i)
+    order[i] = i;
+  const CNameCache::NameComparator cmp;
+  std::sort (order.begin (), order.end (),
+             [&names, &cmp] (size_t a, size_t b)
+               {
+                 return cmp (names[a], names[b]);
+               });
+
+  std::vector<CNameData> data(names.size ());
+  std::vector<bool> found(names.size (), false);
+  {
+    LOCK (cs_main);
+    for (size_t i = 0; i < order.size (); ++i)
+      {
+        const size_t cur = order[i];
+        if (i > 0 && names[cur] == names[order[i - 1]])
+          {
+            data[cur] = data[order[i - 1]];
+            found[cur] = found[order[i - 1]];
+          }
+        else
+          found[cur] = pcoinsTip->GetName (names[cur], data[cur]);
+      }
+  }
+
+  UniValue res(UniValue::VARR);
+  for (size_t i = 0; i < names.size (); ++i)
+    if (found[i])
+      res.push_back (getNameInfo (names[i], data[i]));
+    else
+      res.push_back (NullUniValue);
+
+  return res;
+}
+
+UniValue
+name_show_many (const UniValue& params, bool fHelp)
+{
+  if (fHelp || params.size () != 1)
+    throw std::runtime_error (
+        "name_show_many [\"name\",...]\n"
+        "\nLook up the current data for multiple names at once.\n"
+        "\nArguments:\n"
+        "1. [\"name\",...]     (array, required) the names to query for,"
+        + strprintf (" at most %u\n", MAX_NAMES_INFO) +
+        "\nResult:\n"
+        "[\n"
+        + getNameInfoHelp ("  ", ",") +
+        "  ...\n"
+        "]\n"
+        "\nThe entries are in the order of the names given.  For names that"
+        " do not exist,\nthe entry is null.\n"
+        "\nExamples:\n"
+        + HelpExampleCli ("name_show_many", "'[\"myname\",\"othername\"]'")
+        + HelpExampleRpc ("name_show_many", "[\"myname\",\"othername\"]")
+      );
+
+  const UniValue& arr = params[0].get_array ();
+  if (arr.size () > MAX_NAMES_INFO)
+    throw JSONRPCError (RPC_INVALID_PARAMETER,
+                        strprintf ("too many names (max: %u, tried: %u)",
+                                   MAX_NAMES_INFO, arr.size ()));
+
+  std::vector<valtype> names;
+  names.reserve (arr.size ());
+  for (size_t i = 0; i < arr.size (); ++i)
+    names.push_back (ValtypeFromString (arr[i].get_str ()));
+
+  return getNamesInfo (names);
+}
+
 /* ************************************************************************** */
 
 UniValue
 name_history (const UniValue& params, bool fHelp)
 {
-  if (fHelp || params.size () != 1)
+  if (fHelp || params.size () < 1 || params.size () > 3)
     throw std::runtime_error (
-        "name_history \"name\"\n"
+        "name_history \"name\" (\"from\" (\"count\"))\n"
         "\nLook up the current and all past data for the given name."
         "  -namehistory must be enabled.\n"
         "\nArguments:\n"
         "1. \"name\"          (string, required) the name to query for\n"
+        "2. \"from\"          (numeric, optional, default=0) skip this many"
+        " entries from the oldest\n"
+        "3. \"count\"         (numeric, optional) return at most this many"
+        " entries\n"
         "\nResult:\n"
         "[\n"
         + getNameInfoHelp ("  ", ",") +
@@ -214,6 +309,7 @@ name_history (const UniValue& params, bool fHelp)
         "]\n"
         "\nExamples:\n"
         + HelpExampleCli ("name_history", "\"myname\"")
+        + HelpExampleCli ("name_history", "\"myname\" 100 10")
         + HelpExampleRpc ("name_history", "\"myname\"")
       );
 
@@ -223,8 +319,20 @@ name_history (const UniValue& params, bool fHelp)
   const std::string nameStr = params[0].get_str ();
   const valtype name = ValtypeFromString (nameStr);
 
+  int from = 0;
+  if (params.size () >= 2)
+    from = params[1].get_int ();
+  int count = -1;
+  if (params.size () >= 3)
+    count = params[2].get_int ();
+  if (from < 0 || (params.size () >= 3 && count < 0))
+    throw JSONRPCError (RPC_INVALID_PARAMETER, "negative from or count");
+
+  /* The result is the history stack, oldest first, followed by the
+     current data.  Only the requested range of it is read.  */
   CNameData data;
-  CNameHistory history;
+  std::vector<CNameData> history;
+  bool fCurrent;
 
   {
     LOCK (cs_main);
@@ -236,14 +344,29 @@ name_history (const UniValue& params, bool fHelp)
         throw JSONRPCError (RPC_WALLET_ERROR, msg.str ());
       }
 
-    if (!pcoinsTip->GetNameHistory (name, history))
-      assert (history.empty ());
+    const uint64_t nSize = pcoinsTip->GetNameHistorySize (name);
+    const uint64_t nFrom = from;
+    uint64_t nEnd = nSize + 1;
+    if (count >= 0)
+      nEnd = std::min (nEnd, nFrom + count);
+
+    if (nFrom < nSize && nFrom < nEnd)
+      {
+        const unsigned nHistoryEnd = std::min (nEnd, nSize);
+        if (!pcoinsTip->GetNameHistoryEntries (name, nFrom, nHistoryEnd - nFrom,
+                                               history)
+              || history.size () != nHistoryEnd - nFrom)
+          throw JSONRPCError (RPC_DATABASE_ERROR,
+                              "failed to read the name history");
+      }
+    fCurrent = (nFrom <= nSize && nEnd > nSize);
   }
 
   UniValue res(UniValue::VARR);
-  BOOST_FOREACH (const CNameData& entry, history.getData ())
+  BOOST_FOREACH (const CNameData& entry, history)
     res.push_back (getNameInfo (name, entry));
-  res.push_back (getNameInfo (name, data));
+  if (fCurrent)
+    res.push_back (getNameInfo (name, data));
 
   return res;
 }
@@ -284,11 +407,17 @@ name_scan (const UniValue& params, bool fHelp)
   if (count <= 0)
     return res;
 
-  LOCK (cs_main);
+  /* Only take the snapshot while holding cs_main, the scan itself
+     does not block block processing.  */
+  std::unique_ptr<CNameSnapshot> snapshot;
+  {
+    LOCK (cs_main);
+    snapshot.reset (pcoinsTip->SnapshotNames ());
+  }
 
   valtype name;
   CNameData data;
-  std::unique_ptr<CNameIterator> iter(pcoinsTip->IterateNames ());
+  std::unique_ptr<CNameIterator> iter(snapshot->iterateNames ());
   for (iter->seek (start); count > 0 && iter->next (name, data); --count)
     res.push_back (getNameInfo (name, data));
 
@@ -297,6 +426,389 @@ name_scan (const UniValue& params, bool fHelp)
 
 /* ************************************************************************** */
 
+UniValue
+name_byaddress (const UniValue& params, bool fHelp)
+{
+  if (fHelp || params.size () < 1 || params.size () > 3)
+    throw std::runtime_error (
+        "name_byaddress \"address\" (\"start\" (\"count\"))\n"
+        "\nList the names owned by an address, in the same order as"
+        " name_scan.  -nameaddressindex must be enabled.\n"
+        "\nArguments:\n"
+        "1. \"address\"     (string, required) the address to look up\n"
+        "2. \"start\"       (string, optional) skip initially to this name\n"
+        "3. \"count\"       (numeric, optional, default=500) stop after this many names\n"
+        "\nResult:\n"
+        "[\n"
+        + getNameInfoHelp ("  ", ",") +
+        "  ...\n"
+        "]\n"
+        "\nExamples:\n"
+        + HelpExampleCli ("name_byaddress", "\"myaddress\"")
+        + HelpExampleCli ("name_byaddress", "\"myaddress\" \"abc\" 10")
+        + HelpExampleRpc ("name_byaddress", "\"myaddress\"")
+      );
+
+  if (!fNameAddressIndex)
+    throw std::runtime_error ("-nameaddressindex is not enabled");
+
+  const CBitcoinAddress address(params[0].get_str ());
+  if (!address.IsValid ())
+    throw JSONRPCError (RPC_INVALID_ADDRESS_OR_KEY, "invalid address");
+  const CScript addr = GetScriptForDestination (address.Get ());
+
+  valtype start;
+  if (params.size () >= 2)
+    start = ValtypeFromString (params[1].get_str ());
+
+  int count = 500;
+  if (params.size () >= 3)
+    count = params[2].get_int ();
+
+  UniValue res(UniValue::VARR);
+  if (count <= 0)
+    return res;
+
+  LOCK (cs_main);
+
+  valtype name;
+  CNameData data;
+  std::unique_ptr<CNameIterator> iter(pcoinsTip->IterateNamesForAddress (addr));
+  try
+    {
+      for (iter->seek (start); count > 0 && iter->next (name, data); --count)
+        res.push_back (getNameInfo (name, data));
+    }
+  catch (const std::runtime_error& exc)
+    {
+      throw JSONRPCError (RPC_DATABASE_ERROR, exc.what ());
+    }
+
+  return res;
+}
+
+/**
+ * Maximum number of helper threads used to match names in name_filter.
+ * This is the total for all concurrent calls.  The calling RPC thread
+ * always takes part in its scan as well.
+ */
+static const int MAX_NAME_FILTER_THREADS = 8;
+
+/** Number of name_filter helper threads currently running.  */
+static CCriticalSection cs_nameFilterThreads;
+static int nNameFilterThreads = 0;
+
+/**
+ * Reserve up to the given number of helper threads from the total budget
+ * and give them back when destroyed.
+ */
+class NameFilterThreadBudget
+{
+
+private:
+
+  int nGranted;
+
+public:
+
+  explicit NameFilterThreadBudget (int nWanted)
+  {
+    LOCK (cs_nameFilterThreads);
+    nGranted = std::max (0, std::min (nWanted, MAX_NAME_FILTER_THREADS
+                                                 - nNameFilterThreads));
+    nNameFilterThreads += nGranted;
+  }
+
+  ~NameFilterThreadBudget ()
+  {
+    LOCK (cs_nameFilterThreads);
+    nNameFilterThreads -= nGranted;
+    assert (nNameFilterThreads >= 0);
+  }
+
+  inline int
+  getGranted () const
+  {
+    return nGranted;
+  }
+
+};
+
+/**
+ * Return the literal prefix that all names matching the given regexp must
+ * start with.  This is found for patterns anchored with "^" and followed
+ * by plain characters.  For everything else, the empty prefix is returned.
+ * @param pattern The regexp.
+ * @return The prefix of all matching names.
+ */
+static valtype
+getRegexpPrefix (const std::string& pattern)
+{
+  if (pattern.empty () || pattern[0] != '^'
+        || pattern.find ('|') != std::string::npos)
+    return valtype ();
+
+  static const std::string plainChars = "/-_:@=,; ";
+  std::string res;
+  for (size_t i = 1; i < pattern.size (); ++i)
+    {
+      const char c = pattern[i];
+
+      /* The preceding character may not be present at all.  */
+      if (c == '?' || c == '*' || c == '{')
+        {
+          if (!res.empty ())
+            res.resize (res.size () - 1);
+          break;
+        }
+
+      if (!isalnum (static_cast<unsigned char> (c))
+            && plainChars.find (c) == std::string::npos)
+        break;
+      res += c;
+    }
+
+  return ValtypeFromString (res);
+}
+
+/**
+ * Parallel scan of a name snapshot for name_filter.  The name database
+ * is sorted by name length first, so the names with a given length and
+ * prefix form a contiguous key range.  The scan is split into such
+ * ranges (one for each length and byte following the regexp prefix),
+ * which are claimed by the worker threads in database order.  Each
+ * worker uses its own iterator on the snapshot.
+ */
+class NameFilterScan
+{
+
+private:
+
+  /** A single key range and the result of scanning it.  */
+  struct Range
+  {
+    /** Length of the names in this range.  */
+    unsigned len;
+    /** Prefix of all names in this range.  */
+    valtype prefix;
+    /** Whether this range contains all names longer than len.  */
+    bool tail;
+
+    /** Set when the range has been scanned.  */
+    bool done;
+    /** Matching names (not filled in in stats mode).  */
+    std::vector<std::pair<valtype, CNameData> > matches;
+    /** Number of matching names.  */
+    size_t nMatches;
+
+    Range (unsigned l, const valtype& p, bool t)
+      : len(l), prefix(p), tail(t), done(false), nMatches(0)
+    {}
+  };
+
+  const CNameSnapshot& snapshot;
+  const bool haveRegexp;
+  const std::string pattern;
+  const int height;
+  const int maxage;
+  const bool stats;
+
+  /** Stop once this many names have been found (0 means never).  */
+  const size_t nNeeded;
+
+  CCriticalSection cs;
+  std::vector<Range> ranges;
+  /** Index of the next range to scan.  */
+  size_t nNext;
+  /** Number of leading ranges that have been scanned.  */
+  size_t nDone;
+  /** Number of matches in the leading scanned ranges.  */
+  size_t nMatchesDone;
+  /** Error message if one of the workers failed.  */
+  std::string strError;
+
+  void scanRange (CNameIterator& iter,
+                  const boost::xpressive::sregex& regexp, Range& r) const;
+  void work ();
+
+public:
+
+  NameFilterScan (const CNameSnapshot& s, bool r, const std::string& p,
+                  int h, int m, bool st, size_t n);
+
+  /**
+   * Run the scan and return the matches in database order.
+   * @param from Number of leading matches to skip.
+   * @param nb Maximum number of matches to return (0 means all).
+   * @param names Store the matches here (not in stats mode).
+   * @return Number of returned matches.
+   */
+  size_t run (size_t from, size_t nb,
+              std::vector<std::pair<valtype, CNameData> >& names);
+
+};
+
+NameFilterScan::NameFilterScan (const CNameSnapshot& s, bool r,
+                                const std::string& p, int h, int m, bool st,
+                                size_t n)
+  : snapshot(s), haveRegexp(r), pattern(p), height(h), maxage(m), stats(st),
+    nNeeded(n), nNext(0), nDone(0), nMatchesDone(0)
+{
+  const valtype prefix = haveRegexp ? getRegexpPrefix (pattern) : valtype ();
+  for (unsigned len = prefix.size (); len <= MAX_NAME_LENGTH; ++len)
+    {
+      if (len == prefix.size ())
+        {
+          ranges.push_back (Range (len, prefix, false));
+          continue;
+        }
+
+      valtype rangePrefix(prefix);
+      rangePrefix.push_back (0);
+      for (unsigned b = 0; b < 256; ++b)
+        {
+          rangePrefix.back () = b;
+          ranges.push_back (Range (len, rangePrefix, false));
+        }
+    }
+
+  /* Names longer than MAX_NAME_LENGTH are not valid, but make sure
+     that the scan is complete even if some are in the database.  */
+  const unsigned tailLen = std::max<unsigned> (MAX_NAME_LENGTH + 1,
+                                               prefix.size ());
+  ranges.push_back (Range (tailLen, prefix, true));
+}
+
+void
+NameFilterScan::scanRange (CNameIterator& iter,
+                           const boost::xpressive::sregex& regexp,
+                           Range& r) const
+{
+  valtype start(r.prefix);
+  start.resize (r.len, 0);
+  iter.seek (start);
+
+  valtype name;
+  CNameData data;
+  while (iter.next (name, data))
+    {
+      if (!r.tail && name.size () != r.len)
+        break;
+      if (!std::equal (r.prefix.begin (), r.prefix.end (), name.begin ()))
+        {
+          if (r.tail)
+            continue;
+          break;
+        }
+
+      const int age = height - data.getHeight ();
+      assert (age >= 0);
+      if (maxage != 0 && age >= maxage)
+        continue;
+
+      if (haveRegexp)
+        {
+          const std::string nameStr = ValtypeToString (name);
+          boost::xpressive::smatch matches;
+          if (!boost::xpressive::regex_search (nameStr, matches, regexp))
+            continue;
+        }
+
+      ++r.nMatches;
+      if (!stats)
+        r.matches.push_back (std::make_pair (name, data));
+    }
+}
+
+void
+NameFilterScan::work ()
+{
+  try
+    {
+      /* Each worker compiles its own regexp, since they are not
+         safe to share between threads.  */
+      boost::xpressive::sregex regexp;
+      if (haveRegexp)
+        regexp = boost::xpressive::sregex::compile (
+            pattern, boost::xpressive::regex_constants::single_line);
+
+      std::unique_ptr<CNameIterator> iter(snapshot.iterateNames ());
+      while (true)
+        {
+          size_t i;
+          {
+            LOCK (cs);
+            if (nNext >= ranges.size ()
+                  || (nNeeded > 0 && nMatchesDone >= nNeeded))
+              return;
+            i = nNext++;
+          }
+
+          Range r(ranges[i].len, ranges[i].prefix, ranges[i].tail);
+          scanRange (*iter, regexp, r);
+
+          LOCK (cs);
+          ranges[i].matches.swap (r.matches);
+          ranges[i].nMatches = r.nMatches;
+          ranges[i].done = true;
+          while (nDone < ranges.size () && ranges[nDone].done)
+            {
+              nMatchesDone += ranges[nDone].nMatches;
+              ++nDone;
+            }
+        }
+    }
+  catch (const std::exception& e)
+    {
+      LOCK (cs);
+      strError = e.what ();
+      nNext = ranges.size ();
+    }
+}
+
+size_t
+NameFilterScan::run (size_t from, size_t nb,
+                     std::vector<std::pair<valtype, CNameData> >& names)
+{
+  const int nThreads = std::min<int> (GetNumCores (), ranges.size ());
+  const NameFilterThreadBudget budget(nThreads - 1);
+  boost::thread_group threads;
+  for (int i = 0; i < budget.getGranted (); ++i)
+    threads.create_thread (boost::bind (&NameFilterScan::work, this));
+  work ();
+  threads.join_all ();
+
+  if (!strError.empty ())
+    throw JSONRPCError (RPC_INTERNAL_ERROR,
+                        "name scan failed: " + strError);
+
+  /* Collect the result from the leading scanned ranges.  If the scan
+     was stopped early, they contain enough matches already.  */
+  size_t count = 0;
+  for (size_t i = 0; i < nDone && (nb == 0 || count < nb); ++i)
+    {
+      const Range& r = ranges[i];
+      if (r.nMatches <= from)
+        {
+          from -= r.nMatches;
+          continue;
+        }
+
+      size_t n = r.nMatches - from;
+      if (nb > 0)
+        n = std::min (n, nb - count);
+      if (!stats)
+        names.insert (names.end (), r.matches.begin () + from,
+                      r.matches.begin () + from + n);
+      count += n;
+      from = 0;
+    }
+
+  return count;
+}
+
+/* ************************************************************************** */
+
 UniValue
 name_filter (const UniValue& params, bool fHelp)
 {
@@ -326,7 +838,7 @@ name_filter (const UniValue& params, bool fHelp)
   /* Interpret parameters.  */
 
   bool haveRegexp(false);
-  boost::xpressive::sregex regexp;
+  std::string pattern;
 
   int maxage(36000), from(0), nb(0);
   bool stats(false);
@@ -334,7 +846,13 @@ name_filter (const UniValue& params, bool fHelp)
   if (params.size () >= 1)
     {
       haveRegexp = true;
-      regexp = boost::xpressive::sregex::compile (params[0].get_str ());
+      pattern = params[0].get_str ();
+
+      /* "^" matches only at the start of the name, so that it can be
+         used to seek to a name prefix.  Compile it here already, such
+         that invalid patterns are reported before scanning.  */
+      boost::xpressive::sregex::compile (
+          pattern, boost::xpressive::regex_constants::single_line);
     }
 
   if (params.size () >= 2)
@@ -363,48 +881,26 @@ name_filter (const UniValue& params, bool fHelp)
   /* ******************************************* */
   /* Iterate over names to build up the result.  */
 
-  UniValue names(UniValue::VARR);
-  unsigned count(0);
-
-  LOCK (cs_main);
-
-  valtype name;
-  CNameData data;
-  std::unique_ptr<CNameIterator> iter(pcoinsTip->IterateNames ());
-  while (iter->next (name, data))
-    {
-      const int age = chainActive.Height () - data.getHeight ();
-      assert (age >= 0);
-      if (maxage != 0 && age >= maxage)
-        continue;
-
-      if (haveRegexp)
-        {
-          const std::string nameStr = ValtypeToString (name);
-          boost::xpressive::smatch matches;
-          if (!boost::xpressive::regex_search (nameStr, matches, regexp))
-            continue;
-        }
-
-      if (from > 0)
-        {
-          --from;
-          continue;
-        }
-      assert (from == 0);
+  /* The names are scanned on a snapshot, so that cs_main is only held
+     while taking it.  */
+  std::unique_ptr<CNameSnapshot> snapshot;
+  int height;
+  {
+    LOCK (cs_main);
+    snapshot.reset (pcoinsTip->SnapshotNames ());
+    height = chainActive.Height ();
+  }
 
-      if (stats)
-        ++count;
-      else
-        names.push_back (getNameInfo (name, data));
+  const size_t nNeeded = (nb > 0 ? from + nb : 0);
+  NameFilterScan scan(*snapshot, haveRegexp, pattern, height, maxage, stats,
+                      nNeeded);
+  std::vector<std::pair<valtype, CNameData> > found;
+  const size_t count = scan.run (from, nb, found);
 
-      if (nb > 0)
-        {
-          --nb;
-          if (nb == 0)
-            break;
-        }
-    }
+  UniValue names(UniValue::VARR);
+  for (std::vector<std::pair<valtype, CNameData> >::const_iterator
+        i = found.begin (); i != found.end (); ++i)
+    names.push_back (getNameInfo (i->first, i->second));
 
   /* ********************************************************** */
   /* Return the correct result (take stats mode into account).  */
@@ -412,7 +908,7 @@ name_filter (const UniValue& params, bool fHelp)
   if (stats)
     {
       UniValue res(UniValue::VOBJ);
-      res.push_back (Pair ("blocks", chainActive.Height ()));
+      res.push_back (Pair ("blocks", height));
       res.push_back (Pair ("count", static_cast<int> (count)));
 
       return res;
@@ -455,27 +951,23 @@ name_pending (const UniValue& params, bool fHelp)
     LOCK (mempool.cs);
 #endif
 
-  std::vector<uint256> txHashes;
-  if (params.size () == 0)
-    mempool.queryHashes (txHashes);
-  else
-    {
-      const std::string name = params[0].get_str ();
-      const valtype vchName = ValtypeFromString (name);
-      const uint256 txid = mempool.getTxForName (vchName);
-      if (!txid.IsNull ())
-        txHashes.push_back (txid);
-    }
+  /* Go through the mempool's index of pending name operations.  With
+     a name filter, only the (at most one) matching entry is looked up.  */
+  const CNameMemPool::NameOpsByName& nameOps = mempool.getNameOps ();
+  CNameMemPool::NameOpsByName::const_iterator begin = nameOps.begin ();
+  CNameMemPool::NameOpsByName::const_iterator end = nameOps.end ();
+  if (params.size () > 0)
+    boost::tie (begin, end)
+      = nameOps.equal_range (ValtypeFromString (params[0].get_str ()));
 
   UniValue arr(UniValue::VARR);
-  for (std::vector<uint256>::const_iterator i = txHashes.begin ();
-       i != txHashes.end (); ++i)
+  for (CNameMemPool::NameOpsByName::const_iterator i = begin; i != end; ++i)
     {
-      std::shared_ptr<const CTransaction> tx = mempool.get (*i);
-      if (!tx || !tx->IsNamecoin ())
-        continue;
+      const CTxMemPool::txiter mit = mempool.mapTx.find (i->txid);
+      assert (mit != mempool.mapTx.end ());
+      const CTransaction& tx = mit->GetTx ();
 
-      for (const auto& txOut : tx->vout)
+      for (const auto& txOut : tx.vout)
         {
           const CNameScript op(txOut.scriptPubKey);
           if (!op.isNameOp () || !op.isAnyUpdate ())
@@ -504,7 +996,7 @@ name_pending (const UniValue& params, bool fHelp)
           obj.push_back (Pair ("op", strOp));
           obj.push_back (Pair ("name", name));
           obj.push_back (Pair ("value", value));
-          obj.push_back (Pair ("txid", tx->GetHash ().GetHex ()));
+          obj.push_back (Pair ("txid", tx.GetHash ().GetHex ()));
 
 #ifdef ENABLE_WALLET
           isminetype mine = ISMINE_NO;
@@ -539,9 +1031,13 @@ name_checkdb (const UniValue& params, bool fHelp)
         + HelpExampleRpc ("name_checkdb", "")
       );
 
-  LOCK (cs_main);
-  pcoinsTip->Flush ();
-  return pcoinsTip->ValidateNameDB (*pgameDb);
+  /* The check itself runs on a snapshot of the flushed state.  */
+  {
+    LOCK (cs_main);
+    pcoinsTip->Flush ();
+  }
+  uint256 hashBlock;
+  return pcoinsTip->ValidateNameDB (*pgameDb, hashBlock);
 }
 
 /* ************************************************************************** */
@@ -550,8 +1046,10 @@ static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         okSafeMode
   //  --------------------- ------------------------  -----------------------  ----------
     { "namecoin",           "name_show",              &name_show,              false },
+    { "namecoin",           "name_show_many",         &name_show_many,         false },
     { "namecoin",           "name_history",           &name_history,           false },
     { "namecoin",           "name_scan",              &name_scan,              false },
+    { "namecoin",           "name_byaddress",         &name_byaddress,         false },
     { "namecoin",           "name_filter",            &name_filter,            false },
     { "namecoin",           "name_pending",           &name_pending,           true  },
     { "namecoin",           "name_checkdb",           &name_checkdb,           false },
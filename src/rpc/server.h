@@ -203,6 +203,9 @@ extern void SendMoneyToScript(const CScript& scriptPubKey, const CTxIn* withInpu
 extern void AddRawTxNameOperation(CMutableTransaction& tx, const UniValue& obj);
 extern UniValue getNameInfo(const valtype& name, const valtype& value, bool dead, const COutPoint& outp, const CScript& addr, int height);
 extern UniValue getNameInfo(const valtype& name, const CNameData& data);
+/** Maximum number of names that can be looked up at once with getNamesInfo.  */
+static const unsigned int MAX_NAMES_INFO = 1000;
+extern UniValue getNamesInfo(const std::vector<valtype>& names);
 extern std::string getNameInfoHelp(const std::string& indent, const std::string& trailing);
 
 extern PowAlgo DecodeAlgoParam(const UniValue& param);
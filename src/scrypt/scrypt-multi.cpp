@@ -0,0 +1,343 @@
+/*
+ * Copyright 2009 Colin Percival, 2011 ArtForz, 2012-2013 pooler
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * This file was originally written by Colin Percival as part of the Tarsnap
+ * online backup system.
+ */
+
+/*
+ * Multi-buffer scrypt(1024, 1, 1, 256).  Several independent 80-byte inputs
+ * are hashed at once, with each 32-bit word of the Salsa20/8 state held in
+ * one SIMD register and every lane of the register belonging to a different
+ * input.  The PBKDF2 steps are done per input as in the scalar code.
+ */
+
+#include "compat/cpufeatures.h"
+#include "scrypt/scrypt.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <new>
+
+#ifdef USE_SCRYPT_MULTI_X86
+#include <immintrin.h>
+#endif
+
+/* Size of the scrypt state (X) in 32-bit words and of V in states.  */
+#define SCRYPT_WORDS 32
+#define SCRYPT_N 1024
+
+/* Apply the Salsa20/8 double round to the words x[0..15] of type T, using
+   the given ADD, XOR and ROTL operations.  This is the same sequence as
+   in xor_salsa8 of scrypt.cpp.  */
+#define SALSA8_DOUBLEROUND(x, ADD, XOR, ROTL) do { \
+	x[ 4] = XOR(x[ 4], ROTL(ADD(x[ 0], x[12]),  7)); \
+	x[ 9] = XOR(x[ 9], ROTL(ADD(x[ 5], x[ 1]),  7)); \
+	x[14] = XOR(x[14], ROTL(ADD(x[10], x[ 6]),  7)); \
+	x[ 3] = XOR(x[ 3], ROTL(ADD(x[15], x[11]),  7)); \
+	x[ 8] = XOR(x[ 8], ROTL(ADD(x[ 4], x[ 0]),  9)); \
+	x[13] = XOR(x[13], ROTL(ADD(x[ 9], x[ 5]),  9)); \
+	x[ 2] = XOR(x[ 2], ROTL(ADD(x[14], x[10]),  9)); \
+	x[ 7] = XOR(x[ 7], ROTL(ADD(x[ 3], x[15]),  9)); \
+	x[12] = XOR(x[12], ROTL(ADD(x[ 8], x[ 4]), 13)); \
+	x[ 1] = XOR(x[ 1], ROTL(ADD(x[13], x[ 9]), 13)); \
+	x[ 6] = XOR(x[ 6], ROTL(ADD(x[ 2], x[14]), 13)); \
+	x[11] = XOR(x[11], ROTL(ADD(x[ 7], x[ 3]), 13)); \
+	x[ 0] = XOR(x[ 0], ROTL(ADD(x[12], x[ 8]), 18)); \
+	x[ 5] = XOR(x[ 5], ROTL(ADD(x[ 1], x[13]), 18)); \
+	x[10] = XOR(x[10], ROTL(ADD(x[ 6], x[ 2]), 18)); \
+	x[15] = XOR(x[15], ROTL(ADD(x[11], x[ 7]), 18)); \
+	x[ 1] = XOR(x[ 1], ROTL(ADD(x[ 0], x[ 3]),  7)); \
+	x[ 6] = XOR(x[ 6], ROTL(ADD(x[ 5], x[ 4]),  7)); \
+	x[11] = XOR(x[11], ROTL(ADD(x[10], x[ 9]),  7)); \
+	x[12] = XOR(x[12], ROTL(ADD(x[15], x[14]),  7)); \
+	x[ 2] = XOR(x[ 2], ROTL(ADD(x[ 1], x[ 0]),  9)); \
+	x[ 7] = XOR(x[ 7], ROTL(ADD(x[ 6], x[ 5]),  9)); \
+	x[ 8] = XOR(x[ 8], ROTL(ADD(x[11], x[10]),  9)); \
+	x[13] = XOR(x[13], ROTL(ADD(x[12], x[15]),  9)); \
+	x[ 3] = XOR(x[ 3], ROTL(ADD(x[ 2], x[ 1]), 13)); \
+	x[ 4] = XOR(x[ 4], ROTL(ADD(x[ 7], x[ 6]), 13)); \
+	x[ 9] = XOR(x[ 9], ROTL(ADD(x[ 8], x[11]), 13)); \
+	x[14] = XOR(x[14], ROTL(ADD(x[13], x[12]), 13)); \
+	x[ 0] = XOR(x[ 0], ROTL(ADD(x[ 3], x[ 2]), 18)); \
+	x[ 5] = XOR(x[ 5], ROTL(ADD(x[ 4], x[ 7]), 18)); \
+	x[10] = XOR(x[10], ROTL(ADD(x[ 9], x[ 8]), 18)); \
+	x[15] = XOR(x[15], ROTL(ADD(x[14], x[13]), 18)); \
+} while (0)
+
+/* ************************************************************************** */
+/* Scratchpads.  */
+
+/* Per-thread scratchpad, grown on demand and kept for the thread's
+   lifetime.  This avoids both a large stack frame and an allocation
+   per hash.  */
+struct ScryptScratchpad
+{
+	char *data;
+	size_t size;
+
+	ScryptScratchpad() : data(NULL), size(0) {}
+	~ScryptScratchpad() { free(data); }
+};
+
+static thread_local ScryptScratchpad threadScratchpad;
+
+char *scrypt_get_scratchpad(size_t size)
+{
+	if (threadScratchpad.size < size) {
+		char *data = static_cast<char *>(realloc(threadScratchpad.data, size));
+		if (data == NULL)
+			throw std::bad_alloc();
+		threadScratchpad.data = data;
+		threadScratchpad.size = size;
+	}
+	return threadScratchpad.data;
+}
+
+/* Return the thread's scratchpad for the given number of lanes,
+   aligned to 64 bytes.  */
+static void *get_aligned_scratchpad(unsigned lanes)
+{
+	char *sp = scrypt_get_scratchpad(lanes * (SCRYPT_SCRATCHPAD_SIZE - 63) + 63);
+	return (void *)(((uintptr_t)(sp) + 63) & ~ (uintptr_t)(63));
+}
+
+/* Compute the initial state of one lane from its input.  */
+static void scrypt_multi_load(const char *input, uint32_t X[SCRYPT_WORDS])
+{
+	uint8_t B[128];
+	PBKDF2_SHA256((const uint8_t *)input, 80, (const uint8_t *)input, 80, 1, B, 128);
+	for (int k = 0; k < SCRYPT_WORDS; k++)
+		X[k] = le32dec(&B[4 * k]);
+}
+
+/* Compute the output of one lane from its final state.  */
+static void scrypt_multi_store(const char *input, const uint32_t X[SCRYPT_WORDS], char *output)
+{
+	uint8_t B[128];
+	for (int k = 0; k < SCRYPT_WORDS; k++)
+		le32enc(&B[4 * k], X[k]);
+	PBKDF2_SHA256((const uint8_t *)input, 80, B, 128, 1, (uint8_t *)output, 32);
+}
+
+/* ************************************************************************** */
+/* Generic implementation.  */
+
+static void scrypt_multi_generic(const char *input, char *output, size_t n)
+{
+	char *scratchpad = scrypt_get_scratchpad(SCRYPT_SCRATCHPAD_SIZE);
+	for (size_t i = 0; i < n; i++)
+		scrypt_1024_1_1_256_sp_generic(input + 80 * i, output + 32 * i, scratchpad);
+}
+
+const ScryptMulti scrypt_multi_impl_generic = {"generic", 1, &scrypt_multi_generic};
+
+#ifdef USE_SCRYPT_MULTI_X86
+
+#define SCRYPT_TARGET_SSE2 __attribute__((target("sse2")))
+#define SCRYPT_TARGET_AVX2 __attribute__((target("avx2")))
+
+/* ************************************************************************** */
+/* SSE2 implementation, four lanes.  */
+
+#define ADD_SSE2(a, b) _mm_add_epi32(a, b)
+#define XOR_SSE2(a, b) _mm_xor_si128(a, b)
+#define ROTL_SSE2(a, b) _mm_or_si128(_mm_slli_epi32(a, b), _mm_srli_epi32(a, 32 - (b)))
+
+SCRYPT_TARGET_SSE2 static inline void xor_salsa8_4way(__m128i B[16], const __m128i Bx[16])
+{
+	__m128i x[16];
+	int i;
+
+	for (i = 0; i < 16; i++)
+		x[i] = B[i] = _mm_xor_si128(B[i], Bx[i]);
+	for (i = 0; i < 8; i += 2)
+		SALSA8_DOUBLEROUND(x, ADD_SSE2, XOR_SSE2, ROTL_SSE2);
+	for (i = 0; i < 16; i++)
+		B[i] = _mm_add_epi32(B[i], x[i]);
+}
+
+SCRYPT_TARGET_SSE2 static void scrypt_multi_sse2_4(const char *input, char *output)
+{
+	union {
+		__m128i v[SCRYPT_WORDS];
+		uint32_t u32[SCRYPT_WORDS][4];
+	} X;
+	uint32_t lane[SCRYPT_WORDS];
+	__m128i *V = static_cast<__m128i *>(get_aligned_scratchpad(4));
+	const uint32_t *V32 = reinterpret_cast<const uint32_t *>(V);
+	uint32_t i, k, l;
+
+	for (l = 0; l < 4; l++) {
+		scrypt_multi_load(input + 80 * l, lane);
+		for (k = 0; k < SCRYPT_WORDS; k++)
+			X.u32[k][l] = lane[k];
+	}
+
+	for (i = 0; i < SCRYPT_N; i++) {
+		for (k = 0; k < SCRYPT_WORDS; k++)
+			V[i * SCRYPT_WORDS + k] = X.v[k];
+		xor_salsa8_4way(&X.v[0], &X.v[16]);
+		xor_salsa8_4way(&X.v[16], &X.v[0]);
+	}
+	for (i = 0; i < SCRYPT_N; i++) {
+		uint32_t j[4];
+		for (l = 0; l < 4; l++)
+			j[l] = (X.u32[16][l] & (SCRYPT_N - 1)) * SCRYPT_WORDS * 4 + l;
+		for (k = 0; k < SCRYPT_WORDS; k++) {
+			const __m128i v = _mm_set_epi32(V32[j[3] + 4 * k], V32[j[2] + 4 * k],
+			                                V32[j[1] + 4 * k], V32[j[0] + 4 * k]);
+			X.v[k] = _mm_xor_si128(X.v[k], v);
+		}
+		xor_salsa8_4way(&X.v[0], &X.v[16]);
+		xor_salsa8_4way(&X.v[16], &X.v[0]);
+	}
+
+	for (l = 0; l < 4; l++) {
+		for (k = 0; k < SCRYPT_WORDS; k++)
+			lane[k] = X.u32[k][l];
+		scrypt_multi_store(input + 80 * l, lane, output + 32 * l);
+	}
+}
+
+static void scrypt_multi_sse2(const char *input, char *output, size_t n)
+{
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4)
+		scrypt_multi_sse2_4(input + 80 * i, output + 32 * i);
+	if (i < n)
+		scrypt_multi_generic(input + 80 * i, output + 32 * i, n - i);
+}
+
+const ScryptMulti scrypt_multi_impl_sse2 = {"sse2", 4, &scrypt_multi_sse2};
+
+/* ************************************************************************** */
+/* AVX2 implementation, eight lanes.  The lookups into V in the second loop
+   are done with gathers.  */
+
+#define ADD_AVX2(a, b) _mm256_add_epi32(a, b)
+#define XOR_AVX2(a, b) _mm256_xor_si256(a, b)
+#define ROTL_AVX2(a, b) _mm256_or_si256(_mm256_slli_epi32(a, b), _mm256_srli_epi32(a, 32 - (b)))
+
+SCRYPT_TARGET_AVX2 static inline void xor_salsa8_8way(__m256i B[16], const __m256i Bx[16])
+{
+	__m256i x[16];
+	int i;
+
+	for (i = 0; i < 16; i++)
+		x[i] = B[i] = _mm256_xor_si256(B[i], Bx[i]);
+	for (i = 0; i < 8; i += 2)
+		SALSA8_DOUBLEROUND(x, ADD_AVX2, XOR_AVX2, ROTL_AVX2);
+	for (i = 0; i < 16; i++)
+		B[i] = _mm256_add_epi32(B[i], x[i]);
+}
+
+SCRYPT_TARGET_AVX2 static void scrypt_multi_avx2_8(const char *input, char *output)
+{
+	union {
+		__m256i v[SCRYPT_WORDS];
+		uint32_t u32[SCRYPT_WORDS][8];
+	} X;
+	uint32_t lane[SCRYPT_WORDS];
+	__m256i *V = static_cast<__m256i *>(get_aligned_scratchpad(8));
+	const int *V32 = reinterpret_cast<const int *>(V);
+	uint32_t i, k, l;
+
+	for (l = 0; l < 8; l++) {
+		scrypt_multi_load(input + 80 * l, lane);
+		for (k = 0; k < SCRYPT_WORDS; k++)
+			X.u32[k][l] = lane[k];
+	}
+
+	for (i = 0; i < SCRYPT_N; i++) {
+		for (k = 0; k < SCRYPT_WORDS; k++)
+			V[i * SCRYPT_WORDS + k] = X.v[k];
+		xor_salsa8_8way(&X.v[0], &X.v[16]);
+		xor_salsa8_8way(&X.v[16], &X.v[0]);
+	}
+
+	const __m256i laneIds = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m256i mask = _mm256_set1_epi32(SCRYPT_N - 1);
+	const __m256i step = _mm256_set1_epi32(8);
+	for (i = 0; i < SCRYPT_N; i++) {
+		/* Index of word 0 of V[j] for each lane.  */
+		__m256i idx = _mm256_and_si256(X.v[16], mask);
+		idx = _mm256_slli_epi32(idx, 8); /* * SCRYPT_WORDS * 8 */
+		idx = _mm256_add_epi32(idx, laneIds);
+		for (k = 0; k < SCRYPT_WORDS; k++) {
+			const __m256i v = _mm256_i32gather_epi32(V32, idx, 4);
+			X.v[k] = _mm256_xor_si256(X.v[k], v);
+			idx = _mm256_add_epi32(idx, step);
+		}
+		xor_salsa8_8way(&X.v[0], &X.v[16]);
+		xor_salsa8_8way(&X.v[16], &X.v[0]);
+	}
+
+	for (l = 0; l < 8; l++) {
+		for (k = 0; k < SCRYPT_WORDS; k++)
+			lane[k] = X.u32[k][l];
+		scrypt_multi_store(input + 80 * l, lane, output + 32 * l);
+	}
+}
+
+static void scrypt_multi_avx2(const char *input, char *output, size_t n)
+{
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8)
+		scrypt_multi_avx2_8(input + 80 * i, output + 32 * i);
+	if (i < n)
+		scrypt_multi_sse2(input + 80 * i, output + 32 * i, n - i);
+}
+
+const ScryptMulti scrypt_multi_impl_avx2 = {"avx2", 8, &scrypt_multi_avx2};
+
+#endif // USE_SCRYPT_MULTI_X86
+
+/* ************************************************************************** */
+
+const ScryptMulti *scrypt_multi = &scrypt_multi_impl_generic;
+
+void scrypt_detect_multi()
+{
+#ifdef USE_SCRYPT_MULTI_X86
+	if (CPUHasFeature(CPU_FEATURE_AVX2))
+		scrypt_multi = &scrypt_multi_impl_avx2;
+	else if (CPUHasFeature(CPU_FEATURE_SSE2))
+		scrypt_multi = &scrypt_multi_impl_sse2;
+	else
+		scrypt_multi = &scrypt_multi_impl_generic;
+	LogPrintf("scrypt: using scrypt-multi-%s as detected.\n", scrypt_multi->name);
+#else
+	LogPrintf("scrypt: using scrypt-multi-%s as built.\n", scrypt_multi->name);
+#endif
+}
+
+void scrypt_1024_1_1_256_multi(const char *input, char *output, size_t n)
+{
+	scrypt_multi->hash(input, output, n);
+}
@@ -306,7 +306,7 @@ void scrypt_detect_sse2(unsigned int cpuid_edx)
 
 void scrypt_1024_1_1_256(const char *input, char *output)
 {
-	char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
+	char *scratchpad = scrypt_get_scratchpad(SCRYPT_SCRATCHPAD_SIZE);
 #if defined(USE_SSE2)
         // Detection would work, but in cases where we KNOW it always has SSE2,
         // it is faster to use directly than to use a function pointer or conditional.
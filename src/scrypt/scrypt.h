@@ -13,6 +13,33 @@ void scrypt_1024_1_1_256_sp_sse2(const char *input, char *output, char *scratchp
 extern void (*scrypt_1024_1_1_256_sp)(const char *input, char *output, char *scratchpad);
 #endif
 
+/* Multi-buffer hashing of n independent inputs.  input holds n contiguous
+   80-byte headers and output receives n contiguous 32-byte hashes.  The
+   result is identical to calling scrypt_1024_1_1_256 on each input.  */
+struct ScryptMulti
+{
+	const char *name;
+	/* Number of inputs hashed together per pass.  */
+	unsigned lanes;
+	void (*hash)(const char *input, char *output, size_t n);
+};
+
+extern const ScryptMulti scrypt_multi_impl_generic;
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define USE_SCRYPT_MULTI_X86 1
+extern const ScryptMulti scrypt_multi_impl_sse2;
+extern const ScryptMulti scrypt_multi_impl_avx2;
+#endif
+
+/* The implementation in use, selected by scrypt_detect_multi.  */
+extern const ScryptMulti *scrypt_multi;
+void scrypt_detect_multi();
+void scrypt_1024_1_1_256_multi(const char *input, char *output, size_t n);
+
+/* Thread-local scratch memory of at least size bytes, valid until the
+   next call from the same thread.  */
+char *scrypt_get_scratchpad(size_t size);
+
 void
 PBKDF2_SHA256(const uint8_t *passwd, size_t passwdlen, const uint8_t *salt,
     size_t saltlen, uint64_t c, uint8_t *buf, size_t dkLen);
@@ -0,0 +1,125 @@
+// Copyright (C) 2016 Crypto Realities Ltd
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "compat/cpufeatures.h"
+#include "game/aikernels.h"
+#include "random.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <vector>
+
+BOOST_FIXTURE_TEST_SUITE (aikernels_tests, BasicTestingSetup)
+
+/**
+ * Return all implementations that can be run on this CPU.
+ */
+static std::vector<const AIKernels*>
+getRunnableKernels ()
+{
+  std::vector<const AIKernels*> res;
+  res.push_back (&AI_kernels_generic);
+#ifdef USE_AI_KERNELS_X86
+  if (CPUHasFeature (CPU_FEATURE_SSE2))
+    res.push_back (&AI_kernels_sse2);
+  if (CPUHasFeature (CPU_FEATURE_AVX2))
+    res.push_back (&AI_kernels_avx2);
+#endif
+  return res;
+}
+
+/**
+ * Random playermap score.  Mostly zero (as on the real map), with the
+ * interesting values around the level thresholds and the int range.
+ */
+static int
+randomScore ()
+{
+  switch (insecure_rand () % 8)
+    {
+    case 0:
+      return insecure_rand () % 30;
+    case 1:
+      return -static_cast<int> (insecure_rand () % 3);
+    case 2:
+      return static_cast<int> (insecure_rand ());
+    default:
+      return 0;
+    }
+}
+
+BOOST_AUTO_TEST_CASE (kernels_match_generic)
+{
+  const std::vector<const AIKernels*> kernels = getRunnableKernels ();
+  const AIKernels& ref = AI_kernels_generic;
+
+  int scores[AI_KERNEL_MAX_RUN][AI_KERNEL_COLORS];
+  unsigned flags[AI_KERNEL_MAX_RUN][AI_KERNEL_COLORS];
+
+  for (int round = 0; round < 2000; ++round)
+    {
+      for (int n = 0; n < AI_KERNEL_MAX_RUN; ++n)
+        for (int k = 0; k < AI_KERNEL_COLORS; ++k)
+          {
+            scores[n][k] = randomScore ();
+            flags[n][k] = 1u << (insecure_rand () % 32);
+          }
+
+      const int count = insecure_rand () % (AI_KERNEL_MAX_RUN + 1);
+      const int ownColor = static_cast<int> (insecure_rand () % 6) - 1;
+      const int maxScore = static_cast<int> (insecure_rand () % 30);
+      const unsigned resistMask = insecure_rand ();
+
+      const uint32_t foe = ref.foeMask (scores, count, ownColor);
+      const uint32_t weak = ref.weakFoeMask (scores, count, ownColor, maxScore);
+      const uint32_t target = ref.targetMask (scores, flags, count, ownColor,
+                                              resistMask);
+
+      /* Nothing beyond the run may be set.  */
+      if (count < 32)
+        {
+          BOOST_CHECK_EQUAL (foe >> count, 0);
+          BOOST_CHECK_EQUAL (weak >> count, 0);
+          BOOST_CHECK_EQUAL (target >> count, 0);
+        }
+
+      for (const AIKernels* k : kernels)
+        {
+          BOOST_CHECK_EQUAL (k->foeMask (scores, count, ownColor), foe);
+          BOOST_CHECK_EQUAL (k->weakFoeMask (scores, count, ownColor,
+                                             maxScore), weak);
+          BOOST_CHECK_EQUAL (k->targetMask (scores, flags, count, ownColor,
+                                            resistMask), target);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE (kernels_own_color)
+{
+  int scores[AI_KERNEL_MAX_RUN][AI_KERNEL_COLORS] = {};
+  unsigned flags[AI_KERNEL_MAX_RUN][AI_KERNEL_COLORS] = {};
+
+  /* Tile 0 only has our own team (colour 1), tile 5 also a foe.  */
+  scores[0][1] = 5;
+  scores[5][1] = 5;
+  scores[5][3] = 1;
+  flags[0][1] = 0x10;
+  flags[5][3] = 0x10;
+
+  for (const AIKernels* k : getRunnableKernels ())
+    {
+      BOOST_CHECK_EQUAL (k->foeMask (scores, 21, 1), 1u << 5);
+      BOOST_CHECK_EQUAL (k->foeMask (scores, 21, 3), 1u | (1u << 5));
+      BOOST_CHECK_EQUAL (k->foeMask (scores, 21, -1), 1u | (1u << 5));
+      BOOST_CHECK_EQUAL (k->weakFoeMask (scores, 21, 1, 5), 1u << 5);
+      BOOST_CHECK_EQUAL (k->weakFoeMask (scores, 21, 3, 5), 0);
+      BOOST_CHECK_EQUAL (k->targetMask (scores, flags, 21, 1, 0x10), 1u << 5);
+      BOOST_CHECK_EQUAL (k->targetMask (scores, flags, 21, 1, 0x20), 0);
+      BOOST_CHECK_EQUAL (k->foeMask (scores, 5, 1), 0);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END ()
@@ -0,0 +1,90 @@
+// Copyright (C) 2016 Crypto Realities Ltd
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "game/digest.h"
+#include "game/state.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE (gamedigest_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE (digest_multiset)
+{
+  const uint256 a = uint256S ("01");
+  const uint256 b = uint256S ("ff00");
+
+  GameStateDigest d1, d2;
+  d1.Add (a);
+  d1.Add (b);
+  d2.Add (b);
+  d2.Add (a);
+  BOOST_CHECK (d1.GetHash () == d2.GetHash ());
+
+  d1.Remove (a);
+  BOOST_CHECK (d1.GetHash () != d2.GetHash ());
+  d1.Remove (b);
+  BOOST_CHECK (d1.GetHash () == GameStateDigest ().GetHash ());
+
+  GameStateDigest d3;
+  d3.Add (a);
+  d3 += d2;
+  d3.Remove (a);
+  BOOST_CHECK (d3.GetHash () == d2.GetHash ());
+}
+
+BOOST_AUTO_TEST_CASE (digest_state)
+{
+  const Consensus::Params& params = Params ().GetConsensus ();
+
+  GameState s1(params);
+  GameState s2(params);
+  BOOST_CHECK (GameStateDigest::Compute (s1).GetHash ()
+                == GameStateDigest::Compute (s2).GetHash ());
+
+  /* Insertion order must not matter.  */
+  s1.hearts.insert (Coord (1, 2));
+  s1.hearts.insert (Coord (3, 4));
+  s2.hearts.insert (Coord (3, 4));
+  s2.hearts.insert (Coord (1, 2));
+  s1.players["foo"].value = 10;
+  s1.players["bar"].value = 20;
+  s2.players["bar"].value = 20;
+  s2.players["foo"].value = 10;
+  BOOST_CHECK (GameStateDigest::Compute (s1).GetHash ()
+                == GameStateDigest::Compute (s2).GetHash ());
+
+  /* Changes in any of the parts must be detected.  */
+  const uint256 base = GameStateDigest::Compute (s1).GetHash ();
+
+  s2 = s1;
+  s2.players["foo"].value = 11;
+  BOOST_CHECK (GameStateDigest::Compute (s2).GetHash () != base);
+
+  s2 = s1;
+  s2.players["foo"].characters[0].coord = Coord (5, 5);
+  BOOST_CHECK (GameStateDigest::Compute (s2).GetHash () != base);
+
+  s2 = s1;
+  s2.loot[Coord (1, 2)] = LootInfo (100, 5);
+  BOOST_CHECK (GameStateDigest::Compute (s2).GetHash () != base);
+
+  s2 = s1;
+  s2.banks[Coord (1, 2)] = 10;
+  BOOST_CHECK (GameStateDigest::Compute (s2).GetHash () != base);
+
+  s2 = s1;
+  s2.gameFund = 42;
+  BOOST_CHECK (GameStateDigest::Compute (s2).GetHash () != base);
+
+  /* A heart and a bank at the same coordinate are different elements.  */
+  s2 = s1;
+  s2.hearts.erase (Coord (1, 2));
+  s2.banks[Coord (1, 2)] = 0;
+  BOOST_CHECK (GameStateDigest::Compute (s2).GetHash () != base);
+}
+
+BOOST_AUTO_TEST_SUITE_END ()
@@ -204,7 +204,7 @@ private:
   CCoinsViewCache cache;
 
   /** Keep track of what the name set should look like as comparison.  */
-  CNameCache::EntryMap data;
+  std::map<valtype, CNameData, CNameCache::NameComparator> data;
 
   /**
    * Keep an internal counter to build unique and changing CNameData
@@ -762,6 +762,155 @@ BOOST_AUTO_TEST_CASE (name_updates_undo)
 
 /* ************************************************************************** */
 
+BOOST_AUTO_TEST_CASE (name_history_storage)
+{
+  fNameHistory = true;
+
+  const valtype name = ValtypeFromString ("history-test-name");
+  const CScript addr = getTestAddress ();
+  const CScript updateScript
+    = CNameScript::buildNameUpdate (addr, name, ValtypeFromString ("value"));
+  const CNameScript nameOp(updateScript);
+
+  std::vector<CNameData> data(4);
+  for (unsigned i = 0; i < data.size (); ++i)
+    data[i].fromScript (100 * (i + 1), COutPoint (uint256 (), i), nameOp);
+
+  std::vector<CNameData> entries;
+  CNameHistory history;
+  CCoinsViewCache view(pcoinsdbview);
+
+  view.SetName (name, data[0], false);
+  view.SetName (name, data[1], false);
+  view.SetName (name, data[2], false);
+  BOOST_CHECK_EQUAL (view.GetNameHistorySize (name), 2u);
+  BOOST_CHECK (view.Flush ());
+  BOOST_CHECK_EQUAL (pcoinsdbview->GetNameHistorySize (name), 2u);
+  BOOST_CHECK (pcoinsdbview->GetNameHistoryEntries (name, 1, 5, entries));
+  BOOST_CHECK (entries.size () == 1 && entries[0] == data[1]);
+
+  /* Undo the last update and replace it in a child cache.  */
+  {
+    CCoinsViewCache child(&view);
+    child.SetName (name, data[1], true);
+    BOOST_CHECK_EQUAL (child.GetNameHistorySize (name), 1u);
+    child.SetName (name, data[3], false);
+    BOOST_CHECK (child.Flush ());
+  }
+  BOOST_CHECK (view.GetNameHistory (name, history));
+  BOOST_CHECK (history.getData () == std::vector<CNameData> (data.begin (),
+                                                             data.begin () + 2));
+  BOOST_CHECK (view.Flush ());
+  BOOST_CHECK (pcoinsdbview->GetNameHistory (name, history));
+  BOOST_CHECK (history.getData () == std::vector<CNameData> (data.begin (),
+                                                             data.begin () + 2));
+
+  /* Undo everything, which should erase all entries from the database.  */
+  {
+    CCoinsViewCache child(&view);
+    child.SetName (name, data[1], true);
+    child.SetName (name, data[0], true);
+    BOOST_CHECK_EQUAL (child.GetNameHistorySize (name), 0u);
+    BOOST_CHECK (child.Flush ());
+  }
+  BOOST_CHECK (view.GetNameHistoryEntries (name, 0, 5, entries));
+  BOOST_CHECK (entries.empty ());
+  view.DeleteName (name);
+  BOOST_CHECK (view.Flush ());
+  BOOST_CHECK_EQUAL (pcoinsdbview->GetNameHistorySize (name), 0u);
+  BOOST_CHECK (pcoinsdbview->GetNameHistoryEntries (name, 0, 5, entries));
+  BOOST_CHECK (entries.empty ());
+  BOOST_CHECK (!pcoinsdbview->GetNameHistory (name, history));
+}
+
+/* ************************************************************************** */
+
+/**
+ * Collect the names owned by an address in a view.
+ * @param view The view to query.
+ * @param addr The address.
+ * @return The names in iteration order.
+ */
+static std::vector<std::string>
+getNamesForAddress (const CCoinsView& view, const CScript& addr)
+{
+  std::vector<std::string> res;
+  valtype name;
+  CNameData data;
+  std::unique_ptr<CNameIterator> iter(view.IterateNamesForAddress (addr));
+  while (iter->next (name, data))
+    {
+      BOOST_CHECK (data.getAddress () == addr);
+      res.push_back (ValtypeToString (name));
+    }
+
+  return res;
+}
+
+BOOST_AUTO_TEST_CASE (name_address_index)
+{
+  fNameAddressIndex = true;
+
+  const CScript addr1 = getTestAddress ();
+  const CScript addr2 = CScript () << OP_TRUE;
+  const valtype value = ValtypeFromString ("value");
+
+  const char* names[] = {"ai-b", "ai-a", "ai-aa"};
+  std::vector<CNameData> data1, data2;
+  for (unsigned i = 0; i < 3; ++i)
+    {
+      const valtype name = ValtypeFromString (names[i]);
+      CNameData data;
+      const CScript scr1 = CNameScript::buildNameUpdate (addr1, name, value);
+      data.fromScript (100, COutPoint (uint256 (), i), CNameScript (scr1));
+      data1.push_back (data);
+      const CScript scr2 = CNameScript::buildNameUpdate (addr2, name, value);
+      data.fromScript (200, COutPoint (uint256 (), i), CNameScript (scr2));
+      data2.push_back (data);
+    }
+
+  CCoinsViewCache view(pcoinsdbview);
+  for (unsigned i = 0; i < 3; ++i)
+    view.SetName (ValtypeFromString (names[i]), data1[i], false);
+
+  std::vector<std::string> expected;
+  expected.push_back ("ai-a");
+  expected.push_back ("ai-b");
+  expected.push_back ("ai-aa");
+  BOOST_CHECK (getNamesForAddress (view, addr1) == expected);
+  BOOST_CHECK (view.Flush ());
+  BOOST_CHECK (getNamesForAddress (*pcoinsdbview, addr1) == expected);
+  BOOST_CHECK (getNamesForAddress (*pcoinsdbview, addr2).empty ());
+
+  /* Move a name to the other address.  The unflushed change must be
+     visible through the cache, and end up in the index when flushed.  */
+  view.SetName (ValtypeFromString ("ai-b"), data2[0], false);
+  expected.erase (expected.begin () + 1);
+  BOOST_CHECK (getNamesForAddress (view, addr1) == expected);
+  BOOST_CHECK (getNamesForAddress (view, addr2)
+                == std::vector<std::string> (1, "ai-b"));
+  BOOST_CHECK (view.Flush ());
+  BOOST_CHECK (getNamesForAddress (*pcoinsdbview, addr1) == expected);
+  BOOST_CHECK (getNamesForAddress (*pcoinsdbview, addr2)
+                == std::vector<std::string> (1, "ai-b"));
+
+  /* Undo the change again.  */
+  view.SetName (ValtypeFromString ("ai-b"), data1[0], true);
+  BOOST_CHECK (view.Flush ());
+  BOOST_CHECK (getNamesForAddress (*pcoinsdbview, addr1).size () == 3);
+  BOOST_CHECK (getNamesForAddress (*pcoinsdbview, addr2).empty ());
+
+  for (unsigned i = 0; i < 3; ++i)
+    view.DeleteName (ValtypeFromString (names[i]));
+  BOOST_CHECK (getNamesForAddress (view, addr1).empty ());
+  BOOST_CHECK (view.Flush ());
+  BOOST_CHECK (getNamesForAddress (*pcoinsdbview, addr1).empty ());
+
+  fNameAddressIndex = false;
+}
+
+/* ************************************************************************** */
+
 BOOST_AUTO_TEST_CASE (name_mempool)
 {
   LOCK(mempool.cs);
@@ -880,6 +1029,19 @@ BOOST_AUTO_TEST_CASE (name_mempool)
   BOOST_CHECK (mempool.updatesName (nameUpd));
   BOOST_CHECK (!mempool.checkNameOps (txUpd2));
 
+  /* The update can be replaced by a newer one double-spending it.  */
+  std::set<uint256> replaced;
+  replaced.insert (txUpd1.GetHash ());
+  BOOST_CHECK (mempool.checkNameOps (txUpd2, replaced));
+  BOOST_CHECK (!mempool.checkNameOps (txReg2, replaced));
+
+  /* Check the index of pending operations, which is sorted by name.  */
+  const CNameMemPool::NameOpsByName& nameOps = mempool.getNameOps ();
+  BOOST_CHECK (nameOps.size () == 2);
+  BOOST_CHECK (nameOps.begin ()->name == nameReg
+                && nameOps.begin ()->fRegistration);
+  BOOST_CHECK (nameOps.find (nameUpd)->txid == txUpd1.GetHash ());
+
   /* Check getTxForName.  */
   BOOST_CHECK (mempool.getTxForName (nameReg) == txReg1.GetHash ());
   BOOST_CHECK (mempool.getTxForName (nameUpd) == txUpd1.GetHash ());
@@ -946,6 +1108,32 @@ BOOST_AUTO_TEST_CASE (name_mempool)
   BOOST_CHECK (removed.front ().GetHash () == txReg1.GetHash ());
   BOOST_CHECK (!mempool.registersName (nameReg));
   BOOST_CHECK (mempool.mapTx.empty ());
+
+  /* Check expiry of the name_new hashes.  They are kept while the tx
+     is in the mempool and afterwards until the name_new has matured.  */
+
+  const std::vector<CTransaction> noTx;
+  std::list<CTransaction> nameConflicts;
+  mempool.addUnchecked (entryNew1.GetTx ().GetHash (), entryNew1);
+  mempool.removeForBlock (noTx, 100, dummyConflicts, nameConflicts);
+  mempool.removeForBlock (noTx, 1000, dummyConflicts, nameConflicts);
+  BOOST_CHECK (!mempool.checkNameOps (txNew1p));
+
+  const CNameMemPool::NameNewsStats stats = mempool.getNameNewsStats ();
+  BOOST_CHECK (stats.nEntries > 0 && stats.nUsage > 0);
+
+  mempool.removeRecursive (txNew1, removed);
+  mempool.removeForBlock (noTx, 1001 + MIN_FIRSTUPDATE_DEPTH,
+                          dummyConflicts, nameConflicts);
+  BOOST_CHECK (!mempool.checkNameOps (txNew1p));
+  mempool.removeForBlock (noTx, 1002 + MIN_FIRSTUPDATE_DEPTH,
+                          dummyConflicts, nameConflicts);
+  BOOST_CHECK (mempool.checkNameOps (txNew1p));
+
+  const CNameMemPool::NameNewsStats stats2 = mempool.getNameNewsStats ();
+  BOOST_CHECK (stats2.nEntries < stats.nEntries);
+  BOOST_CHECK (stats2.nUsage < stats.nUsage);
+  BOOST_CHECK (stats2.nExpired > stats.nExpired);
 }
 
 /* ************************************************************************** */
@@ -0,0 +1,81 @@
+// Copyright (C) 2016 Crypto Realities Ltd
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "compat/cpufeatures.h"
+#include "scrypt/scrypt.h"
+#include "random.h"
+#include "uint256.h"
+#include "utilstrencodings.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <string>
+#include <vector>
+
+BOOST_FIXTURE_TEST_SUITE (scrypt_tests, BasicTestingSetup)
+
+/**
+ * Return all multi-buffer implementations that can be run on this CPU.
+ */
+static std::vector<const ScryptMulti*>
+getRunnableImpls ()
+{
+  std::vector<const ScryptMulti*> res;
+  res.push_back (&scrypt_multi_impl_generic);
+#ifdef USE_SCRYPT_MULTI_X86
+  if (CPUHasFeature (CPU_FEATURE_SSE2))
+    res.push_back (&scrypt_multi_impl_sse2);
+  if (CPUHasFeature (CPU_FEATURE_AVX2))
+    res.push_back (&scrypt_multi_impl_avx2);
+#endif
+  return res;
+}
+
+BOOST_AUTO_TEST_CASE (known_hash)
+{
+  /* Litecoin's genesis block header.  */
+  const std::vector<unsigned char> input = ParseHex (
+      "01000000000000000000000000000000000000000000000000000000000000000000"
+      "0000d9ced4ed1130f7b7faad9be25323ffafa33232a17c3edf6cfd97bee6bafbdd97"
+      "b9aa8e4ef0ff0f1ecd513f7c");
+  BOOST_REQUIRE_EQUAL (input.size (), 80);
+
+  uint256 hash;
+  scrypt_1024_1_1_256 (reinterpret_cast<const char*> (&input[0]),
+                       reinterpret_cast<char*> (hash.begin ()));
+  BOOST_CHECK_EQUAL (hash.GetHex (),
+                     "0000050c34a64b415b6b15b37f2216634b5b1669cb9a2e38d76f7213b0671e00");
+}
+
+BOOST_AUTO_TEST_CASE (multi_matches_single)
+{
+  const std::vector<const ScryptMulti*> impls = getRunnableImpls ();
+
+  /* Use counts that are not multiples of the lane widths, so that the
+     tails are exercised as well.  */
+  const size_t counts[] = {1, 3, 4, 7, 8, 13};
+  for (const size_t n : counts)
+    {
+      std::vector<char> input(80 * n);
+      for (auto& c : input)
+        c = static_cast<char> (insecure_rand ());
+
+      std::vector<char> expected(32 * n);
+      for (size_t i = 0; i < n; ++i)
+        scrypt_1024_1_1_256 (&input[80 * i], &expected[32 * i]);
+
+      for (const ScryptMulti* impl : impls)
+        {
+          std::vector<char> output(32 * n);
+          impl->hash (&input[0], &output[0], n);
+          BOOST_CHECK_MESSAGE (output == expected,
+                               std::string (impl->name) + " differs for n = "
+                                 + std::to_string (n));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END ()
@@ -16,6 +16,7 @@
 #include "script/names.h"
 
 #include <stdint.h>
+#include <algorithm>
 
 #include <boost/thread.hpp>
 
@@ -24,16 +25,25 @@ using namespace std;
 static const char DB_COINS = 'c';
 static const char DB_BLOCK_FILES = 'f';
 static const char DB_TXINDEX = 't';
+static const char DB_GAMETX = 'G';
+static const char DB_GAMETXINDEX = 'g';
 static const char DB_BLOCK_INDEX = 'b';
 
 static const char DB_NAME = 'n';
 static const char DB_NAME_HISTORY = 'h';
+static const char DB_NAME_HISTORY_ENTRY = 'H';
+static const char DB_NAME_HISTORY_SIZE = 'S';
+static const char DB_NAME_HISTORY_UPGRADE = 'U';
+static const char DB_NAME_ADDRESS = 'A';
 
 static const char DB_BEST_BLOCK = 'B';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
 
+/* Write the name history upgrade in batches of this many names or bytes.  */
+static const size_t NAME_HISTORY_UPGRADE_NAMES = 1000;
+static const size_t NAME_HISTORY_UPGRADE_BYTES = 16 << 20;
 
 CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true) 
 {
@@ -58,9 +68,136 @@ bool CCoinsViewDB::GetName(const valtype &name, CNameData& data) const {
     return db.Read(std::make_pair(DB_NAME, name), data);
 }
 
-bool CCoinsViewDB::GetNameHistory(const valtype &name, CNameHistory& data) const {
+/**
+ * Database key of a single name history entry.  The index is written
+ * big-endian, so that the entries of a name are sorted by their index
+ * and a range of them can be read with a single seek.
+ */
+class CNameHistoryKey
+{
+public:
+    valtype name;
+    uint32_t nIndex;
+
+    CNameHistoryKey() : nIndex(0) {}
+    CNameHistoryKey(const valtype& nameIn, uint32_t nIndexIn) : name(nameIn), nIndex(nIndexIn) {}
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const {
+        return 1 + ::GetSerializeSize(name, nType, nVersion) + sizeof(nIndex);
+    }
+
+    template<typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const {
+        ::Serialize(s, DB_NAME_HISTORY_ENTRY, nType, nVersion);
+        ::Serialize(s, name, nType, nVersion);
+        const uint32_t nIndexBE = htobe32(nIndex);
+        s.write(reinterpret_cast<const char*>(&nIndexBE), sizeof(nIndexBE));
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion) {
+        char chType;
+        ::Unserialize(s, chType, nType, nVersion);
+        if (chType != DB_NAME_HISTORY_ENTRY)
+            throw std::ios_base::failure("not a name history key");
+        ::Unserialize(s, name, nType, nVersion);
+        uint32_t nIndexBE;
+        s.read(reinterpret_cast<char*>(&nIndexBE), sizeof(nIndexBE));
+        nIndex = be32toh(nIndexBE);
+    }
+};
+
+unsigned CCoinsViewDB::GetNameHistorySize(const valtype &name) const {
     assert (fNameHistory);
-    return db.Read(std::make_pair(DB_NAME_HISTORY, name), data);
+    uint32_t nSize;
+    if (!db.Read(std::make_pair(DB_NAME_HISTORY_SIZE, name), nSize))
+        return 0;
+    return nSize;
+}
+
+bool CCoinsViewDB::GetNameHistoryEntries(const valtype &name, unsigned nFrom, unsigned nCount, std::vector<CNameData> &entries) const {
+    assert (fNameHistory);
+    entries.clear();
+    if (nCount == 0)
+        return true;
+
+    boost::scoped_ptr<CDBIterator> pcursor(const_cast<CDBWrapper*>(&db)->NewIterator());
+    for (pcursor->Seek(CNameHistoryKey(name, nFrom)); pcursor->Valid() && entries.size() < nCount; pcursor->Next())
+    {
+        CNameHistoryKey key;
+        if (!pcursor->GetKey(key) || key.name != name)
+            break;
+        if (key.nIndex != nFrom + entries.size())
+            return error("%s : gap in history of name %s", __func__, ValtypeToString(name).c_str());
+
+        entries.push_back(CNameData());
+        if (!pcursor->GetValue(entries.back()))
+            return error("%s : failed to read name history entry", __func__);
+    }
+
+    return true;
+}
+
+bool CCoinsViewDB::UpgradeNameHistory() {
+    /* If an earlier upgrade was interrupted, continue after the last name
+       that was converted.  This avoids scanning over the deleted legacy
+       entries again.  */
+    valtype lastName;
+    const bool fResume = db.Read(DB_NAME_HISTORY_UPGRADE, lastName);
+
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+    if (fResume)
+        pcursor->Seek(std::make_pair(DB_NAME_HISTORY, lastName));
+    else
+        pcursor->Seek(DB_NAME_HISTORY);
+    if (!pcursor->Valid())
+        return !fResume || db.Erase(DB_NAME_HISTORY_UPGRADE, true);
+
+    /* Convert the legacy history stacks, which are stored as a single
+       vector per name, to one entry per key.  The batch is written every
+       NAME_HISTORY_UPGRADE_NAMES names or NAME_HISTORY_UPGRADE_BYTES bytes
+       together with the last converted name, so that memory use is bounded
+       and an interrupted upgrade can be resumed.  */
+    unsigned nNames = 0;
+    size_t nBatchNames = 0, nBatchBytes = 0;
+    boost::scoped_ptr<CDBBatch> batch(new CDBBatch(db));
+    for (; pcursor->Valid(); pcursor->Next())
+    {
+        boost::this_thread::interruption_point();
+
+        std::pair<char, valtype> key;
+        if (!pcursor->GetKey(key) || key.first != DB_NAME_HISTORY)
+            break;
+        if (nNames == 0)
+            LogPrintf("%s name history database...\n", fResume ? "Resuming upgrade of" : "Upgrading");
+
+        CNameHistory history;
+        if (!pcursor->GetValue(history))
+            return error("%s : failed to read legacy name history", __func__);
+
+        const std::vector<CNameData>& data = history.getData();
+        for (unsigned i = 0; i < data.size(); ++i)
+            batch->Write(CNameHistoryKey(key.second, i), data[i]);
+        batch->Write(std::make_pair(DB_NAME_HISTORY_SIZE, key.second), static_cast<uint32_t>(data.size()));
+        batch->Erase(key);
+        ++nNames;
+        ++nBatchNames;
+        nBatchBytes += GetSerializeSize(history, SER_DISK, CLIENT_VERSION);
+
+        if (nBatchNames >= NAME_HISTORY_UPGRADE_NAMES || nBatchBytes >= NAME_HISTORY_UPGRADE_BYTES) {
+            batch->Write(DB_NAME_HISTORY_UPGRADE, key.second);
+            if (!db.WriteBatch(*batch))
+                return false;
+            batch.reset(new CDBBatch(db));
+            nBatchNames = 0;
+            nBatchBytes = 0;
+        }
+    }
+
+    if (nNames > 0)
+        LogPrintf("Upgraded the history of %u names\n", nNames);
+    batch->Erase(DB_NAME_HISTORY_UPGRADE);
+    return db.WriteBatch(*batch, true);
 }
 
 class CDbNameIterator : public CNameIterator
@@ -81,6 +218,12 @@ public:
      */
     CDbNameIterator(const CDBWrapper& db);
 
+    /**
+     * Construct a new name iterator for a database snapshot.
+     * @param snapshot The snapshot to create the iterator for.
+     */
+    CDbNameIterator(const CDBSnapshot& snapshot);
+
     /* Implement iterator methods.  */
     void seek (const valtype& start);
     bool next (valtype& name, CNameData& data);
@@ -97,6 +240,12 @@ CDbNameIterator::CDbNameIterator(const CDBWrapper& db)
     seek(valtype());
 }
 
+CDbNameIterator::CDbNameIterator(const CDBSnapshot& snapshot)
+    : iter(snapshot.NewIterator())
+{
+    seek(valtype());
+}
+
 void CDbNameIterator::seek(const valtype& start) {
     iter->Seek(std::make_pair(DB_NAME, start));
 }
@@ -121,6 +270,89 @@ CNameIterator* CCoinsViewDB::IterateNames() const {
     return new CDbNameIterator(db);
 }
 
+/** Name snapshot of the database, based on a LevelDB snapshot.  */
+class CDbNameSnapshot : public CNameSnapshot
+{
+private:
+    CDBSnapshot snapshot;
+
+public:
+    CDbNameSnapshot(const CDBWrapper& db) : snapshot(db) {}
+
+    CNameIterator* iterateNames() const {
+        return new CDbNameIterator(snapshot);
+    }
+};
+
+CNameSnapshot* CCoinsViewDB::SnapshotNames() const {
+    return new CDbNameSnapshot(db);
+}
+
+typedef std::pair<char, std::pair<CScriptBase, valtype> > CNameAddressKey;
+
+/** Construct the address index key for a name.  */
+static CNameAddressKey NameAddressKey(const CScript& addr, const valtype& name) {
+    return std::make_pair(DB_NAME_ADDRESS, std::make_pair(static_cast<const CScriptBase&>(addr), name));
+}
+
+/**
+ * Iterator over the names owned by an address, based on the address
+ * index.  The index keys are (address, name), so the names of an address
+ * are sorted like the name database.  The data of each name is looked up
+ * from the main name entry.
+ */
+class CDbAddressNameIterator : public CNameIterator
+{
+
+private:
+
+    const CDBWrapper& db;
+    const CScript addr;
+    boost::scoped_ptr<CDBIterator> iter;
+
+public:
+
+    CDbAddressNameIterator(const CDBWrapper& dbIn, const CScript& addrIn);
+
+    /* Implement iterator methods.  */
+    void seek (const valtype& start);
+    bool next (valtype& name, CNameData& data);
+
+};
+
+CDbAddressNameIterator::CDbAddressNameIterator(const CDBWrapper& dbIn, const CScript& addrIn)
+    : db(dbIn), addr(addrIn), iter(const_cast<CDBWrapper*>(&db)->NewIterator())
+{
+    seek(valtype());
+}
+
+void CDbAddressNameIterator::seek(const valtype& start) {
+    iter->Seek(NameAddressKey(addr, start));
+}
+
+bool CDbAddressNameIterator::next(valtype& name, CNameData& data) {
+    if (!iter->Valid())
+        return false;
+
+    CNameAddressKey key;
+    if (!iter->GetKey(key) || key.first != DB_NAME_ADDRESS || key.second.first != addr)
+        return false;
+    name = key.second.second;
+
+    /* Do not just end the iteration, since the caller would then silently
+       return truncated results.  */
+    if (!db.Read(std::make_pair(DB_NAME, name), data))
+        throw std::runtime_error(strprintf("%s : name %s in address index but not in DB", __func__, ValtypeToString(name)));
+
+    iter->Next();
+    return true;
+}
+
+CNameIterator* CCoinsViewDB::IterateNamesForAddress(const CScript &addr) const {
+    assert(fNameAddressIndex);
+    return new CDbAddressNameIterator(db, addr);
+}
+
 bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CNameCache &names) {
     CDBBatch batch(db);
     size_t count = 0;
@@ -140,6 +372,8 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, con
     if (!hashBlock.IsNull())
         batch.Write(DB_BEST_BLOCK, hashBlock);
 
+    if (fNameAddressIndex)
+        names.writeAddressIndex(batch, *this);
     names.writeBatch(batch);
 
     LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
@@ -225,19 +459,26 @@ bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockF
     return WriteBatch(batch, true);
 }
 
-bool CCoinsViewDB::ValidateNameDB(CGameDB& gameDb) const
+bool CCoinsViewDB::ValidateNameDB(CGameDB& gameDb, uint256& hashBlock) const
 {
-    /* Skip for genesis block, since there is no game state available yet
-       (test would fail below).  There's not really anything to verify
-       for the genesis block anyway.  */
-    const uint256 blockHash = GetBestBlock();
-    if (blockHash.IsNull())
+    /* Work on a snapshot, so that the check sees a consistent state even
+       if the cache is flushed while it runs.  This allows to call it
+       from a background thread without holding cs_main.  The best block
+       is read from the snapshot as well.  */
+    const CDBSnapshot snapshot(db);
+    boost::scoped_ptr<CDBIterator> pcursor(snapshot.NewIterator());
+
+    /* Nothing has been flushed since the last check, so there is no
+       need to go through the whole database again.  */
+    uint256 blockHash;
+    char chType;
+    pcursor->Seek(DB_BEST_BLOCK);
+    if (pcursor->Valid() && pcursor->GetKey(chType) && chType == DB_BEST_BLOCK
+        && !pcursor->GetValue(blockHash))
+        return error("%s : failed to read best block", __func__);
+    if (!hashBlock.IsNull() && blockHash == hashBlock)
         return true;
 
-    /* It seems that there are no "const iterators" for LevelDB.  Since we
-       only need read operations on it, use a const-cast to get around
-       that restriction.  */
-    boost::scoped_ptr<CDBIterator> pcursor(const_cast<CDBWrapper*>(&db)->NewIterator());
     pcursor->SeekToFirst();
 
     /* Loop over the total database and read interesting
@@ -246,13 +487,15 @@ bool CCoinsViewDB::ValidateNameDB(CGameDB& gameDb) const
 
     std::set<valtype> namesTotal;
     std::set<valtype> namesInDB;
-    std::set<valtype> namesWithHistory;
+    std::map<valtype, unsigned> namesWithHistory;
+    std::map<valtype, unsigned> historyEntries;
+    std::set<std::pair<CScriptBase, valtype> > namesByAddress;
+    std::set<std::pair<CScriptBase, valtype> > addressIndex;
     std::map<valtype, CAmount> namesInUTXO;
 
     for (; pcursor->Valid(); pcursor->Next())
     {
         boost::this_thread::interruption_point();
-        char chType;
         if (!pcursor->GetKey(chType))
             continue;
 
@@ -300,21 +543,56 @@ bool CCoinsViewDB::ValidateNameDB(CGameDB& gameDb) const
             assert(namesInDB.count(name) == 0);
             if (!data.isDead ())
                 namesInDB.insert(name);
+            namesByAddress.insert(NameAddressKey(data.getAddress(), name).second);
+            break;
+        }
+
+        case DB_NAME_ADDRESS:
+        {
+            CNameAddressKey key;
+            if (!pcursor->GetKey(key) || key.first != DB_NAME_ADDRESS)
+                return error("%s : failed to read DB_NAME_ADDRESS key",
+                             __func__);
+            addressIndex.insert(key.second);
             break;
         }
 
         case DB_NAME_HISTORY:
+            return error("%s : name history is in the legacy format",
+                         __func__);
+
+        case DB_NAME_HISTORY_ENTRY:
+        {
+            CNameHistoryKey key;
+            if (!pcursor->GetKey(key))
+                return error("%s : failed to read DB_NAME_HISTORY_ENTRY key",
+                             __func__);
+
+            /* The entries of each name are sorted by index, so they
+               must be found in order and without gaps.  */
+            unsigned& nEntries = historyEntries[key.name];
+            if (key.nIndex != nEntries)
+                return error("%s : history of name %s is not contiguous",
+                             __func__, ValtypeToString(key.name).c_str());
+            ++nEntries;
+            break;
+        }
+
+        case DB_NAME_HISTORY_SIZE:
         {
             std::pair<char, valtype> key;
-            if (!pcursor->GetKey(key) || key.first != DB_NAME_HISTORY)
-                return error("%s : failed to read DB_NAME_HISTORY key",
+            uint32_t nSize;
+            if (!pcursor->GetKey(key) || key.first != DB_NAME_HISTORY_SIZE)
+                return error("%s : failed to read DB_NAME_HISTORY_SIZE key",
+                             __func__);
+            if (!pcursor->GetValue(nSize))
+                return error("%s : failed to read name history size",
                              __func__);
-            const valtype& name = key.second;
 
-            if (namesWithHistory.count(name) > 0)
-                return error("%s : name %s has duplicate history",
-                             __func__, ValtypeToString(name).c_str());
-            namesWithHistory.insert(name);
+            if (nSize == 0)
+                return error("%s : name %s has empty history",
+                             __func__, ValtypeToString(key.second).c_str());
+            namesWithHistory.insert(std::make_pair(key.second, nSize));
             break;
         }
 
@@ -323,12 +601,18 @@ bool CCoinsViewDB::ValidateNameDB(CGameDB& gameDb) const
         }
     }
 
+    /* Skip for genesis block, since there is no game state available yet
+       (test would fail below).  There's not really anything to verify
+       for the genesis block anyway.  */
+    if (blockHash.IsNull())
+        return true;
+
     std::map<valtype, CAmount> namesInGame;
-    GameState state(Params().GetConsensus());
-    if (!gameDb.get(blockHash, state))
+    const GameStatePtr state = gameDb.get(blockHash);
+    if (!state)
         return error("%s : failed to read game state", __func__);
-    for (PlayerStateMap::const_iterator mi = state.players.begin();
-         mi != state.players.end(); ++mi)
+    for (PlayerStateMap::const_iterator mi = state->players.begin();
+         mi != state->players.end(); ++mi)
     {
         const valtype cur = ValtypeFromString(mi->first);
         if (namesInGame.count(cur) > 0)
@@ -355,18 +639,32 @@ bool CCoinsViewDB::ValidateNameDB(CGameDB& gameDb) const
 
     if (fNameHistory)
     {
-        BOOST_FOREACH(const valtype& name, namesWithHistory)
-            if (namesTotal.count(name) == 0)
+        BOOST_FOREACH(const PAIRTYPE(valtype, unsigned)& pair, namesWithHistory)
+            if (namesTotal.count(pair.first) == 0)
                 return error("%s : history entry for name '%s' not in main DB",
-                             __func__, ValtypeToString(name).c_str());
-    } else if (!namesWithHistory.empty ())
+                             __func__, ValtypeToString(pair.first).c_str());
+        if (namesWithHistory != historyEntries)
+            return error("%s : name history sizes do not match the entries",
+                         __func__);
+    } else if (!namesWithHistory.empty () || !historyEntries.empty ())
         return error("%s : name_history entries in DB, but"
                      " -namehistory not set", __func__);
 
-    LogPrintf("Checked name database, %u living player names, %u total.\n",
-              namesInDB.size(), namesTotal.size());
+    if (fNameAddressIndex)
+    {
+        if (addressIndex != namesByAddress)
+            return error("%s : name address index does not match the names",
+                         __func__);
+    } else if (!addressIndex.empty ())
+        return error("%s : name address index in DB, but"
+                     " -nameaddressindex not set", __func__);
+
+    LogPrintf("Checked name database at block %s, %u living player names,"
+              " %u total.\n",
+              blockHash.GetHex(), namesInDB.size(), namesTotal.size());
     LogPrintf("Names with history: %u\n", namesWithHistory.size());
 
+    hashBlock = blockHash;
     return true;
 }
 
@@ -377,17 +675,61 @@ CNameCache::writeBatch (CDBBatch& batch) const
        i != entries.end (); ++i)
     batch.Write (std::make_pair (DB_NAME, i->first), i->second);
 
-  for (std::set<valtype>::const_iterator i = deleted.begin ();
+  for (DeletedSet::const_iterator i = deleted.begin ();
        i != deleted.end (); ++i)
     batch.Erase (std::make_pair (DB_NAME, *i));
 
+  /* Only the changed history entries are written.  Popped entries
+     are erased and the stack size is updated.  */
   assert (fNameHistory || history.empty ());
-  for (std::map<valtype, CNameHistory>::const_iterator i = history.begin ();
+  for (HistoryMap::const_iterator i = history.begin ();
        i != history.end (); ++i)
-    if (i->second.empty ())
-      batch.Erase (std::make_pair (DB_NAME_HISTORY, i->first));
-    else
-      batch.Write (std::make_pair (DB_NAME_HISTORY, i->first), i->second);
+    {
+      const valtype& name = i->first;
+      const HistoryChanges& changes = i->second;
+
+      for (std::map<unsigned, CNameData>::const_iterator ei
+            = changes.entries.begin (); ei != changes.entries.end (); ++ei)
+        batch.Write (CNameHistoryKey (name, ei->first), ei->second);
+      for (unsigned j = changes.nSize; j < changes.nBaseSize; ++j)
+        batch.Erase (CNameHistoryKey (name, j));
+
+      if (changes.nSize == 0)
+        batch.Erase (std::make_pair (DB_NAME_HISTORY_SIZE, name));
+      else
+        batch.Write (std::make_pair (DB_NAME_HISTORY_SIZE, name),
+                     static_cast<uint32_t> (changes.nSize));
+    }
+}
+
+void
+CNameCache::writeAddressIndex (CDBBatch& batch, const CCoinsView& base) const
+{
+  /* The previous address of each changed name is read from the base
+     view, which does not yet contain the changes.  Undoing a name
+     update goes through the same path, since CNameTxUndo sets the
+     previous data again.  */
+  const char dummy = 0;
+  for (EntryMap::const_iterator i = entries.begin ();
+       i != entries.end (); ++i)
+    {
+      CNameData oldData;
+      if (base.GetName (i->first, oldData))
+        {
+          if (oldData.getAddress () == i->second.getAddress ())
+            continue;
+          batch.Erase (NameAddressKey (oldData.getAddress (), i->first));
+        }
+      batch.Write (NameAddressKey (i->second.getAddress (), i->first), dummy);
+    }
+
+  for (DeletedSet::const_iterator i = deleted.begin ();
+       i != deleted.end (); ++i)
+    {
+      CNameData oldData;
+      if (base.GetName (*i, oldData))
+        batch.Erase (NameAddressKey (oldData.getAddress (), *i));
+    }
 }
 
 bool CBlockTreeDB::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos) {
@@ -401,6 +743,37 @@ bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos>
     return WriteBatch(batch);
 }
 
+bool CBlockTreeDB::WriteGameTx(const uint256 &hashBlock, const std::vector<CTransaction> &vGameTx) {
+    CDBBatch batch(*this);
+    batch.Write(make_pair(DB_GAMETX, hashBlock), vGameTx);
+    for (const auto &tx : vGameTx)
+        batch.Write(make_pair(DB_GAMETXINDEX, tx.GetHash()), hashBlock);
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::ReadGameTx(const uint256 &hashBlock, std::vector<CTransaction> &vGameTx) {
+    return Read(make_pair(DB_GAMETX, hashBlock), vGameTx);
+}
+
+bool CBlockTreeDB::ReadGameTx(const std::vector<uint256> &vBlocks, std::vector<std::vector<CTransaction> > &vGameTx) {
+    /* Read in key order, which keeps the LevelDB seeks local.  */
+    std::vector<std::pair<uint256, size_t> > vSorted;
+    for (size_t i = 0; i < vBlocks.size(); ++i)
+        vSorted.push_back(std::make_pair(vBlocks[i], i));
+    std::sort(vSorted.begin(), vSorted.end());
+
+    vGameTx.clear();
+    vGameTx.resize(vBlocks.size());
+    for (size_t i = 0; i < vSorted.size(); ++i)
+        if (!ReadGameTx(vSorted[i].first, vGameTx[vSorted[i].second]))
+            return false;
+    return true;
+}
+
+bool CBlockTreeDB::ReadGameTxIndex(const uint256 &txid, uint256 &hashBlock) {
+    return Read(make_pair(DB_GAMETXINDEX, txid), hashBlock);
+}
+
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
     return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
 }
@@ -90,11 +90,16 @@ public:
     bool HaveCoins(const uint256 &txid) const;
     uint256 GetBestBlock() const;
     bool GetName(const valtype &name, CNameData &data) const;
-    bool GetNameHistory(const valtype &name, CNameHistory &data) const;
+    unsigned GetNameHistorySize(const valtype &name) const;
+    bool GetNameHistoryEntries(const valtype &name, unsigned nFrom, unsigned nCount, std::vector<CNameData> &entries) const;
     CNameIterator* IterateNames() const;
+    CNameIterator* IterateNamesForAddress(const CScript &addr) const;
+    CNameSnapshot* SnapshotNames() const;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CNameCache &names);
     CCoinsViewCursor *Cursor() const;
-    bool ValidateNameDB(CGameDB& gameDb) const;
+    bool ValidateNameDB(CGameDB& gameDb, uint256& hashBlock) const;
+    //! Convert name history stored as one vector per name to per-entry keys
+    bool UpgradeNameHistory();
 };
 
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
@@ -135,6 +140,13 @@ public:
     bool ReadReindexing(bool &fReindex);
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
+    /** Store the game tx of a block and index them by txid.  */
+    bool WriteGameTx(const uint256 &hashBlock, const std::vector<CTransaction> &vGameTx);
+    bool ReadGameTx(const uint256 &hashBlock, std::vector<CTransaction> &vGameTx);
+    /** Read the game tx of many blocks.  Fails if any of them is missing.  */
+    bool ReadGameTx(const std::vector<uint256> &vBlocks, std::vector<std::vector<CTransaction> > &vGameTx);
+    /** Look up the block containing a game tx.  */
+    bool ReadGameTxIndex(const uint256 &txid, uint256 &hashBlock);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
     bool LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256&)> insertBlockIndex);
@@ -25,6 +25,7 @@
 
 class CAutoFile;
 class CBlockIndex;
+struct Move;
 
 inline double AllowFreeThreshold()
 {
@@ -110,6 +111,8 @@ private:
 
     /* Cache name operation (if any) performed by this tx.  */
     CNameScript nameOp;
+    /* The parsed move (if any), as validated when entering the pool.  */
+    std::shared_ptr<const Move> move;
 
 public:
     CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
@@ -182,6 +185,16 @@ public:
     {
         return nameOp.getOpName();
     }
+    inline const std::shared_ptr<const Move>&
+    getMove() const
+    {
+        return move;
+    }
+    inline void
+    setMove(const std::shared_ptr<const Move>& m)
+    {
+        move = m;
+    }
 
     mutable size_t vTxHashesIdx; //!< Index in mempool's vTxHashes
 };
@@ -680,6 +693,24 @@ public:
         AssertLockHeld(cs);
         return names.getTxForName(name);
     }
+    inline unsigned
+    getMovesUpdated() const
+    {
+        AssertLockHeld(cs);
+        return names.getMovesUpdated();
+    }
+    inline CNameMemPool::NameNewsStats
+    getNameNewsStats() const
+    {
+        LOCK(cs);
+        return names.getNameNewsStats();
+    }
+    inline void
+    setNameBestHeight(unsigned nHeight)
+    {
+        LOCK(cs);
+        names.setBestHeight(nHeight);
+    }
 
     /**
      * Check if a tx can be added to it according to name criteria.
@@ -690,9 +721,35 @@ public:
      */
     inline bool
     checkNameOps (const CTransaction& tx) const
+    {
+        return checkNameOps(tx, std::set<uint256>());
+    }
+
+    /**
+     * Check if a tx can be added to it according to name criteria, when
+     * it replaces the given mempool tx.  This allows to replace a pending
+     * name operation (e. g., a move) with a newer one double-spending it.
+     * @param tx The tx that should be added.
+     * @param setConflicts The mempool tx that it replaces.
+     * @return True if it doesn't conflict.
+     */
+    inline bool
+    checkNameOps (const CTransaction& tx,
+                  const std::set<uint256>& setConflicts) const
+    {
+        AssertLockHeld(cs);
+        return names.checkTx (tx, setConflicts);
+    }
+
+    /**
+     * Return the pending name operations sorted by name.
+     * @return The index of pending name operations by name.
+     */
+    inline const CNameMemPool::NameOpsByName&
+    getNameOps() const
     {
         AssertLockHeld(cs);
-        return names.checkTx (tx);
+        return names.getNameOps();
     }
 
     std::shared_ptr<const CTransaction> get(const uint256& hash) const;
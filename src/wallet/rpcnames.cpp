@@ -499,13 +499,14 @@ name_update (const UniValue& params, bool fHelp)
   }
 
   CNameData oldData;
-  GameState gameState(Params ().GetConsensus ());
+  GameStatePtr gameState;
   {
     LOCK (cs_main);
     if (!pcoinsTip->GetName (name, oldData) || oldData.isDead ())
       throw JSONRPCError (RPC_TRANSACTION_ERROR,
                           "this name can not be updated");
-    if (!pgameDb->get (pcoinsTip->GetBestBlock (), gameState))
+    gameState = pgameDb->get (pcoinsTip->GetBestBlock ());
+    if (!gameState)
       throw JSONRPCError (RPC_INTERNAL_ERROR, "failed to load game state");
   }
 
@@ -542,8 +543,8 @@ name_update (const UniValue& params, bool fHelp)
     = CNameScript::buildNameUpdate (addrName, name, value);
 
   /* Find amount locked in the name and add required game fee.  */
-  const PlayerStateMap::const_iterator mi = gameState.players.find (nameStr);
-  if (mi == gameState.players.end ())
+  const PlayerStateMap::const_iterator mi = gameState->players.find (nameStr);
+  if (mi == gameState->players.end ())
     throw JSONRPCError (RPC_INTERNAL_ERROR,
                         "failed to find player in game state");
   CAmount amount = mi->second.lockedCoins;